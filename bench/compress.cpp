@@ -0,0 +1,900 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file compress.cpp
+ *  @brief Compression benchmark
+ *
+ *  @details
+ *  Compresses a reproducible corpus with every codec and reports the
+ *  compression ratio, the compression throughput and the decompression
+ *  throughput of each. Throughput is measured in uncompressed bytes per
+ *  second; the fastest repetition is reported.
+ *
+ *  The corpus consists of synthetic RGBA8 images (gradients, noise and UI
+ *  content), and of synthetic photo and UI images encoded in every tex3ds
+ *  output format the same way tex3ds encodes them.
+ *
+ *  A validation report follows, comparing the codec predicted by the
+ *  compression estimator (-z auto-fast) with the exhaustive choice (-z auto).
+ *
+ *  Last, a bleed report compares the -z auto output size of synthetic
+ *  sprites, whose invisible pixels have leftover colors, in every format with
+ *  alpha under each bleed mode (-B).
+ *
+ *  Usage: compressbench [--csv|--json] [repetitions]
+ */
+
+#include "compress.h"
+#include "encode.h"
+#include "magick_compat.h"
+#include "quantum.h"
+#include "rg_etc1.h"
+#include "swizzle.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+/** @brief Synthetic image size */
+constexpr size_t IMAGE_SIZE = 256;
+
+/** @brief Sample data */
+struct Corpus
+{
+	std::string name;          ///< Corpus name
+	std::vector<uint8_t> data; ///< Uncompressed data
+};
+
+/** @brief Output format */
+enum OutputFormat
+{
+	OUTPUT_TABLE, ///< Human-readable table
+	OUTPUT_CSV,   ///< Comma-separated values
+	OUTPUT_JSON,  ///< JSON array of results
+};
+
+/** @brief Uncompressed "compression", as written by tex3ds -z none
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Buffer with compression header
+ */
+std::vector<uint8_t> noneEncode (const void *src, size_t len)
+{
+	const uint8_t *source = reinterpret_cast<const uint8_t *> (src);
+
+	std::vector<uint8_t> result;
+	compressionHeader (result, 0x00, len);
+	result.insert (std::end (result), source, source + len);
+
+	if (result.size () & 0x3)
+		result.resize ((result.size () + 3) & ~0x3);
+
+	return result;
+}
+
+/** @brief Smallest output of every codec, as chosen by tex3ds -z auto
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Compressed buffer
+ */
+std::vector<uint8_t> autoEncode (const void *src, size_t len)
+{
+	std::vector<uint8_t> (*const encoders[]) (const void *, size_t) = {
+	    noneEncode, lzssEncode, lz11Encode, huffEncode, rleEncode};
+
+	std::vector<uint8_t> best;
+	for (const auto &encoder : encoders)
+	{
+		std::vector<uint8_t> output = encoder (src, len);
+		if (best.empty () || (!output.empty () && output.size () < best.size ()))
+			best.swap (output);
+	}
+
+	return best;
+}
+
+/** @brief Encoder */
+typedef std::vector<uint8_t> (*Encoder) (const void *src, size_t len);
+
+/** @brief Get encoder by name
+ *  @param[in] name Compression name, as in CompressionEstimate
+ *  @returns Encoder
+ */
+Encoder encoder (const char *name)
+{
+	const std::pair<const char *, Encoder> encoders[] = {
+	    {"none", noneEncode},
+	    {"lzss", lzssEncode},
+	    {"lz11", lz11Encode},
+	    {"huff", huffEncode},
+	    {"rle", rleEncode},
+	};
+
+	for (const auto &entry : encoders)
+	{
+		if (std::strcmp (entry.first, name) == 0)
+			return entry.second;
+	}
+
+	std::abort ();
+}
+
+/** @brief Smallest output of the predicted codecs, as chosen by tex3ds -z auto-fast
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Compressed buffer
+ */
+std::vector<uint8_t> autoFastEncode (const void *src, size_t len)
+{
+	std::vector<uint8_t> best;
+	for (const auto &candidate : compressionCandidates (estimateCompression (src, len)))
+	{
+		std::vector<uint8_t> output = encoder (candidate.name) (src, len);
+		if (best.empty () || (!output.empty () && output.size () < best.size ()))
+			best.swap (output);
+	}
+
+	return best;
+}
+
+/** @brief Codec */
+struct Codec
+{
+	const char *name;                                             ///< Codec name
+	std::vector<uint8_t> (*encode) (const void *src, size_t len); ///< Encoder
+};
+
+/** @brief Codecs to benchmark; all are decoded by decompress () */
+const Codec codecs[] = {
+    {"lzss", lzssEncode},
+    {"lz11", lz11Encode},
+    {"rle", rleEncode},
+    {"huff", huffEncode},
+    {"lzss-p", lzssEncodeParallel},
+    {"lz11-p", lz11EncodeParallel},
+    {"auto", autoEncode},
+    {"auto-fast", autoFastEncode},
+};
+
+/** @brief Texture format */
+struct Format
+{
+	const char *name;                    ///< Format name, as given to tex3ds -f
+	void (*encode) (encode::WorkUnit &); ///< Tile encoder
+	bool swizzled;                       ///< Whether tiles are swizzled
+	unsigned alphaBits;                  ///< Alpha precision; 0 without alpha
+};
+
+/** @brief Texture formats */
+const Format formats[] = {
+    {"rgba8", encode::rgba8888, true, 8},
+    {"rgb8", encode::rgb888, true, 0},
+    {"rgba5551", encode::rgba5551, true, 1},
+    {"rgb565", encode::rgb565, true, 0},
+    {"rgba4", encode::rgba4444, true, 4},
+    {"la8", encode::la88, true, 8},
+    {"hilo8", encode::hilo88, true, 0},
+    {"l8", encode::l8, true, 0},
+    {"a8", encode::a8, true, 8},
+    {"la4", encode::la44, true, 4},
+    {"l4", encode::l4, true, 0},
+    {"a4", encode::a4, true, 4},
+    {"etc1", encode::etc1, false, 0},
+    {"etc1a4", encode::etc1a4, false, 4},
+};
+
+/** @brief Deterministic random number generator */
+class Random
+{
+public:
+	explicit Random (uint32_t seed) : state (seed)
+	{
+	}
+
+	/** @brief Get a random number in [min, max] */
+	uint32_t next (uint32_t min, uint32_t max)
+	{
+		// xorshift32
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		return min + state % (max - min + 1);
+	}
+
+private:
+	uint32_t state; ///< Generator state
+};
+
+/** @brief Synthetic RGBA8 image */
+class Canvas
+{
+public:
+	Canvas () : data (IMAGE_SIZE * IMAGE_SIZE * 4)
+	{
+	}
+
+	/** @brief Set a pixel
+	 *  @param[in] x    X coordinate
+	 *  @param[in] y    Y coordinate
+	 *  @param[in] rgba Color (0xRRGGBBAA)
+	 */
+	void set (size_t x, size_t y, uint32_t rgba)
+	{
+		uint8_t *p = &data[(y * IMAGE_SIZE + x) * 4];
+		p[0]       = rgba >> 24;
+		p[1]       = rgba >> 16;
+		p[2]       = rgba >> 8;
+		p[3]       = rgba >> 0;
+	}
+
+	/** @brief Fill a rectangle
+	 *  @param[in] x    Left edge
+	 *  @param[in] y    Top edge
+	 *  @param[in] w    Width
+	 *  @param[in] h    Height
+	 *  @param[in] rgba Color (0xRRGGBBAA)
+	 */
+	void fill (size_t x, size_t y, size_t w, size_t h, uint32_t rgba)
+	{
+		for (size_t j = y; j < std::min (y + h, IMAGE_SIZE); ++j)
+		{
+			for (size_t i = x; i < std::min (x + w, IMAGE_SIZE); ++i)
+				set (i, j, rgba);
+		}
+	}
+
+	std::vector<uint8_t> data; ///< RGBA8 pixel data
+};
+
+/** @brief Smooth opaque gradient
+ *  @returns Image
+ */
+Canvas gradient ()
+{
+	Canvas canvas;
+	for (size_t y = 0; y < IMAGE_SIZE; ++y)
+	{
+		for (size_t x = 0; x < IMAGE_SIZE; ++x)
+			canvas.set (x, y, x << 24 | y << 16 | ((x + y) / 2) << 8 | 0xFF);
+	}
+
+	return canvas;
+}
+
+/** @brief Uniform noise
+ *  @returns Image
+ */
+Canvas noise ()
+{
+	Canvas canvas;
+	Random random (1);
+	for (auto &byte : canvas.data)
+		byte = random.next (0, 0xFF);
+
+	return canvas;
+}
+
+/** @brief Gradient with a little noise, like a photo or painted background
+ *  @returns Image
+ */
+Canvas photo ()
+{
+	Canvas canvas;
+	Random random (2);
+	for (size_t y = 0; y < IMAGE_SIZE; ++y)
+	{
+		for (size_t x = 0; x < IMAGE_SIZE; ++x)
+		{
+			const uint32_t r = (x / 2 + 40 + random.next (0, 8)) & 0xFF;
+			const uint32_t g = (y / 3 + 60 + random.next (0, 8)) & 0xFF;
+			const uint32_t b = ((x + y) / 4 + 20 + random.next (0, 8)) & 0xFF;
+			canvas.set (x, y, r << 24 | g << 16 | b << 8 | 0xFF);
+		}
+	}
+
+	return canvas;
+}
+
+/** @brief UI elements: bordered panels, buttons and text on a transparent background
+ *  @returns Image
+ */
+Canvas ui ()
+{
+	Canvas canvas;
+	Random random (3);
+	for (size_t i = 0; i < 24; ++i)
+	{
+		const size_t x = random.next (0, IMAGE_SIZE - 48);
+		const size_t y = random.next (0, IMAGE_SIZE - 24);
+		const size_t w = random.next (24, 96);
+		const size_t h = random.next (12, 48);
+
+		const uint32_t fill   = random.next (0, 0xFFFFFF) << 8 | 0xFF;
+		const uint32_t border = (fill >> 1 & 0x7F7F7F00) | 0xFF;
+
+		// drop shadow
+		canvas.fill (x + 2, y + 2, w, h, 0x00000060);
+
+		// panel with a 1px border
+		canvas.fill (x, y, w, h, border);
+		canvas.fill (x + 1, y + 1, w - 2, h - 2, fill);
+
+		// a line of antialiased text
+		for (size_t tx = x + 4; tx + 4 < std::min (x + w, IMAGE_SIZE); tx += random.next (3, 6))
+		{
+			const size_t len = random.next (2, 7);
+			for (size_t ty = y + 4; ty < std::min (y + 4 + len, y + h - 1); ++ty)
+				canvas.set (tx, ty, 0x101010FF);
+			canvas.set (tx + 1, y + 4, 0x808080FF);
+		}
+	}
+
+	return canvas;
+}
+
+/** @brief UI elements whose invisible pixels have leftover colors, like exported sprite sheets
+ *  @returns Image
+ */
+Canvas sprites ()
+{
+	Canvas canvas = ui ();
+	Random random (4);
+	for (size_t i = 0; i < canvas.data.size (); i += 4)
+	{
+		if (canvas.data[i + 3] != 0)
+			continue;
+
+		for (size_t c = 0; c < 3; ++c)
+			canvas.data[i + c] = random.next (0, 0xFF);
+	}
+
+	return canvas;
+}
+
+/** @brief Encode an image the way tex3ds encodes it
+ *  @param[in]  canvas Image
+ *  @param[in]  format Texture format
+ *  @param[in]  bleed  Bleed mode
+ *  @param[out] error  Mean squared error (0-255 RGB) of the visible pixels, if not null
+ *  @returns Encoded texture data
+ */
+std::vector<uint8_t> encodeTexture (const Canvas &canvas,
+    const Format &format,
+    BleedMode bleed = BLEED_NONE,
+    double *error   = nullptr)
+{
+	Magick::Image img (IMAGE_SIZE, IMAGE_SIZE, "RGBA", Magick::CharPixel, canvas.data.data ());
+	Magick::Image source = img;
+
+	applyBleed (img, bleed, format.alphaBits ? format.alphaBits : 8);
+
+	if (format.swizzled)
+	{
+		swizzle (img, false);
+		swizzle (source, false);
+	}
+
+	Pixels cache (img);
+	PixelPacket p = cache.get (0, 0, img.columns (), img.rows ());
+
+	std::vector<uint8_t> result;
+
+	uint64_t sequence = 0;
+	for (size_t j = 0; j < IMAGE_SIZE; j += 8)
+	{
+		for (size_t i = 0; i < IMAGE_SIZE; i += 8)
+		{
+			encode::WorkUnit work (sequence++,
+			    p + (j * IMAGE_SIZE + i),
+			    IMAGE_SIZE,
+			    rg_etc1::cMediumQuality,
+			    true,
+			    error != nullptr,
+			    format.encode);
+
+			work.process (work);
+			result.insert (std::end (result), std::begin (work.result), std::end (work.result));
+		}
+	}
+
+	if (!error)
+		return result;
+
+	// compare the preview, which holds the decoded pixels, with the source
+	cache.sync ();
+
+	Pixels sourceCache (source);
+	PixelPacket s = sourceCache.get (0, 0, source.columns (), source.rows ());
+
+	double sum   = 0.0;
+	size_t count = 0;
+	for (size_t i = 0; i < IMAGE_SIZE * IMAGE_SIZE; ++i)
+	{
+		const Magick::Color a = s[i];
+		const Magick::Color b = p[i];
+
+		if (quantum_to_bits<8> (quantumAlpha (a)) == 0)
+			continue;
+
+		const int diff[] = {
+		    quantum_to_bits<8> (quantumRed (a)) - quantum_to_bits<8> (quantumRed (b)),
+		    quantum_to_bits<8> (quantumGreen (a)) - quantum_to_bits<8> (quantumGreen (b)),
+		    quantum_to_bits<8> (quantumBlue (a)) - quantum_to_bits<8> (quantumBlue (b)),
+		};
+
+		for (const auto &d : diff)
+			sum += d * d;
+		++count;
+	}
+
+	*error = count ? sum / (3 * count) : 0.0;
+
+	return result;
+}
+
+/** @brief Generate the benchmark corpus
+ *  @returns Corpus
+ */
+std::vector<Corpus> corpora ()
+{
+	std::vector<Corpus> result;
+
+	result.emplace_back (Corpus{"gradient", gradient ().data});
+	result.emplace_back (Corpus{"noise", noise ().data});
+	result.emplace_back (Corpus{"ui", ui ().data});
+
+	const std::pair<const char *, Canvas> sources[] = {
+	    {"photo", photo ()},
+	    {"ui", ui ()},
+	};
+
+	for (const auto &source : sources)
+	{
+		for (const auto &format : formats)
+		{
+			result.emplace_back (Corpus{std::string (source.first) + "/" + format.name,
+			    encodeTexture (source.second, format)});
+		}
+	}
+
+	return result;
+}
+
+/** @brief Benchmark result */
+struct Result
+{
+	std::string corpus; ///< Corpus name
+	const char *codec;  ///< Codec name
+	size_t size;        ///< Uncompressed size
+	size_t compressed;  ///< Compressed size
+	double encode;      ///< Compression throughput (MB/s)
+	double decode;      ///< Decompression throughput (MB/s)
+	bool ok;            ///< Whether the data survived the round trip
+};
+
+/** @brief Compression estimator validation result */
+struct Validation
+{
+	std::string corpus;    ///< Corpus name
+	const char *predicted; ///< Codec with the smallest estimate
+	const char *actual;    ///< Codec with the smallest output
+	size_t candidates;     ///< Number of codecs auto-fast runs
+	bool exhaustive;       ///< Whether auto-fast runs every codec
+	size_t chosen;         ///< Output size chosen by auto-fast
+	size_t best;           ///< Smallest output size
+	double estimate;       ///< Time to estimate (ms)
+};
+
+/** @brief Validate the compression estimator
+ *  @param[in] corpus Sample data
+ *  @returns Validation result
+ */
+Validation validate (const Corpus &corpus)
+{
+	const void *src  = corpus.data.data ();
+	const size_t len = corpus.data.size ();
+
+	const auto start     = Clock::now ();
+	const auto estimates = estimateCompression (src, len);
+	const std::chrono::duration<double, std::milli> elapsed = Clock::now () - start;
+
+	const auto candidates = compressionCandidates (estimates);
+
+	Validation result{corpus.name,
+	    estimates.front ().name,
+	    nullptr,
+	    candidates.size (),
+	    candidates.size () == estimates.size (),
+	    0,
+	    0,
+	    elapsed.count ()};
+
+	// exhaustive search, in the same order as -z auto
+	for (const char *name : {"none", "lzss", "lz11", "huff", "rle"})
+	{
+		const size_t size = encoder (name) (src, len).size ();
+		if (!result.actual || size < result.best)
+		{
+			result.actual = name;
+			result.best   = size;
+		}
+	}
+
+	result.chosen = autoFastEncode (src, len).size ();
+	return result;
+}
+
+/** @brief Print validation report
+ *  @param[in] validations Validation results
+ *  @param[in] format      Output format
+ */
+void report (const std::vector<Validation> &validations, OutputFormat format)
+{
+	size_t predicted = 0;
+	size_t chosen    = 0;
+	size_t fallback  = 0;
+	size_t best      = 0;
+	size_t total     = 0;
+	for (const auto &validation : validations)
+	{
+		predicted += std::strcmp (validation.predicted, validation.actual) == 0;
+		chosen += validation.chosen == validation.best;
+		fallback += validation.exhaustive;
+		best += validation.best;
+		total += validation.chosen;
+	}
+
+	const double overhead = best ? 100.0 * (total - best) / best : 0.0;
+
+	switch (format)
+	{
+	case OUTPUT_TABLE:
+		std::printf ("%-16s %-9s %-9s %5s %8s %8s %8s\n",
+		    "corpus",
+		    "predicted",
+		    "actual",
+		    "tried",
+		    "chosen",
+		    "best",
+		    "est ms");
+		for (const auto &validation : validations)
+		{
+			std::printf ("%-16s %-9s %-9s %5zu %8zu %8zu %8.2f\n",
+			    validation.corpus.c_str (),
+			    validation.predicted,
+			    validation.actual,
+			    validation.candidates,
+			    validation.chosen,
+			    validation.best,
+			    validation.estimate);
+		}
+
+		std::printf ("\nprediction matched %zu/%zu, auto-fast chose the smallest %zu/%zu, "
+		             "fell back to exhaustive search %zu/%zu, size overhead %.3f%%\n",
+		    predicted,
+		    validations.size (),
+		    chosen,
+		    validations.size (),
+		    fallback,
+		    validations.size (),
+		    overhead);
+		break;
+
+	case OUTPUT_CSV:
+		// CSV holds a single table
+		break;
+
+	case OUTPUT_JSON:
+		std::printf ("\"validation\": {\"corpora\": %zu, \"predicted\": %zu, \"chosen\": %zu, "
+		             "\"fallback\": %zu, \"overhead\": %.3f}",
+		    validations.size (),
+		    predicted,
+		    chosen,
+		    fallback,
+		    overhead);
+		break;
+	}
+}
+
+/** @brief Bleed comparison result */
+struct BleedResult
+{
+	const char *format; ///< Texture format
+	const char *mode;   ///< Bleed mode
+	size_t size;        ///< Compressed size (-z auto)
+	size_t baseline;    ///< Compressed size without bleeding
+	double error;       ///< Mean squared error of the visible pixels
+};
+
+/** @brief Compare bleed modes
+ *  @returns Results for every format with alpha
+ */
+std::vector<BleedResult> compareBleed ()
+{
+	const std::pair<const char *, BleedMode> modes[] = {
+	    {"none", BLEED_NONE},
+	    {"constant", BLEED_CONSTANT},
+	    {"dilate", BLEED_DILATE},
+	};
+
+	const Canvas canvas = sprites ();
+
+	std::vector<BleedResult> results;
+	for (const auto &format : formats)
+	{
+		if (!format.alphaBits)
+			continue;
+
+		size_t baseline = 0;
+		for (const auto &mode : modes)
+		{
+			double error                    = 0.0;
+			const std::vector<uint8_t> data = encodeTexture (canvas, format, mode.second, &error);
+			const size_t size               = autoEncode (data.data (), data.size ()).size ();
+
+			if (mode.second == BLEED_NONE)
+				baseline = size;
+
+			results.emplace_back (BleedResult{format.name, mode.first, size, baseline, error});
+		}
+	}
+
+	return results;
+}
+
+/** @brief Print bleed report
+ *  @param[in] results Bleed comparison results
+ *  @param[in] format  Output format
+ */
+void report (const std::vector<BleedResult> &results, OutputFormat format)
+{
+	switch (format)
+	{
+	case OUTPUT_TABLE:
+		std::printf ("%-16s %-9s %8s %8s %9s %8s\n",
+		    "sprites",
+		    "bleed",
+		    "output",
+		    "none",
+		    "reduction",
+		    "mse");
+		for (const auto &result : results)
+		{
+			std::printf ("%-16s %-9s %8zu %8zu %8.1f%% %8.3f\n",
+			    result.format,
+			    result.mode,
+			    result.size,
+			    result.baseline,
+			    100.0 - 100.0 * result.size / result.baseline,
+			    result.error);
+		}
+		break;
+
+	case OUTPUT_CSV:
+		// CSV holds a single table
+		break;
+
+	case OUTPUT_JSON:
+		std::printf ("\"bleed\": [");
+		for (size_t i = 0; i < results.size (); ++i)
+		{
+			std::printf ("%s\n  {\"format\": \"%s\", \"mode\": \"%s\", \"compressed\": %zu, "
+			             "\"baseline\": %zu, \"mse\": %.3f}",
+			    i ? "," : "",
+			    results[i].format,
+			    results[i].mode,
+			    results[i].size,
+			    results[i].baseline,
+			    results[i].error);
+		}
+		std::printf ("\n]");
+		break;
+	}
+}
+
+/** @brief Benchmark a codec
+ *  @param[in] corpus Sample data
+ *  @param[in] codec  Codec
+ *  @param[in] reps   Number of timed repetitions
+ *  @returns Result
+ */
+Result measure (const Corpus &corpus, const Codec &codec, size_t reps)
+{
+	Result result{corpus.name, codec.name, corpus.data.size (), 0, 0, 0, true};
+
+	std::vector<uint8_t> compressed;
+	std::vector<uint8_t> output;
+
+	double encodeTime = 0;
+	double decodeTime = 0;
+	for (size_t rep = 0; rep < reps; ++rep)
+	{
+		auto start = Clock::now ();
+		compressed = codec.encode (corpus.data.data (), corpus.data.size ());
+		const std::chrono::duration<double> encodeElapsed = Clock::now () - start;
+
+		start  = Clock::now ();
+		output = decompress (compressed.data (), compressed.size ());
+		const std::chrono::duration<double> decodeElapsed = Clock::now () - start;
+
+		if (rep == 0 || encodeElapsed.count () < encodeTime)
+			encodeTime = encodeElapsed.count ();
+		if (rep == 0 || decodeElapsed.count () < decodeTime)
+			decodeTime = decodeElapsed.count ();
+	}
+
+	result.compressed = compressed.size ();
+	result.encode     = corpus.data.size () / encodeTime / 1e6;
+	result.decode     = corpus.data.size () / decodeTime / 1e6;
+	result.ok         = output == corpus.data;
+
+	return result;
+}
+
+/** @brief Print a result
+ *  @param[in] result Result
+ *  @param[in] format Output format
+ *  @param[in] first  Whether this is the first result
+ */
+void print (const Result &result, OutputFormat format, bool first)
+{
+	const double ratio = 100.0 * result.compressed / result.size;
+
+	switch (format)
+	{
+	case OUTPUT_TABLE:
+		std::printf ("%-16s %-9s %8zu %8zu %7.1f%% %10.1f %10.1f%s\n",
+		    result.corpus.c_str (),
+		    result.codec,
+		    result.size,
+		    result.compressed,
+		    ratio,
+		    result.encode,
+		    result.decode,
+		    result.ok ? "" : " FAILED");
+		break;
+
+	case OUTPUT_CSV:
+		std::printf ("%s,%s,%zu,%zu,%.2f,%.2f,%.2f,%d\n",
+		    result.corpus.c_str (),
+		    result.codec,
+		    result.size,
+		    result.compressed,
+		    ratio,
+		    result.encode,
+		    result.decode,
+		    result.ok);
+		break;
+
+	case OUTPUT_JSON:
+		std::printf ("%s\n  {\"corpus\": \"%s\", \"codec\": \"%s\", \"size\": %zu, "
+		             "\"compressed\": %zu, \"ratio\": %.2f, \"encode_mbps\": %.2f, "
+		             "\"decode_mbps\": %.2f, \"ok\": %s}",
+		    first ? "" : ",",
+		    result.corpus.c_str (),
+		    result.codec,
+		    result.size,
+		    result.compressed,
+		    ratio,
+		    result.encode,
+		    result.decode,
+		    result.ok ? "true" : "false");
+		break;
+	}
+}
+}
+
+/** @brief Program entry point
+ *  @param[in] argc Number of command-line arguments
+ *  @param[in] argv Command-line arguments
+ *  @returns Exit status
+ */
+int main (int argc, char *argv[])
+{
+	OutputFormat format = OUTPUT_TABLE;
+
+	// number of timed repetitions
+	size_t reps = 3;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp (argv[i], "--csv") == 0)
+			format = OUTPUT_CSV;
+		else if (std::strcmp (argv[i], "--json") == 0)
+			format = OUTPUT_JSON;
+		else
+			reps = std::max (1, std::atoi (argv[i]));
+	}
+
+	rg_etc1::pack_etc1_block_init ();
+
+	switch (format)
+	{
+	case OUTPUT_TABLE:
+		std::printf ("%-16s %-9s %8s %8s %8s %10s %10s\n",
+		    "corpus",
+		    "codec",
+		    "size",
+		    "output",
+		    "ratio",
+		    "enc MB/s",
+		    "dec MB/s");
+		break;
+
+	case OUTPUT_CSV:
+		std::printf ("corpus,codec,size,compressed,ratio,encode_mbps,decode_mbps,ok\n");
+		break;
+
+	case OUTPUT_JSON:
+		std::printf ("{\"version\": \"%s\", \"reps\": %zu, \"results\": [", PACKAGE_VERSION, reps);
+		break;
+	}
+
+	int status = EXIT_SUCCESS;
+	bool first = true;
+
+	std::vector<Validation> validations;
+	for (const auto &corpus : corpora ())
+	{
+		validations.emplace_back (validate (corpus));
+
+		for (const auto &codec : codecs)
+		{
+			const Result result = measure (corpus, codec, reps);
+			if (!result.ok)
+				status = EXIT_FAILURE;
+
+			print (result, format, first);
+			first = false;
+		}
+
+		if (format == OUTPUT_TABLE)
+			std::printf ("\n");
+
+		std::fflush (stdout);
+	}
+
+	if (format == OUTPUT_JSON)
+		std::printf ("\n], ");
+
+	report (validations, format);
+
+	if (format == OUTPUT_TABLE)
+		std::printf ("\n");
+	else if (format == OUTPUT_JSON)
+		std::printf (", ");
+
+	report (compareBleed (), format);
+
+	if (format == OUTPUT_JSON)
+		std::printf ("}\n");
+
+	return status;
+}
@@ -0,0 +1,482 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file encode.cpp
+ *  @brief Encoder, swizzle and quantization microbenchmark
+ *
+ *  @details
+ *  Times every tile encoder, ETC1 and ETC1A4 at each quality, swizzling in
+ *  both directions, and the quantization helpers on a fixed synthetic image.
+ *  Each case runs a number of untimed warmup samples followed by the timed
+ *  samples, and the median, 10th and 90th percentile and the spread of the
+ *  throughput over the samples are reported, so changes can be judged
+ *  against the noise of the machine.
+ *
+ *  Usage: encodebench [--csv|--json] [--warmup N] [--reps N] [filter]
+ *
+ *  Only cases whose name contains the filter are run.
+ */
+
+#include "encode.h"
+#include "magick_compat.h"
+#include "quantum.h"
+#include "rg_etc1.h"
+#include "swizzle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+/** @brief Synthetic image size */
+constexpr size_t IMAGE_SIZE = 256;
+
+/** @brief Side of the area encoded by the slow ETC1 cases */
+constexpr size_t ETC1_SIZE = 64;
+
+/** @brief Output format */
+enum OutputFormat
+{
+	OUTPUT_TABLE, ///< Human-readable table
+	OUTPUT_CSV,   ///< Comma-separated values
+	OUTPUT_JSON,  ///< JSON array of results
+};
+
+/** @brief Deterministic random number generator */
+class Random
+{
+public:
+	explicit Random (uint32_t seed) : state (seed)
+	{
+	}
+
+	/** @brief Get a random number in [min, max] */
+	uint32_t next (uint32_t min, uint32_t max)
+	{
+		// xorshift32
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		return min + state % (max - min + 1);
+	}
+
+private:
+	uint32_t state; ///< Generator state
+};
+
+/** @brief Generate the benchmark image
+ *  @returns Noisy gradient with translucent and invisible areas
+ */
+Magick::Image image ()
+{
+	std::vector<uint8_t> data (IMAGE_SIZE * IMAGE_SIZE * 4);
+
+	Random random (1);
+	for (size_t y = 0; y < IMAGE_SIZE; ++y)
+	{
+		for (size_t x = 0; x < IMAGE_SIZE; ++x)
+		{
+			uint8_t *p = &data[(y * IMAGE_SIZE + x) * 4];
+			p[0]       = (x + random.next (0, 16)) & 0xFF;
+			p[1]       = (y + random.next (0, 16)) & 0xFF;
+			p[2]       = ((x ^ y) + random.next (0, 16)) & 0xFF;
+
+			// opaque, translucent and invisible bands
+			if (y < IMAGE_SIZE / 2)
+				p[3] = 0xFF;
+			else if (x < IMAGE_SIZE / 2)
+				p[3] = random.next (0, 0xFF);
+			else
+				p[3] = 0x00;
+		}
+	}
+
+	return Magick::Image (IMAGE_SIZE, IMAGE_SIZE, "RGBA", Magick::CharPixel, data.data ());
+}
+
+/** @brief Benchmark case */
+struct Case
+{
+	std::string name;             ///< Case name
+	const char *unit;             ///< Unit of the items processed
+	std::function<size_t ()> run; ///< Run once; returns the number of items processed
+};
+
+/** @brief Benchmark result */
+struct Result
+{
+	std::string name; ///< Case name
+	const char *unit; ///< Unit of the items processed
+	size_t items;     ///< Items processed per sample
+	double median;    ///< Median throughput (items/s)
+	double p10;       ///< 10th percentile throughput (items/s)
+	double p90;       ///< 90th percentile throughput (items/s)
+	double spread;    ///< (p90 - p10) / median
+};
+
+/** @brief Prevent the compiler from discarding benchmark results */
+volatile uint64_t sink;
+
+/** @brief Encode a square area of an image with a tile encoder
+ *  @param[in] p       Pixel data
+ *  @param[in] size    Side of the area
+ *  @param[in] encoder Tile encoder
+ *  @param[in] quality ETC1 quality
+ *  @returns Number of tiles encoded
+ */
+size_t encodeTiles (PixelPacket &p,
+    size_t size,
+    void (*encoder) (encode::WorkUnit &),
+    rg_etc1::etc1_quality quality)
+{
+	uint64_t sequence = 0;
+	uint64_t bytes    = 0;
+	for (size_t j = 0; j < size; j += 8)
+	{
+		for (size_t i = 0; i < size; i += 8)
+		{
+			encode::WorkUnit work (
+			    sequence++, p + (j * IMAGE_SIZE + i), IMAGE_SIZE, quality, true, false, encoder);
+
+			work.process (work);
+			bytes += work.result.size ();
+		}
+	}
+
+	sink = bytes;
+	return sequence;
+}
+
+/** @brief Make a case which applies a helper to every input
+ *  @param[in] name   Case name
+ *  @param[in] inputs Inputs; must outlive the case
+ *  @param[in] helper Helper to apply
+ *  @returns Case
+ */
+template <typename T, typename F>
+Case apply (const char *name, const std::vector<T> &inputs, F helper)
+{
+	auto run = [&inputs, helper]() {
+		double sum = 0;
+		for (const auto &input : inputs)
+			sum += helper (input);
+
+		sink = sum;
+		return inputs.size ();
+	};
+
+	return Case{name, "values", run};
+}
+
+/** @brief Get the value at a percentile of sorted samples
+ *  @param[in] sorted  Sorted samples
+ *  @param[in] percent Percentile
+ *  @returns Linearly interpolated value
+ */
+double percentile (const std::vector<double> &sorted, double percent)
+{
+	const double pos   = percent / 100.0 * (sorted.size () - 1);
+	const size_t index = static_cast<size_t> (pos);
+
+	if (index + 1 >= sorted.size ())
+		return sorted.back ();
+
+	return sorted[index] + (pos - index) * (sorted[index + 1] - sorted[index]);
+}
+
+/** @brief Benchmark a case
+ *  @param[in] bench  Case
+ *  @param[in] warmup Number of untimed samples
+ *  @param[in] reps   Number of timed samples
+ *  @returns Result
+ */
+Result measure (const Case &bench, size_t warmup, size_t reps)
+{
+	for (size_t i = 0; i < warmup; ++i)
+		bench.run ();
+
+	size_t items = 0;
+	std::vector<double> rates;
+	for (size_t i = 0; i < reps; ++i)
+	{
+		const auto start = Clock::now ();
+		items            = bench.run ();
+		const std::chrono::duration<double> elapsed = Clock::now () - start;
+
+		rates.emplace_back (items / std::max (elapsed.count (), 1e-9));
+	}
+
+	std::sort (std::begin (rates), std::end (rates));
+
+	Result result{bench.name, bench.unit, items, 0, 0, 0, 0};
+	result.median = percentile (rates, 50);
+	result.p10    = percentile (rates, 10);
+	result.p90    = percentile (rates, 90);
+	result.spread = (result.p90 - result.p10) / result.median;
+
+	return result;
+}
+
+/** @brief Print a result
+ *  @param[in] result Result
+ *  @param[in] format Output format
+ *  @param[in] first  Whether this is the first result
+ */
+void print (const Result &result, OutputFormat format, bool first)
+{
+	switch (format)
+	{
+	case OUTPUT_TABLE:
+		std::printf ("%-22s %-7s %8zu %12.0f %12.0f %12.0f %6.1f%%\n",
+		    result.name.c_str (),
+		    result.unit,
+		    result.items,
+		    result.median,
+		    result.p10,
+		    result.p90,
+		    100.0 * result.spread);
+		break;
+
+	case OUTPUT_CSV:
+		std::printf ("%s,%s,%zu,%.0f,%.0f,%.0f,%.4f\n",
+		    result.name.c_str (),
+		    result.unit,
+		    result.items,
+		    result.median,
+		    result.p10,
+		    result.p90,
+		    result.spread);
+		break;
+
+	case OUTPUT_JSON:
+		std::printf ("%s\n  {\"case\": \"%s\", \"unit\": \"%s\", \"items\": %zu, "
+		             "\"median\": %.0f, \"p10\": %.0f, \"p90\": %.0f, \"spread\": %.4f}",
+		    first ? "" : ",",
+		    result.name.c_str (),
+		    result.unit,
+		    result.items,
+		    result.median,
+		    result.p10,
+		    result.p90,
+		    result.spread);
+		break;
+	}
+}
+}
+
+/** @brief Program entry point
+ *  @param[in] argc Number of command-line arguments
+ *  @param[in] argv Command-line arguments
+ *  @returns Exit status
+ */
+int main (int argc, char *argv[])
+{
+	OutputFormat format = OUTPUT_TABLE;
+	size_t warmup       = 3;
+	size_t reps         = 15;
+	std::string filter;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp (argv[i], "--csv") == 0)
+			format = OUTPUT_CSV;
+		else if (std::strcmp (argv[i], "--json") == 0)
+			format = OUTPUT_JSON;
+		else if (std::strcmp (argv[i], "--warmup") == 0 && i + 1 < argc)
+			warmup = std::max (0, std::atoi (argv[++i]));
+		else if (std::strcmp (argv[i], "--reps") == 0 && i + 1 < argc)
+			reps = std::max (1, std::atoi (argv[++i]));
+		else if (argv[i][0] == '-')
+		{
+			std::fprintf (stderr,
+			    "Usage: %s [--csv|--json] [--warmup N] [--reps N] [filter]\n",
+			    argv[0]);
+			return EXIT_FAILURE;
+		}
+		else
+			filter = argv[i];
+	}
+
+	rg_etc1::pack_etc1_block_init ();
+
+	// encoders read swizzled tiles, except ETC1/ETC1A4
+	Magick::Image linear = image ();
+	Magick::Image swizzled (linear);
+	swizzle (swizzled, false);
+
+	Pixels linearCache (linear);
+	PixelPacket linearPixels = linearCache.get (0, 0, IMAGE_SIZE, IMAGE_SIZE);
+
+	Pixels swizzledCache (swizzled);
+	PixelPacket swizzledPixels = swizzledCache.get (0, 0, IMAGE_SIZE, IMAGE_SIZE);
+
+	// fixed inputs for the quantization helpers
+	std::vector<Magick::Quantum> quanta;
+	std::vector<uint8_t> values;
+	std::vector<Magick::Color> colors;
+	for (size_t i = 0; i < IMAGE_SIZE * IMAGE_SIZE; ++i)
+	{
+		const Magick::Color color = linearPixels[i];
+		quanta.emplace_back (quantumRed (color));
+		values.emplace_back (quantum_to_bits<8> (quantumGreen (color)));
+		colors.emplace_back (color);
+	}
+
+	std::vector<Case> cases;
+
+	const struct
+	{
+		const char *name;
+		void (*encode) (encode::WorkUnit &);
+	} encoders[] = {
+	    {"rgba8888", encode::rgba8888},
+	    {"rgb888", encode::rgb888},
+	    {"rgba5551", encode::rgba5551},
+	    {"rgb565", encode::rgb565},
+	    {"rgba4444", encode::rgba4444},
+	    {"la88", encode::la88},
+	    {"hilo88", encode::hilo88},
+	    {"l8", encode::l8},
+	    {"a8", encode::a8},
+	    {"la44", encode::la44},
+	    {"l4", encode::l4},
+	    {"a4", encode::a4},
+	};
+
+	for (const auto &encoder : encoders)
+	{
+		const auto process = encoder.encode;
+		auto run           = [&swizzledPixels, process]() {
+			return encodeTiles (swizzledPixels, IMAGE_SIZE, process, rg_etc1::cMediumQuality);
+		};
+
+		cases.push_back (Case{std::string ("encode/") + encoder.name, "tiles", run});
+	}
+
+	const struct
+	{
+		const char *name;
+		rg_etc1::etc1_quality quality;
+	} qualities[] = {
+	    {"low", rg_etc1::cLowQuality},
+	    {"medium", rg_etc1::cMediumQuality},
+	    {"high", rg_etc1::cHighQuality},
+	};
+
+	for (const auto &quality : qualities)
+	{
+		const auto q = quality.quality;
+		auto etc1    = [&linearPixels, q]() {
+			return encodeTiles (linearPixels, ETC1_SIZE, encode::etc1, q);
+		};
+		auto etc1a4 = [&linearPixels, q]() {
+			return encodeTiles (linearPixels, ETC1_SIZE, encode::etc1a4, q);
+		};
+
+		cases.push_back (Case{std::string ("encode/etc1-") + quality.name, "tiles", etc1});
+		cases.push_back (Case{std::string ("encode/etc1a4-") + quality.name, "tiles", etc1a4});
+	}
+
+	// each sample permutes the pixels again, which costs the same every time
+	Magick::Image forward (linear);
+	auto swizzleForward = [&forward]() {
+		swizzle (forward, false);
+		return IMAGE_SIZE * IMAGE_SIZE;
+	};
+
+	Magick::Image reverse (linear);
+	auto swizzleReverse = [&reverse]() {
+		swizzle (reverse, true);
+		return IMAGE_SIZE * IMAGE_SIZE;
+	};
+
+	cases.push_back (Case{"swizzle/forward", "pixels", swizzleForward});
+	cases.push_back (Case{"swizzle/reverse", "pixels", swizzleReverse});
+
+	using Magick::Quantum;
+	cases.push_back (apply ("quantum_to_bits<4>", quanta, [](Quantum v) {
+		return quantum_to_bits<4> (v);
+	}));
+	cases.push_back (apply ("quantum_to_bits<5>", quanta, [](Quantum v) {
+		return quantum_to_bits<5> (v);
+	}));
+	cases.push_back (apply ("quantum_to_bits<8>", quanta, [](Quantum v) {
+		return quantum_to_bits<8> (v);
+	}));
+	cases.push_back (apply ("bits_to_quantum<8>", values, [](uint8_t v) {
+		return bits_to_quantum<8> (v);
+	}));
+	cases.push_back (apply ("quantize<6>", quanta, [](Quantum v) { return quantize<6> (v); }));
+	cases.push_back (apply ("luminance", colors, [](const Magick::Color &c) {
+		return luminance (c);
+	}));
+
+	switch (format)
+	{
+	case OUTPUT_TABLE:
+		std::printf ("%-22s %-7s %8s %12s %12s %12s %7s\n",
+		    "case",
+		    "unit",
+		    "items",
+		    "median/s",
+		    "p10/s",
+		    "p90/s",
+		    "spread");
+		break;
+
+	case OUTPUT_CSV:
+		std::printf ("case,unit,items,median,p10,p90,spread\n");
+		break;
+
+	case OUTPUT_JSON:
+		std::printf ("{\"version\": \"%s\", \"warmup\": %zu, \"reps\": %zu, \"results\": [",
+		    PACKAGE_VERSION,
+		    warmup,
+		    reps);
+		break;
+	}
+
+	bool first = true;
+	for (const auto &bench : cases)
+	{
+		if (bench.name.find (filter) == std::string::npos)
+			continue;
+
+		print (measure (bench, warmup, reps), format, first);
+		first = false;
+
+		std::fflush (stdout);
+	}
+
+	if (format == OUTPUT_JSON)
+		std::printf ("\n]}\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,302 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file packing.cpp
+ *  @brief Atlas packing density and speed benchmark
+ *
+ *  @details
+ *  Packs synthetic sprite sets with every heuristic and sort order, searching
+ *  power-of-two atlas sizes the same way tex3ds does, and reports the atlas
+ *  size, its density, the density of the area actually covered, and the time
+ *  taken for each. Power-of-two rounding often hides differences between
+ *  heuristics; the covered density shows how much room each one leaves.
+ */
+
+#include "rectpack.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+/** @brief Sprite size */
+struct Size
+{
+	size_t w; ///< Width
+	size_t h; ///< Height
+};
+
+/** @brief Sprite corpus */
+struct Corpus
+{
+	const char *name;        ///< Corpus name
+	std::vector<Size> sizes; ///< Sprite sizes
+};
+
+/** @brief Deterministic random number generator */
+class Random
+{
+public:
+	explicit Random (uint32_t seed) : state (seed)
+	{
+	}
+
+	/** @brief Get a random number in [min, max] */
+	size_t next (size_t min, size_t max)
+	{
+		// xorshift32
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		return min + state % (max - min + 1);
+	}
+
+private:
+	uint32_t state; ///< Generator state
+};
+
+/** @brief Generate the benchmark corpora
+ *  @returns Corpora
+ */
+std::vector<Corpus> corpora ()
+{
+	std::vector<Corpus> result;
+
+	{
+		// UI icons: mostly square power-of-two sizes
+		Corpus corpus{"icons", {}};
+		Random random (1);
+		for (size_t i = 0; i < 200; ++i)
+		{
+			const size_t side = 8 << random.next (0, 3);
+			corpus.sizes.push_back (Size{side, side});
+		}
+		result.emplace_back (std::move (corpus));
+	}
+
+	{
+		// trimmed sprites: arbitrary sizes
+		Corpus corpus{"trimmed", {}};
+		Random random (2);
+		for (size_t i = 0; i < 150; ++i)
+			corpus.sizes.push_back (Size{random.next (4, 96), random.next (4, 96)});
+		result.emplace_back (std::move (corpus));
+	}
+
+	{
+		// glyphs and strips: many small, a few long and thin
+		Corpus corpus{"mixed", {}};
+		Random random (3);
+		for (size_t i = 0; i < 300; ++i)
+			corpus.sizes.push_back (Size{random.next (6, 24), random.next (10, 32)});
+		for (size_t i = 0; i < 12; ++i)
+			corpus.sizes.push_back (Size{random.next (128, 400), random.next (8, 24)});
+		result.emplace_back (std::move (corpus));
+	}
+
+	{
+		// a few large backgrounds with filler
+		Corpus corpus{"large", {}};
+		Random random (4);
+		for (size_t i = 0; i < 6; ++i)
+			corpus.sizes.push_back (Size{random.next (200, 380), random.next (150, 300)});
+		for (size_t i = 0; i < 80; ++i)
+			corpus.sizes.push_back (Size{random.next (16, 64), random.next (16, 64)});
+		result.emplace_back (std::move (corpus));
+	}
+
+	return result;
+}
+
+/** @brief Pack sizes into a bin
+ *  @param[in]  heuristic Packing heuristic
+ *  @param[in]  order     Placement order
+ *  @param[in]  sizes     Sizes to pack
+ *  @param[in]  width     Bin width
+ *  @param[in]  height    Bin height
+ *  @param[out] extent    Bounding box of the placed sizes
+ *  @returns Whether every size fit
+ */
+bool packBin (rectpack::Heuristic heuristic,
+    rectpack::SortOrder order,
+    std::vector<Size> sizes,
+    size_t width,
+    size_t height,
+    Size &extent)
+{
+	std::stable_sort (std::begin (sizes), std::end (sizes), [&](const Size &lhs, const Size &rhs) {
+		return rectpack::placeBefore (order, lhs.w, lhs.h, rhs.w, rhs.h);
+	});
+
+	extent = Size{0, 0};
+
+	auto packer = rectpack::Packer::create (heuristic, width, height);
+	for (const auto &size : sizes)
+	{
+		rectpack::Rect rect;
+		if (!packer->insert (size.w, size.h, rect))
+			return false;
+
+		extent.w = std::max (extent.w, rect.x + rect.w);
+		extent.h = std::max (extent.h, rect.y + rect.h);
+	}
+
+	return true;
+}
+
+/** @brief Find the smallest power-of-two atlas which fits every size
+ *  @param[in]  heuristic Packing heuristic
+ *  @param[in]  order     Placement order
+ *  @param[in]  sizes     Sizes to pack
+ *  @param[out] width     Atlas width
+ *  @param[out] height    Atlas height
+ *  @param[out] extent    Bounding box of the placed sizes
+ *  @returns Whether an atlas was found
+ */
+bool packAtlas (rectpack::Heuristic heuristic,
+    rectpack::SortOrder order,
+    const std::vector<Size> &sizes,
+    size_t &width,
+    size_t &height,
+    Size &extent)
+{
+	size_t totalArea = 0;
+	for (const auto &size : sizes)
+		totalArea += size.w * size.h;
+
+	std::vector<Size> candidates;
+	for (size_t h = 8; h <= 1024; h *= 2)
+	{
+		for (size_t w = 8; w <= 1024; w *= 2)
+		{
+			if (w * h >= totalArea)
+				candidates.push_back (Size{w, h});
+		}
+	}
+
+	// smallest area first, like tex3ds
+	std::sort (std::begin (candidates), std::end (candidates), [](const Size &lhs, const Size &rhs) {
+		return rectpack::placeBefore (rectpack::SORT_AREA, rhs.w, rhs.h, lhs.w, lhs.h);
+	});
+
+	for (const auto &candidate : candidates)
+	{
+		if (packBin (heuristic, order, sizes, candidate.w, candidate.h, extent))
+		{
+			width  = candidate.w;
+			height = candidate.h;
+			return true;
+		}
+	}
+
+	return false;
+}
+}
+
+/** @brief Program entry point
+ *  @param[in] argc Number of command-line arguments
+ *  @param[in] argv Command-line arguments
+ *  @returns EXIT_SUCCESS
+ */
+int main (int argc, char *argv[])
+{
+	// number of timed repetitions
+	size_t reps = 3;
+	if (argc > 1)
+		reps = std::max (1, std::atoi (argv[1]));
+
+	std::printf ("%-8s %-17s %-9s %9s %8s %8s %10s\n",
+	    "corpus",
+	    "packer",
+	    "order",
+	    "atlas",
+	    "density",
+	    "covered",
+	    "time (ms)");
+
+	for (const auto &corpus : corpora ())
+	{
+		size_t used = 0;
+		for (const auto &size : corpus.sizes)
+			used += size.w * size.h;
+
+		size_t bestArea = SIZE_MAX;
+		std::string best;
+
+		for (size_t h = 0; h < rectpack::NUM_HEURISTICS; ++h)
+		{
+			for (size_t o = 0; o < rectpack::NUM_SORT_ORDERS; ++o)
+			{
+				const auto heuristic = static_cast<rectpack::Heuristic> (h);
+				const auto order     = static_cast<rectpack::SortOrder> (o);
+
+				size_t width  = 0;
+				size_t height = 0;
+				Size extent{0, 0};
+				bool found = false;
+
+				// report the fastest repetition
+				double fastest = 0;
+				for (size_t rep = 0; rep < reps; ++rep)
+				{
+					const auto start = Clock::now ();
+					found = packAtlas (heuristic, order, corpus.sizes, width, height, extent);
+					const std::chrono::duration<double, std::milli> elapsed =
+					    Clock::now () - start;
+
+					if (rep == 0 || elapsed.count () < fastest)
+						fastest = elapsed.count ();
+				}
+
+				const std::string atlas =
+				    found ? std::to_string (width) + "x" + std::to_string (height) : "none";
+
+				std::printf ("%-8s %-17s %-9s %9s %7.1f%% %7.1f%% %10.2f\n",
+				    corpus.name,
+				    rectpack::name (heuristic),
+				    rectpack::name (order),
+				    atlas.c_str (),
+				    found ? 100.0 * used / (width * height) : 0.0,
+				    found ? 100.0 * used / (extent.w * extent.h) : 0.0,
+				    fastest);
+
+				// rank by atlas size, then by covered area
+				const size_t area = (width * height) << 20 | extent.w * extent.h;
+				if (found && area < bestArea)
+				{
+					bestArea = area;
+					best     = std::string (rectpack::name (heuristic)) + "/" +
+					       rectpack::name (order) + " " + atlas;
+				}
+			}
+		}
+
+		std::printf ("%-8s best: %s\n\n", corpus.name, best.empty () ? "none" : best.c_str ());
+	}
+
+	return EXIT_SUCCESS;
+}
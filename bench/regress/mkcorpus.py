@@ -0,0 +1,316 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2017-2022
+#     Michael Theall (mtheall)
+#
+# This file is part of tex3ds.
+#
+# tex3ds is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# tex3ds is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Generate the regression corpus.
+
+The corpus is checked in, so this only needs to be run to change it. Every
+image is synthetic and the font is a 5x7 pixel font drawn here, so the corpus
+carries no third-party licenses.
+
+Usage: mkcorpus.py [output directory]
+"""
+
+import os
+import struct
+import sys
+import zlib
+
+
+class Random:
+    """Deterministic random number generator (xorshift32)."""
+
+    def __init__(self, seed):
+        self.state = seed
+
+    def next(self, lo, hi):
+        s = self.state
+        s ^= (s << 13) & 0xFFFFFFFF
+        s ^= s >> 17
+        s ^= (s << 5) & 0xFFFFFFFF
+        self.state = s
+        return lo + s % (hi - lo + 1)
+
+
+def png(path, width, height, pixels):
+    """Write an RGBA8 PNG; pixels is a list of (r, g, b, a) rows."""
+
+    def chunk(tag, data):
+        return (struct.pack('>I', len(data)) + tag + data +
+                struct.pack('>I', zlib.crc32(tag + data) & 0xFFFFFFFF))
+
+    raw = b''.join(b'\0' + bytes(c for px in row for c in px) for row in pixels)
+
+    with open(path, 'wb') as f:
+        f.write(b'\x89PNG\r\n\x1a\n')
+        f.write(chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 6, 0, 0, 0)))
+        f.write(chunk(b'IDAT', zlib.compress(raw, 9)))
+        f.write(chunk(b'IEND', b''))
+
+
+def photo(width, height, seed):
+    """Opaque gradient with a little noise."""
+    random = Random(seed)
+    return [[((x * 3 + random.next(0, 12)) & 0xFF,
+              (y * 2 + 40 + random.next(0, 12)) & 0xFF,
+              ((x + y) + 20 + random.next(0, 12)) & 0xFF,
+              0xFF) for x in range(width)] for y in range(height)]
+
+
+def translucent(width, height, seed):
+    """Gradient with opaque, translucent and invisible areas."""
+    random = Random(seed)
+    rows = []
+    for y in range(height):
+        row = []
+        for x in range(width):
+            dx = x - width // 2
+            dy = y - height // 2
+            d = dx * dx + dy * dy
+            a = 0xFF if d < (width // 4) ** 2 else max(0, 0xFF - (d - (width // 4) ** 2) // 2)
+            # leftover colors in the invisible pixels, like exported sprites
+            row.append(((x * 4) & 0xFF, (y * 4) & 0xFF, random.next(0, 0xFF), a))
+        rows.append(row)
+    return rows
+
+
+def sprite(width, height, seed):
+    """Bordered panel with a transparent margin."""
+    random = Random(seed)
+    fill = (random.next(0, 0xFF), random.next(0, 0xFF), random.next(0, 0xFF), 0xFF)
+    border = (fill[0] // 2, fill[1] // 2, fill[2] // 2, 0xFF)
+    rows = []
+    for y in range(height):
+        row = []
+        for x in range(width):
+            if x < 2 or y < 2 or x >= width - 2 or y >= height - 2:
+                row.append((0, 0, 0, 0))
+            elif x == 2 or y == 2 or x == width - 3 or y == height - 3:
+                row.append(border)
+            else:
+                row.append(fill)
+        rows.append(row)
+    return rows
+
+
+def cube(face, seed):
+    """Cubemap cross; each face has its own color."""
+    random = Random(seed)
+    colors = [(random.next(0, 0xFF), random.next(0, 0xFF), random.next(0, 0xFF), 0xFF)
+              for _ in range(6)]
+    faces = {(1, 0): 0, (0, 1): 1, (1, 1): 2, (2, 1): 3, (3, 1): 4, (1, 2): 5}
+    rows = []
+    for y in range(face * 3):
+        row = []
+        for x in range(face * 4):
+            index = faces.get((x // face, y // face))
+            if index is None:
+                row.append((0, 0, 0, 0))
+            else:
+                c = colors[index]
+                shade = (x % face + y % face) * 2
+                row.append((min(0xFF, c[0] + shade), min(0xFF, c[1] + shade), c[2], c[3]))
+        rows.append(row)
+    return rows
+
+
+# 5x7 glyphs; '#' is ink
+GLYPHS = {
+    ' ': [''] * 7,
+    '0': [' ### ', '#   #', '#  ##', '# # #', '##  #', '#   #', ' ### '],
+    '1': ['  #  ', ' ##  ', '  #  ', '  #  ', '  #  ', '  #  ', ' ### '],
+    '2': [' ### ', '#   #', '    #', '   # ', '  #  ', ' #   ', '#####'],
+    '3': ['#####', '   # ', '  #  ', '   # ', '    #', '#   #', ' ### '],
+    '4': ['   # ', '  ## ', ' # # ', '#  # ', '#####', '   # ', '   # '],
+    '5': ['#####', '#    ', '#### ', '    #', '    #', '#   #', ' ### '],
+    '6': ['  ## ', ' #   ', '#    ', '#### ', '#   #', '#   #', ' ### '],
+    '7': ['#####', '    #', '   # ', '  #  ', ' #   ', ' #   ', ' #   '],
+    '8': [' ### ', '#   #', '#   #', ' ### ', '#   #', '#   #', ' ### '],
+    '9': [' ### ', '#   #', '#   #', ' ####', '    #', '   # ', ' ##  '],
+    '?': [' ### ', '#   #', '    #', '   # ', '  #  ', '     ', '  #  '],
+    'A': [' ### ', '#   #', '#   #', '#####', '#   #', '#   #', '#   #'],
+    'B': ['#### ', '#   #', '#   #', '#### ', '#   #', '#   #', '#### '],
+    'C': [' ### ', '#   #', '#    ', '#    ', '#    ', '#   #', ' ### '],
+    'D': ['#### ', '#   #', '#   #', '#   #', '#   #', '#   #', '#### '],
+    'E': ['#####', '#    ', '#    ', '#### ', '#    ', '#    ', '#####'],
+    'F': ['#####', '#    ', '#    ', '#### ', '#    ', '#    ', '#    '],
+}
+
+UNITS = 1000   # units per em
+PIXEL = 100    # units per glyph pixel
+ADVANCE = 600  # advance width
+ASCENT = 800
+DESCENT = -200
+
+
+def contours(rows):
+    """Outline every horizontal run of ink as a clockwise rectangle."""
+    result = []
+    for j, row in enumerate(rows):
+        y1 = (7 - j) * PIXEL
+        y0 = y1 - PIXEL
+        x = 0
+        while x < len(row):
+            if row[x] != '#':
+                x += 1
+                continue
+            end = x
+            while end < len(row) and row[end] == '#':
+                end += 1
+            x0 = PIXEL // 2 + x * PIXEL
+            x1 = PIXEL // 2 + end * PIXEL
+            result.append([(x0, y0), (x0, y1), (x1, y1), (x1, y0)])
+            x = end
+    return result
+
+
+def glyph(outline):
+    """Encode a simple glyph; returns (data, bounding box, points)."""
+    if not outline:
+        return b'', (0, 0, 0, 0), 0
+
+    points = [p for c in outline for p in c]
+    bbox = (min(p[0] for p in points), min(p[1] for p in points),
+            max(p[0] for p in points), max(p[1] for p in points))
+
+    data = struct.pack('>hhhhh', len(outline), *bbox)
+    end = -1
+    for c in outline:
+        end += len(c)
+        data += struct.pack('>H', end)
+    data += struct.pack('>H', 0)          # no instructions
+    data += bytes([0x01] * len(points))   # on-curve, 16-bit deltas
+
+    for axis in (0, 1):
+        prev = 0
+        for p in points:
+            data += struct.pack('>h', p[axis] - prev)
+            prev = p[axis]
+
+    return data + b'\0' * (-len(data) % 4), bbox, len(points)
+
+
+def checksum(data):
+    data += b'\0' * (-len(data) % 4)
+    return sum(struct.unpack('>%dI' % (len(data) // 4), data)) & 0xFFFFFFFF
+
+
+def ttf(path):
+    """Write a TrueType font with the glyphs in GLYPHS."""
+    chars = sorted(GLYPHS)
+
+    # glyph 0 is .notdef: a hollow box
+    notdef = [[(50, 0), (50, 700), (550, 700), (550, 0)],
+              [(150, 100), (450, 100), (450, 600), (150, 600)]]
+    glyphs = [glyph(notdef)] + [glyph(contours(GLYPHS[c])) for c in chars]
+
+    glyf = b''
+    loca = [0]
+    for data, _, _ in glyphs:
+        glyf += data
+        loca.append(len(glyf))
+
+    boxes = [g[1] for g in glyphs if g[0]]
+    xmin = min(b[0] for b in boxes)
+    ymin = min(b[1] for b in boxes)
+    xmax = max(b[2] for b in boxes)
+    ymax = max(b[3] for b in boxes)
+    maxpoints = max(g[2] for g in glyphs)
+    maxcontours = max(struct.unpack('>h', g[0][:2])[0] for g in glyphs if g[0])
+
+    tables = {}
+    tables[b'head'] = struct.pack('>IIIIHHqqhhhhHHhhh', 0x00010000, 0x00010000, 0, 0x5F0F3CF5,
+                                  0x000B, UNITS, 0, 0, xmin, ymin, xmax, ymax, 0, 8, 2, 1, 0)
+    tables[b'hhea'] = struct.pack('>IhhhHhhhhhhhhhhhH', 0x00010000, ASCENT, DESCENT, 0, ADVANCE,
+                                  0, 0, xmax, 1, 0, 0, 0, 0, 0, 0, 0, len(glyphs))
+    tables[b'maxp'] = struct.pack('>IHHHHHHHHHHHHHH', 0x00010000, len(glyphs), maxpoints,
+                                  maxcontours, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0)
+    tables[b'hmtx'] = b''.join(struct.pack('>Hh', ADVANCE, g[1][0]) for g in glyphs)
+    tables[b'loca'] = b''.join(struct.pack('>I', offset) for offset in loca)
+    tables[b'glyf'] = glyf
+    tables[b'post'] = struct.pack('>IIhhIIIII', 0x00030000, 0, -100, 50, 1, 0, 0, 0, 0)
+
+    # format 4 cmap with one segment per character
+    codes = [ord(c) for c in chars]
+    segments = [(code, code, i + 1 - code) for i, code in enumerate(codes)] + [(0xFFFF, 0xFFFF, 1)]
+    count = len(segments)
+    search = 2 ** (count.bit_length() - 1)
+    sub = b''.join([
+        struct.pack('>' + 'H' * count, *[s[1] for s in segments]),
+        struct.pack('>H', 0),
+        struct.pack('>' + 'H' * count, *[s[0] for s in segments]),
+        struct.pack('>' + 'H' * count, *[s[2] & 0xFFFF for s in segments]),
+        struct.pack('>' + 'H' * count, *[0] * count),
+    ])
+    sub = struct.pack('>HHH', 4, 14 + len(sub), 0) + struct.pack(
+        '>HHHH', count * 2, search * 2, search.bit_length() - 1, (count - search) * 2) + sub
+    tables[b'cmap'] = struct.pack('>HHHHI', 0, 1, 3, 1, 12) + sub
+
+    names = [(1, 'tex3ds regress'), (2, 'Regular'), (4, 'tex3ds regress'),
+             (6, 'tex3ds-regress')]
+    strings = b''
+    records = b''
+    for name_id, text in names:
+        encoded = text.encode('utf-16-be')
+        records += struct.pack('>HHHHHH', 3, 1, 0x409, name_id, len(encoded), len(strings))
+        strings += encoded
+    tables[b'name'] = struct.pack('>HHH', 0, len(names), 6 + len(records)) + records + strings
+
+    tags = sorted(tables)
+    search = 2 ** (len(tags).bit_length() - 1)
+    header = struct.pack('>IHHHH', 0x00010000, len(tags), search * 16,
+                         search.bit_length() - 1, (len(tags) - search) * 16)
+
+    offset = len(header) + 16 * len(tags)
+    directory = b''
+    body = b''
+    for tag in tags:
+        data = tables[tag]
+        directory += struct.pack('>4sIII', tag, checksum(data), offset + len(body), len(data))
+        body += data + b'\0' * (-len(data) % 4)
+
+    font = bytearray(header + directory + body)
+
+    # head.checkSumAdjustment
+    head = offset + body.index(tables[b'head'])
+    struct.pack_into('>I', font, head + 8, (0xB1B0AFBA - checksum(bytes(font))) & 0xFFFFFFFF)
+
+    with open(path, 'wb') as f:
+        f.write(font)
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), 'corpus')
+    os.makedirs(out, exist_ok=True)
+
+    png(os.path.join(out, 'photo.png'), 64, 64, photo(64, 64, 1))
+    png(os.path.join(out, 'translucent.png'), 64, 64, translucent(64, 64, 2))
+    png(os.path.join(out, 'cube.png'), 128, 96, cube(32, 3))
+
+    random = Random(4)
+    for name in 'abcdefgh':
+        w = random.next(6, 40)
+        h = random.next(6, 40)
+        png(os.path.join(out, 'sprite_%s.png' % name), w, h, sprite(w, h, random.next(1, 1000)))
+
+    ttf(os.path.join(out, 'font.ttf'))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2017-2022
+#     Michael Theall (mtheall)
+#
+# This file is part of tex3ds.
+#
+# tex3ds is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# tex3ds is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+
+"""End-to-end regression harness for tex3ds and mkbcfnt.
+
+Runs both tools over the checked-in corpus and:
+  - checks that repeated runs give the same output;
+  - compares every output byte-for-byte with the SHA-256 hashes recorded from
+    a reference build, if any were recorded;
+  - records the wall time (fastest of --reps runs) and peak RSS of each case,
+    and fails when a case is slower than the stored baseline by more than
+    --tolerance percent.
+
+No goldens are shipped: outputs depend on the ImageMagick version and quantum
+depth. Like the timing baseline, record them with a build of the commit before
+the change under test, then check the change against them. Without them only
+determinism and timing are checked.
+
+  regress.py                      check outputs and timings
+  regress.py --record             write the golden hashes from the current outputs
+  regress.py --update-baseline    write the timing baseline
+
+Only the standard library is used, so it runs offline on any Linux box.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CORPUS = os.path.join(HERE, 'corpus')
+
+FORMATS = ['rgba8', 'rgb8', 'rgba5551', 'rgb565', 'rgba4', 'la8', 'hilo8', 'l8', 'a8', 'la4',
+           'l4', 'a4', 'etc1', 'etc1a4']
+
+SPRITES = ['sprite_%s.png' % name for name in 'abcdefgh']
+
+
+def cases():
+    """Every case: (name, tool, arguments, output files)."""
+    result = []
+
+    for fmt in FORMATS:
+        src = 'photo.png' if fmt in ('rgb8', 'rgb565', 'etc1', 'hilo8', 'l8', 'l4') \
+            else 'translucent.png'
+        result.append(('format-' + fmt, 'tex3ds',
+                       ['-f', fmt, '-q', 'low', '-z', 'none', '-o', 'out.t3x', src], ['out.t3x']))
+
+    for z in ['lzss', 'lz11', 'huff', 'rle', 'auto', 'auto-fast']:
+        result.append(('compress-' + z, 'tex3ds',
+                       ['-f', 'rgba8', '-z', z, '-o', 'out.t3x', 'translucent.png'], ['out.t3x']))
+
+    result += [
+        ('parallel-lz', 'tex3ds',
+         ['-f', 'rgba8', '-z', 'lz11', '-L', '-o', 'out.t3x', 'translucent.png'], ['out.t3x']),
+        ('mipmap', 'tex3ds',
+         ['-f', 'rgb565', '-m', 'lanczos', '-z', 'auto', '-o', 'out.t3x', '-p', 'preview.png',
+          'photo.png'], ['out.t3x']),
+        ('chunked', 'tex3ds',
+         ['-f', 'rgba4', '-m', 'box', '-C', '-z', 'auto', '-o', 'out.t3x', 'translucent.png'],
+         ['out.t3x']),
+        ('bleed-dilate', 'tex3ds',
+         ['-f', 'etc1a4', '-q', 'low', '-B', 'dilate', '-z', 'none', '-o', 'out.t3x',
+          'translucent.png'], ['out.t3x']),
+        ('etc1-rd', 'tex3ds',
+         ['-f', 'etc1', '-q', 'low', '-R', '20', '-z', 'lz11', '-o', 'out.t3x', 'photo.png'],
+         ['out.t3x']),
+        ('atlas', 'tex3ds',
+         ['-a', '-f', 'rgba8', '-z', 'auto', '-o', 'out.t3x', '-H', 'out.h'] + SPRITES,
+         ['out.t3x', 'out.h']),
+        ('atlas-trim', 'tex3ds',
+         ['-a', '-t', '-O', '-b', 'edge', '-P', 'skyline', '-f', 'rgba5551', '-z', 'lzss',
+          '-o', 'out.t3x', '-H', 'out.h'] + SPRITES, ['out.t3x', 'out.h']),
+        ('cubemap', 'tex3ds',
+         ['--cubemap', '-f', 'rgb565', '-m', 'box', '-z', 'auto', '-o', 'out.t3x', 'cube.png'],
+         ['out.t3x']),
+        ('skybox', 'tex3ds',
+         ['--skybox', '-f', 'etc1', '-q', 'low', '-z', 'none', '-o', 'out.t3x', 'cube.png'],
+         ['out.t3x']),
+        ('font', 'mkbcfnt', ['-s', '16', '-o', 'out.bcfnt', 'font.ttf'], ['out.bcfnt']),
+        ('font-reencode', 'mkbcfnt', ['-o', 'out.bcfnt', 'font.bcfnt'], ['out.bcfnt']),
+    ]
+
+    return result
+
+
+def run(tool, args, cwd):
+    """Run a tool; returns (wall seconds, peak RSS KiB)."""
+    start = time.perf_counter()
+    proc = subprocess.Popen([tool] + args, cwd=cwd, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE)
+    stderr = proc.stderr.read()
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.perf_counter() - start
+    proc.stderr.close()
+
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        raise RuntimeError('%s %s failed (status %d):\n%s' %
+                           (tool, ' '.join(args), status, stderr.decode(errors='replace')))
+
+    return wall, usage.ru_maxrss
+
+
+def digest(path):
+    with open(path, 'rb') as f:
+        return hashlib.sha256(f.read()).hexdigest()
+
+
+def load(path):
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def save(path, data):
+    with open(path, 'w') as f:
+        json.dump(data, f, indent=2, sort_keys=True)
+        f.write('\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='tex3ds/mkbcfnt regression harness')
+    parser.add_argument('--tex3ds', default='./tex3ds', help='tex3ds binary')
+    parser.add_argument('--mkbcfnt', default='./mkbcfnt', help='mkbcfnt binary')
+    parser.add_argument('--reps', type=int, default=3, help='timed runs per case (default 3)')
+    parser.add_argument('--tolerance', type=float, default=10.0,
+                        help='allowed slowdown against the baseline, in percent (default 10)')
+    parser.add_argument('--baseline', default='regress-baseline.json',
+                        help='timing baseline (default regress-baseline.json)')
+    parser.add_argument('--goldens', default='regress-goldens.json',
+                        help='golden hashes (default regress-goldens.json)')
+    parser.add_argument('--record', action='store_true', help='write the golden hashes')
+    parser.add_argument('--update-baseline', action='store_true', help='write the timing baseline')
+    parser.add_argument('filter', nargs='*', help='only run cases containing any of these')
+    options = parser.parse_args()
+
+    tools = {'tex3ds': os.path.abspath(options.tex3ds),
+             'mkbcfnt': os.path.abspath(options.mkbcfnt)}
+
+    goldens = load(options.goldens)
+    baseline = load(options.baseline)
+    failures = 0
+
+    # without goldens there is nothing to compare the outputs with
+    check = options.record or os.path.exists(options.goldens)
+    if not check:
+        print('No golden hashes in %s; only checking determinism and timing.' % options.goldens)
+        print('Record them with --record using a build of the reference commit.')
+
+    work = tempfile.mkdtemp(prefix='tex3ds-regress-')
+    try:
+        # inputs are copied so that paths in the outputs don't depend on the checkout
+        for name in os.listdir(CORPUS):
+            shutil.copy(os.path.join(CORPUS, name), work)
+
+        print('%-16s %10s %10s %8s %9s  %s' % ('case', 'wall ms', 'base ms', 'change', 'rss MiB',
+                                                'status'))
+
+        for name, tool, args, outputs in cases():
+            if options.filter and not any(f in name for f in options.filter):
+                continue
+
+            cwd = os.path.join(work, name)
+            os.mkdir(cwd)
+            for entry in os.listdir(work):
+                if os.path.isfile(os.path.join(work, entry)):
+                    os.symlink(os.path.join(work, entry), os.path.join(cwd, entry))
+
+            status = []
+            hashes = None
+            best = None
+            rss = 0
+            try:
+                # the first run warms the caches and is not timed
+                for rep in range(options.reps + 1):
+                    wall, peak = run(tools[tool], args, cwd)
+                    current = {output: digest(os.path.join(cwd, output)) for output in outputs}
+
+                    if hashes is None:
+                        hashes = current
+                    elif current != hashes:
+                        status.append('NONDETERMINISTIC')
+
+                    if rep > 0:
+                        best = wall if best is None else min(best, wall)
+                    rss = max(rss, peak)
+            except RuntimeError as e:
+                print('%-16s %s' % (name, e))
+                failures += 1
+                continue
+
+            # mkbcfnt re-encodes the font built by the previous case
+            if name == 'font':
+                shutil.copy(os.path.join(cwd, 'out.bcfnt'), os.path.join(work, 'font.bcfnt'))
+
+            if options.record:
+                goldens[name] = hashes
+            elif check and name not in goldens:
+                status.append('NO GOLDEN')
+            elif check and goldens[name] != hashes:
+                changed = sorted(o for o in outputs if goldens[name].get(o) != hashes[o])
+                status.append('MISMATCH ' + ','.join(changed))
+
+            base = baseline.get(name, {}).get('wall')
+            change = ''
+            if base:
+                percent = 100.0 * (best - base) / base
+                change = '%+7.1f%%' % percent
+                if percent > options.tolerance and not options.update_baseline:
+                    status.append('SLOW')
+
+            if options.update_baseline:
+                baseline[name] = {'wall': best, 'rss_kib': rss}
+
+            print('%-16s %10.1f %10s %8s %9.1f  %s' % (
+                name, best * 1e3, '%.1f' % (base * 1e3) if base else '-', change, rss / 1024.0,
+                ' '.join(status) if status else 'ok'))
+            sys.stdout.flush()
+
+            if status:
+                failures += 1
+    finally:
+        shutil.rmtree(work)
+
+    if options.record:
+        save(options.goldens, goldens)
+    if options.update_baseline:
+        save(options.baseline, baseline)
+
+    if failures:
+        print('%d case(s) failed' % failures)
+        if check and any(name not in goldens for name, _, _, _ in cases()):
+            print('Record missing goldens with --record')
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -23,15 +23,54 @@
 #pragma once
 
 #include "magick_compat.h"
+#include "rectpack.h"
 #include "subimage.h"
 
 #include <string>
 #include <vector>
 
+/** @brief Placement of sprites in an atlas */
+struct AtlasLayout
+{
+	/** @brief Sprite placement */
+	struct Sprite
+	{
+		std::string name; ///< Sprite name
+		size_t x;         ///< Left coordinate
+		size_t y;         ///< Top coordinate
+		size_t w;         ///< Placed width, including border
+		size_t h;         ///< Placed height, including border
+		bool rotated;     ///< Whether sprite is rotated
+	};
+
+	size_t width;                ///< Atlas width, excluding border
+	size_t height;               ///< Atlas height, excluding border
+	std::vector<Sprite> sprites; ///< Sprite placements
+
+	AtlasLayout () : width (0), height (0)
+	{
+	}
+};
+
+/** @brief Atlas packing options */
+struct PackOptions
+{
+	rectpack::Heuristic heuristic; ///< Packing heuristic
+	rectpack::SortOrder order;     ///< Sprite placement order
+	bool best;                     ///< Try every heuristic and order, keep the smallest atlas
+	unsigned budget;               ///< Time budget for best mode, in milliseconds
+
+	PackOptions ()
+	    : heuristic (rectpack::CONTACT), order (rectpack::SORT_AREA), best (false), budget (1000)
+	{
+	}
+};
+
 struct Atlas
 {
 	Magick::Image img;
 	std::vector<SubImage> subs;
+	AtlasLayout layout;
 
 	Atlas ()
 	{
@@ -42,6 +81,37 @@ struct Atlas
 	Atlas &operator= (const Atlas &other) = delete;
 	Atlas &operator= (Atlas &&other) = delete;
 
-	static Atlas
-	    build (const std::vector<std::string> &paths, bool trim, unsigned border, unsigned edge);
+	/** @brief Build an atlas
+	 *  @param[in] paths    Input paths
+	 *  @param[in] trim     Whether to trim inputs
+	 *  @param[in] border   Border size
+	 *  @param[in] edge     Edge size
+	 *  @param[in] options  Packing options
+	 *  @param[in] previous Previous layout to keep unchanged sprites in place
+	 *  @returns Atlas
+	 *
+	 *  @note With a previous layout, sprites whose name and size are unchanged
+	 *  keep their placement and only the rest are packed into the free space.
+	 *  If they don't fit, the atlas is packed from scratch.
+	 */
+	static Atlas build (const std::vector<std::string> &paths,
+	    bool trim,
+	    unsigned border,
+	    unsigned edge,
+	    const PackOptions &options = PackOptions (),
+	    const AtlasLayout *previous = nullptr);
+
+	/** @brief Build an atlas which spills onto as many pages as needed
+	 *  @param[in] paths   Input paths
+	 *  @param[in] trim    Whether to trim inputs
+	 *  @param[in] border  Border size
+	 *  @param[in] edge    Edge size
+	 *  @param[in] options Packing options
+	 *  @returns Atlas pages; each sub-image records its page
+	 */
+	static std::vector<Atlas> buildPages (const std::vector<std::string> &paths,
+	    bool trim,
+	    unsigned border,
+	    unsigned edge,
+	    const PackOptions &options = PackOptions ());
 };
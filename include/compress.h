@@ -22,9 +22,11 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 /** @brief LZSS/LZ10 compression
@@ -49,6 +51,26 @@ void lzssDecode (const void *src, void *dst, size_t len);
  */
 std::vector<uint8_t> lz11Encode (const void *src, size_t len);
 
+/** @brief Parallel LZSS/LZ10 compression
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Compressed buffer
+ *
+ *  @note 64KiB segments of the source are compressed concurrently, so the
+ *        output can be slightly larger than that of lzssEncode.
+ */
+std::vector<uint8_t> lzssEncodeParallel (const void *src, size_t len);
+
+/** @brief Parallel LZ11 compression
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Compressed buffer
+ *
+ *  @note 64KiB segments of the source are compressed concurrently, so the
+ *        output can be slightly larger than that of lz11Encode.
+ */
+std::vector<uint8_t> lz11EncodeParallel (const void *src, size_t len);
+
 /** @brief LZ11 decompression
  *  @param[in]  src Source buffer
  *  @param[out] dst Destination buffer
@@ -79,6 +101,17 @@ void rleDecode (const void *src, void *dst, size_t len);
  */
 std::vector<uint8_t> huffEncode (const void *src, size_t len);
 
+/** @brief Huffman compression with a known histogram
+ *  @param[in] src       Source buffer
+ *  @param[in] len       Source length
+ *  @param[in] histogram Byte value histogram of the source
+ *  @returns Compressed buffer, identical to huffEncode (src, len)
+ *
+ *  @note Lets a caller which streams its data count the histogram as it goes
+ *        and encode from its own copy of the data, instead of keeping another.
+ */
+std::vector<uint8_t> huffEncodeHistogram (const void *src, size_t len, const size_t histogram[256]);
+
 /** @brief Huffman decompression
  *  @param[in]  src Source buffer
  *  @param[out] dst Destination buffer
@@ -87,6 +120,114 @@ std::vector<uint8_t> huffEncode (const void *src, size_t len);
  */
 void huffDecode (const void *src, void *dst, size_t len);
 
+/** @brief Compressed size estimate */
+struct CompressionEstimate
+{
+	const char *name; ///< Compression name: none, lzss, lz11, huff or rle
+	size_t size;      ///< Compressed size, including the compression header and padding
+	bool exact;       ///< Whether the size is exact rather than extrapolated
+};
+
+/** @brief Estimate LZSS/LZ10 compressed size
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Estimate
+ *
+ *  @note Evenly spaced samples of large sources are parsed and their match
+ *        density extrapolated; small sources are parsed whole.
+ */
+CompressionEstimate lzssEstimate (const void *src, size_t len);
+
+/** @brief Estimate LZ11 compressed size
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Estimate
+ *
+ *  @note Evenly spaced samples of large sources are parsed and their match
+ *        density extrapolated; small sources are parsed whole.
+ */
+CompressionEstimate lz11Estimate (const void *src, size_t len);
+
+/** @brief Get run-length encoding compressed size from run statistics
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Exact estimate
+ */
+CompressionEstimate rleEstimate (const void *src, size_t len);
+
+/** @brief Get Huffman compressed size from the byte histogram
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Exact estimate
+ */
+CompressionEstimate huffEstimate (const void *src, size_t len);
+
+/** @brief Estimate compressed size of every compression type
+ *  @param[in] src Source buffer
+ *  @param[in] len Source length
+ *  @returns Estimates, smallest first; ties keep the order none, lzss, lz11, huff, rle
+ */
+std::vector<CompressionEstimate> estimateCompression (const void *src, size_t len);
+
+/** @brief Select compression types worth running
+ *  @param[in] estimates Estimates from estimateCompression
+ *  @returns The smallest estimate, plus any extrapolated estimate close enough
+ *           that it could be smaller. If more than two are that close, every
+ *           estimate is returned.
+ */
+std::vector<CompressionEstimate> compressionCandidates (
+    const std::vector<CompressionEstimate> &estimates);
+
+/** @brief Streaming compressor
+ *
+ *  @details
+ *  Data is compressed as it is pushed, as far as the compression format
+ *  allows. The output of finish () is identical to that of the matching
+ *  one-shot encoder given all of the pushed data at once.
+ */
+class Compressor
+{
+public:
+	virtual ~Compressor () = default;
+
+	/** @brief Compress more data
+	 *  @param[in] src Source buffer
+	 *  @param[in] len Source length
+	 */
+	virtual void push (const void *src, size_t len) = 0;
+
+	/** @brief Finish compression
+	 *  @returns Compressed buffer
+	 *
+	 *  @note No more data may be pushed afterwards.
+	 */
+	virtual std::vector<uint8_t> finish () = 0;
+};
+
+/** @brief Create streaming LZSS/LZ10 compressor
+ *  @returns Compressor whose output matches lzssEncode
+ */
+std::unique_ptr<Compressor> lzssCompressor ();
+
+/** @brief Create streaming LZ11 compressor
+ *  @returns Compressor whose output matches lz11Encode
+ */
+std::unique_ptr<Compressor> lz11Compressor ();
+
+/** @brief Create streaming run-length encoding compressor
+ *  @returns Compressor whose output matches rleEncode
+ */
+std::unique_ptr<Compressor> rleCompressor ();
+
+/** @brief Decompress data with a GBA-style compression header
+ *  @param[in] src Compressed data, starting with the compression header
+ *  @param[in] len Compressed data length
+ *  @returns Decompressed data
+ *
+ *  @note The compressed data must be well-formed; only the header is checked.
+ */
+std::vector<uint8_t> decompress (const void *src, size_t len);
+
 namespace
 {
 /** @brief Output a GBA-style compression header
@@ -113,4 +254,27 @@ inline void compressionHeader (std::vector<uint8_t> &buffer, uint8_t type, size_
 		buffer.push_back (0); /* Reserved */
 	}
 }
+
+/** @brief Room to reserve for a compression header whose size is not known yet */
+constexpr size_t COMPRESSION_HEADER_MAX = 8;
+
+/** @brief Fill in a compression header reserved at the start of a buffer
+ *  @param[inout] buffer Output buffer starting with COMPRESSION_HEADER_MAX reserved bytes
+ *  @param[in]    type   Compression type
+ *  @param[in]    size   Uncompressed data size
+ *
+ *  @note Unused reserved bytes are removed, which doesn't change the
+ *        buffer's alignment to 4 bytes.
+ */
+inline void finishCompressionHeader (std::vector<uint8_t> &buffer, uint8_t type, size_t size)
+{
+	assert (buffer.size () >= COMPRESSION_HEADER_MAX);
+
+	std::vector<uint8_t> header;
+	compressionHeader (header, type, size);
+
+	const size_t unused = COMPRESSION_HEADER_MAX - header.size ();
+	std::copy (std::begin (header), std::end (header), std::begin (buffer) + unused);
+	buffer.erase (std::begin (buffer), std::begin (buffer) + unused);
+}
 }
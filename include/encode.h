@@ -30,6 +30,7 @@
 #include "subimage.h"
 
 #include <limits>
+#include <stdexcept>
 #include <vector>
 
 /** @namespace encode
@@ -114,6 +115,56 @@ inline void encode (const SubImage &sub, uint16_t width, uint16_t height, Buffer
 	encode<float> (sub.bottom, out);
 }
 
+/** @brief Flags in the optional .t3x extension byte */
+enum Extension : uint8_t
+{
+	EXTENSION_TRIM    = 1 << 0, ///< Untrimmed size and trim offset follow each sub-image
+	EXTENSION_CHUNKED = 1 << 1, ///< Chunk table follows the sub-images
+};
+
+/** @brief Alignment of the chunks of a chunked .t3x file */
+constexpr size_t CHUNK_ALIGN = 0x80;
+
+/** @brief Encode chunk table entry
+ *  @param[in]  type         Compression type; 0x00 if the chunk is stored as-is
+ *  @param[in]  offset       Offset of the chunk in the file
+ *  @param[in]  size         Stored size
+ *  @param[in]  uncompressed Uncompressed size
+ *  @param[out] out          Output buffer
+ */
+inline void encodeChunk (uint8_t type, size_t offset, size_t size, size_t uncompressed, Buffer &out)
+{
+	constexpr size_t limit = std::numeric_limits<uint32_t>::max ();
+
+	if (offset > limit || size > limit || uncompressed > limit)
+		throw std::runtime_error ("Chunked output is too large");
+
+	encode<uint8_t> (type, out);
+	encode<uint8_t> (0, out); /* Reserved */
+	encode<uint8_t> (0, out); /* Reserved */
+	encode<uint8_t> (0, out); /* Reserved */
+	encode<uint32_t> (offset, out);
+	encode<uint32_t> (size, out);
+	encode<uint32_t> (uncompressed, out);
+}
+
+/** @brief Encode sub-image untrimmed size and trim offset
+ *  @param[in]  sub Sub-image to encode
+ *  @param[out] out Output buffer
+ */
+inline void encodeTrim (const SubImage &sub, Buffer &out)
+{
+	constexpr size_t limit = std::numeric_limits<uint16_t>::max ();
+
+	if (sub.srcWidth > limit || sub.srcHeight > limit)
+		throw std::runtime_error ("Untrimmed image is too large");
+
+	encode<uint16_t> (sub.srcWidth, out);
+	encode<uint16_t> (sub.srcHeight, out);
+	encode<uint16_t> (sub.trimLeft, out);
+	encode<uint16_t> (sub.trimTop, out);
+}
+
 /** @brief Work unit
  *
  *  @details
@@ -341,4 +392,62 @@ void etc1 (WorkUnit &work);
  *  @param[in] work Work unit
  */
 void etc1a4 (WorkUnit &work);
+
+/** @brief ETC1 rate-distortion optimizer
+ *
+ *  @details
+ *  Revisits encoded ETC1/ETC1A4 tiles in output order and swaps blocks for
+ *  alternatives whose error is within a tolerance of the best encoding, but
+ *  which compress better. In order of preference, a block is replaced by:
+ *    - a recently output block, so the whole 8 bytes repeat
+ *    - the previous block's base colors, flip, diff and tables with selectors
+ *      recomputed for this block's pixels, so the 4 color bytes repeat
+ *
+ *  Work units must be optimized in output order. When the work unit has
+ *  preview enabled, its pixels are replaced with the decoded output, so the
+ *  tile encoder must not have done so.
+ */
+class ETC1Optimizer
+{
+public:
+	/** @brief Parameterized constructor
+	 *  @param[in] tolerance Allowed increase of mean squared error per pixel
+	 */
+	explicit ETC1Optimizer (double tolerance);
+
+	/** @brief Optimize an encoded tile
+	 *  @param[in] work  Work unit holding the encoded tile and its source pixels
+	 *  @param[in] alpha Whether the tile is ETC1A4
+	 */
+	void optimize (WorkUnit &work, bool alpha);
+
+	/** @brief Get number of blocks which were replaced */
+	size_t replaced () const
+	{
+		return numReplaced;
+	}
+
+private:
+	/** @brief Number of recently output blocks to consider */
+	static constexpr size_t HISTORY_SIZE = 32;
+
+	/** @brief Recently output block */
+	struct Entry
+	{
+		uint8_t block[8];       ///< ETC1 block (big-endian)
+		unsigned pixels[4 * 4]; ///< Decoded pixels (RGBA)
+	};
+
+	/** @brief Add a block to the history
+	 *  @param[in] block  ETC1 block (big-endian)
+	 *  @param[in] pixels Decoded pixels (RGBA)
+	 */
+	void remember (const uint8_t block[8], const unsigned pixels[4 * 4]);
+
+	std::vector<Entry> history; ///< Recently output blocks
+	size_t next        = 0;     ///< Next history slot to replace
+	size_t last        = 0;     ///< History slot of previous block
+	double tolerance;           ///< Allowed increase of squared error per block
+	size_t numReplaced = 0;     ///< Number of blocks replaced
+};
 }
@@ -0,0 +1,85 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file jobs.h
+ *  @brief Thread count and GNU make jobserver
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace jobs
+{
+/** @brief Connect to the GNU make jobserver, if any
+ *  @note Call at the start of main (), before any file is opened, so the file
+ *  descriptors named in MAKEFLAGS can't refer to files the program opened.
+ */
+void init ();
+
+/** @brief Set the maximum number of threads
+ *  @param[in] jobs Maximum number of threads; 0 for no maximum
+ */
+void setMaximum (size_t jobs);
+
+/** @brief Get the number of CPUs allowed by the cgroup CPU quota
+ *  @returns Number of CPUs, rounded up; 0 if there is no quota
+ */
+size_t cgroupQuota ();
+
+/** @brief Get the number of threads to use
+ *  @returns The smallest of the maximum set by setMaximum (), the cgroup CPU
+ *           quota, and the number of CPUs the process may run on; at least 1
+ */
+size_t concurrency ();
+
+/** @brief Job slots for a group of threads
+ *
+ *  @details
+ *  The process owns one job slot. When run by GNU make with a jobserver
+ *  (--jobserver-auth in MAKEFLAGS), every additional thread needs a token from
+ *  the jobserver. Tokens are taken without waiting, so the group may get fewer
+ *  threads than it asked for, and are returned when the slots are destroyed.
+ *  Without a jobserver, every requested slot is granted.
+ */
+class Slots
+{
+public:
+	/** @brief Constructor
+	 *  @param[in] count Number of threads wanted
+	 */
+	explicit Slots (size_t count);
+
+	/** @brief Destructor; returns tokens to the jobserver */
+	~Slots ();
+
+	Slots (const Slots &other) = delete;
+	Slots &operator= (const Slots &other) = delete;
+
+	/** @brief Get number of threads which may run; at least 1 */
+	size_t size () const
+	{
+		return count;
+	}
+
+private:
+	std::vector<char> tokens; ///< Tokens taken from the jobserver
+	size_t count;             ///< Number of threads which may run
+};
+}
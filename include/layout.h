@@ -0,0 +1,102 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file layout.h
+ *  @brief Incremental build state
+ */
+#pragma once
+
+#include "atlas.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** @brief FNV-1a offset basis */
+constexpr uint64_t FNV1A_BASIS = 0xCBF29CE484222325ULL;
+
+/** @brief Update a 64-bit FNV-1a hash
+ *  @param[in] data Data to hash
+ *  @param[in] size Data size
+ *  @param[in] hash Hash to update
+ *  @returns Updated hash
+ */
+uint64_t fnv1a (const void *data, size_t size, uint64_t hash = FNV1A_BASIS);
+
+/** @brief Compute a 64-bit MurmurHash64A hash
+ *  @param[in] data Data to hash
+ *  @param[in] size Data size
+ *  @param[in] seed Hash seed
+ *  @returns Hash
+ */
+uint64_t murmur64 (const void *data, size_t size, uint64_t seed = 0);
+
+/** @brief 128-bit digest of a tile's pixels, from two independent hashes */
+struct TileDigest
+{
+	uint64_t fnv;    ///< FNV-1a hash
+	uint64_t murmur; ///< MurmurHash64A hash
+
+	/** @brief Compute digest
+	 *  @param[in] data Data to hash
+	 *  @param[in] size Data size
+	 *  @returns Digest
+	 */
+	static TileDigest of (const void *data, size_t size);
+
+	bool operator== (const TileDigest &other) const
+	{
+		return fnv == other.fnv && murmur == other.murmur;
+	}
+};
+
+/** @brief Incremental build state
+ *
+ *  @details
+ *  Recorded in a sidecar file after each build. A later build with the same
+ *  settings keeps unchanged atlas sprites at their previous placement and
+ *  copies the encoded tiles whose pixels did not change out of the previous
+ *  output instead of encoding them again.
+ */
+struct Layout
+{
+	std::string settings;          ///< Settings the atlas layout was built with
+	std::string encoding;          ///< Settings the tiles were encoded with
+	AtlasLayout atlas;             ///< Atlas placement
+	size_t dataOffset;             ///< Offset of compressed image data in the output file
+	size_t dataSize;               ///< Size of compressed image data in the output file
+	uint64_t dataHash;             ///< Hash of compressed image data
+	std::vector<TileDigest> tiles; ///< Digest of each tile's pixels, in output order
+
+	Layout () : dataOffset (0), dataSize (0), dataHash (0)
+	{
+	}
+
+	/** @brief Read layout from a sidecar file
+	 *  @param[in] path Sidecar path
+	 *  @returns Whether a valid layout was read
+	 */
+	bool read (const std::string &path);
+
+	/** @brief Write layout to a sidecar file
+	 *  @param[in] path Sidecar path
+	 */
+	void write (const std::string &path) const;
+};
@@ -0,0 +1,127 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file rectpack.h
+ *  @brief Rectangle packing heuristics
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+/** @namespace rectpack
+ *  @brief Rectangle packing namespace
+ */
+namespace rectpack
+{
+/** @brief Packing heuristic */
+enum Heuristic
+{
+	CONTACT,          ///< Corner points scored by contact with placed rectangles
+	MAXRECTS_BSSF,    ///< MaxRects, best short side fit
+	MAXRECTS_CONTACT, ///< MaxRects, contact point rule
+	SKYLINE,          ///< Skyline, bottom-left rule
+	GUILLOTINE,       ///< Guillotine, best area fit with shorter leftover axis split
+};
+
+/** @brief Number of packing heuristics */
+constexpr size_t NUM_HEURISTICS = GUILLOTINE + 1;
+
+/** @brief Order in which rectangles are placed */
+enum SortOrder
+{
+	SORT_AREA,      ///< Largest area first
+	SORT_PERIMETER, ///< Largest perimeter first
+	SORT_SIDE,      ///< Longest side first
+	SORT_WIDTH,     ///< Widest first
+	SORT_HEIGHT,    ///< Tallest first
+};
+
+/** @brief Number of sort orders */
+constexpr size_t NUM_SORT_ORDERS = SORT_HEIGHT + 1;
+
+/** @brief Placed rectangle */
+struct Rect
+{
+	size_t x;     ///< Left coordinate
+	size_t y;     ///< Top coordinate
+	size_t w;     ///< Width, as placed
+	size_t h;     ///< Height, as placed
+	bool rotated; ///< Whether the rectangle was rotated by 90 degrees
+};
+
+/** @brief Get heuristic name
+ *  @param[in] heuristic Heuristic
+ *  @returns Heuristic name
+ */
+const char *name (Heuristic heuristic);
+
+/** @brief Get sort order name
+ *  @param[in] order Sort order
+ *  @returns Sort order name
+ */
+const char *name (SortOrder order);
+
+/** @brief Compare rectangles for placement order
+ *  @param[in] order Sort order
+ *  @param[in] w1    First width
+ *  @param[in] h1    First height
+ *  @param[in] w2    Second width
+ *  @param[in] h2    Second height
+ *  @returns Whether the first rectangle should be placed before the second
+ *
+ *  @note Ties are broken the same way for every order, so this is a strict
+ *  weak ordering which only treats equal sizes as equivalent.
+ */
+bool placeBefore (SortOrder order, size_t w1, size_t h1, size_t w2, size_t h2);
+
+/** @brief Rectangle packer */
+class Packer
+{
+public:
+	virtual ~Packer ()
+	{
+	}
+
+	/** @brief Mark an area as used
+	 *  @param[in] rect Area to mark
+	 *
+	 *  @note Reserved areas must lie inside the bin and not overlap.
+	 */
+	virtual void reserve (const Rect &rect) = 0;
+
+	/** @brief Place a rectangle
+	 *  @param[in]  w    Width
+	 *  @param[in]  h    Height
+	 *  @param[out] rect Placement
+	 *  @returns Whether the rectangle fit
+	 *
+	 *  @note The rectangle may be rotated by 90 degrees to make it fit.
+	 */
+	virtual bool insert (size_t w, size_t h, Rect &rect) = 0;
+
+	/** @brief Create a packer
+	 *  @param[in] heuristic Packing heuristic
+	 *  @param[in] width     Bin width
+	 *  @param[in] height    Bin height
+	 *  @returns Packer
+	 */
+	static std::unique_ptr<Packer> create (Heuristic heuristic, size_t width, size_t height);
+};
+}
@@ -0,0 +1,89 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file stats.h
+ *  @brief Per-stage timing statistics and Chrome trace output
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace stats
+{
+/** @brief Enable statistics collection
+ *  @note Must be called before any other thread is started.
+ */
+void enable ();
+
+/** @brief Whether statistics are being collected */
+bool enabled ();
+
+/** @brief Write a Chrome trace_event file in report (); enables statistics
+ *  @param[in] path Output path
+ */
+void setTracePath (const std::string &path);
+
+/** @brief Name the current thread in the trace
+ *  @param[in] name Thread name; must outlive report ()
+ */
+void threadName (const char *name);
+
+/** @brief Count data processed by a stage
+ *  @param[in] stage Stage name; must outlive report ()
+ *  @param[in] in    Bytes in
+ *  @param[in] out   Bytes out
+ *  @param[in] items Items processed, e.g. tiles
+ */
+void count (const char *stage, size_t in, size_t out, size_t items = 0);
+
+/** @brief Print the per-stage report and write the trace file
+ *  @returns Whether the trace file was written, or none was requested
+ *  @note No span may be running on another thread.
+ */
+bool report ();
+
+/** @brief Timed span of a stage on the current thread
+ *
+ *  @details
+ *  When built with --enable-alloc-stats, allocations made on the thread
+ *  during the innermost span are counted against its stage.
+ */
+class Span
+{
+public:
+	/** @brief Start span
+	 *  @param[in] stage Stage name; must outlive report ()
+	 */
+	explicit Span (const char *stage);
+
+	/** @brief End span */
+	~Span ();
+
+	Span (const Span &other) = delete;
+	Span &operator= (const Span &other) = delete;
+
+private:
+	const char *stage; ///< Stage name; null if not collecting
+	uint64_t start;    ///< Start time (ns)
+	uint64_t cpu;      ///< Thread CPU time at start (ns)
+	size_t previous;   ///< Allocation stage of the enclosing span
+};
+}
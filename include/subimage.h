@@ -40,6 +40,11 @@ struct SubImage
 	float right;      ///< Right u-coordinate
 	float bottom;     ///< Bottom v-coordinate
 	bool rotated;     ///< Whether sub-image is rotated
+	size_t page;      ///< Atlas page
+	size_t srcWidth;  ///< Untrimmed width
+	size_t srcHeight; ///< Untrimmed height
+	size_t trimLeft;  ///< Left offset of the trimmed image in the untrimmed image
+	size_t trimTop;   ///< Top offset of the trimmed image in the untrimmed image
 
 	SubImage (size_t index,
 	    const std::string &name,
@@ -54,7 +59,12 @@ struct SubImage
 	      top (top),
 	      right (right),
 	      bottom (bottom),
-	      rotated (rotated)
+	      rotated (rotated),
+	      page (0),
+	      srcWidth (0),
+	      srcHeight (0),
+	      trimLeft (0),
+	      trimTop (0)
 	{
 		assert (rotated == (top < bottom));
 
@@ -0,0 +1,197 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file t3x.h
+ *  @brief Reference .t3x reader
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** @namespace t3x
+ *  @brief Reference .t3x reader namespace
+ *
+ *  @details
+ *  A .t3x file starts with the Tex3DS header:
+ *    - u16 number of sub-images
+ *    - u8 texture parameters: log2 (width) - 3 in bits 0-2, log2 (height) - 3
+ *      in bits 3-5, cubemap in bit 6, extension byte present in bit 7
+ *    - u8 texture format
+ *    - u8 number of mipmaps, not counting the base level
+ *    - u8 extension flags, if bit 7 of the texture parameters is set
+ *    - for each sub-image: u16 width, u16 height, and u16 left, top, right and
+ *      bottom texture coordinates scaled by 1024. With EXTENSION_TRIM, four
+ *      u16 follow: untrimmed width and height, and left and top trim offset.
+ *
+ *  Normally the header is followed by the image data of every face and
+ *  mipmap level, compressed together with a GBA-style compression header.
+ *
+ *  With EXTENSION_CHUNKED, the header is followed by a u16 chunk count and a
+ *  chunk table; each mipmap level of each face is a chunk, in the same order
+ *  as the image data would be. An entry is a u8 compression type, three
+ *  reserved bytes, and u32 offset, stored size and uncompressed size. Chunks
+ *  start on CHUNK_ALIGN boundaries. A chunk with compression type 0x00 is
+ *  stored as-is; others start with their compression header.
+ *
+ *  All values are little-endian.
+ */
+namespace t3x
+{
+/** @brief Texture parameters flag: texture is a cubemap */
+constexpr uint8_t PARAM_CUBEMAP = 1 << 6;
+
+/** @brief Texture parameters flag: extension flags byte is present */
+constexpr uint8_t PARAM_EXTENSION = 1 << 7;
+
+/** @brief Extension flag: untrimmed size and trim offset follow each sub-image */
+constexpr uint8_t EXTENSION_TRIM = 1 << 0;
+
+/** @brief Extension flag: chunk table follows the sub-images */
+constexpr uint8_t EXTENSION_CHUNKED = 1 << 1;
+
+/** @brief Alignment of chunks */
+constexpr size_t CHUNK_ALIGN = 0x80;
+
+/** @brief Number of texture formats */
+constexpr uint8_t NUM_FORMATS = 0x0E;
+
+/** @brief Sub-image */
+struct SubImage
+{
+	uint16_t width;     ///< Width (pixels)
+	uint16_t height;    ///< Height (pixels)
+	float left;         ///< Left texture coordinate
+	float top;          ///< Top texture coordinate
+	float right;        ///< Right texture coordinate
+	float bottom;       ///< Bottom texture coordinate
+	uint16_t srcWidth;  ///< Untrimmed width; 0 without EXTENSION_TRIM
+	uint16_t srcHeight; ///< Untrimmed height; 0 without EXTENSION_TRIM
+	uint16_t trimLeft;  ///< Left trim offset
+	uint16_t trimTop;   ///< Top trim offset
+};
+
+/** @brief Chunk table entry */
+struct Chunk
+{
+	uint8_t type;              ///< Compression type; 0x00 if stored as-is
+	uint32_t offset;           ///< Offset in file
+	uint32_t size;             ///< Stored size
+	uint32_t uncompressedSize; ///< Uncompressed size
+};
+
+/** @brief Parsed .t3x file */
+class Texture
+{
+public:
+	/** @brief Parse a .t3x file
+	 *  @param[in] file File contents
+	 *  @throws std::runtime_error if the file is malformed
+	 */
+	explicit Texture (std::vector<uint8_t> file);
+
+	/** @brief Read and parse a .t3x file
+	 *  @param[in] path File path
+	 *  @throws std::runtime_error if the file can't be read or is malformed
+	 */
+	static Texture read (const std::string &path);
+
+	/** @brief Get texture width */
+	size_t width () const
+	{
+		return texWidth;
+	}
+
+	/** @brief Get texture height */
+	size_t height () const
+	{
+		return texHeight;
+	}
+
+	/** @brief Get texture format */
+	uint8_t format () const
+	{
+		return texFormat;
+	}
+
+	/** @brief Get number of mipmap levels, including the base level */
+	size_t levels () const
+	{
+		return numLevels;
+	}
+
+	/** @brief Get number of faces; 6 for cubemaps, otherwise 1 */
+	size_t faces () const
+	{
+		return numFaces;
+	}
+
+	/** @brief Get extension flags */
+	uint8_t extensions () const
+	{
+		return extensionFlags;
+	}
+
+	/** @brief Get sub-images */
+	const std::vector<SubImage> &subImages () const
+	{
+		return subs;
+	}
+
+	/** @brief Get chunk table; empty unless chunked */
+	const std::vector<Chunk> &chunks () const
+	{
+		return table;
+	}
+
+	/** @brief Get size of a mipmap level of one face
+	 *  @param[in] level Mipmap level
+	 *  @returns Size (bytes)
+	 */
+	size_t levelSize (size_t level) const;
+
+	/** @brief Load a mipmap level of one face
+	 *  @param[in] face  Face
+	 *  @param[in] level Mipmap level
+	 *  @returns Image data
+	 *
+	 *  @note Only the level's chunk is decompressed when the file is chunked.
+	 */
+	std::vector<uint8_t> load (size_t face, size_t level) const;
+
+	/** @brief Load all image data
+	 *  @returns Image data of every mipmap level of every face
+	 */
+	std::vector<uint8_t> load () const;
+
+private:
+	std::vector<uint8_t> file;  ///< File contents
+	std::vector<SubImage> subs; ///< Sub-images
+	std::vector<Chunk> table;   ///< Chunk table
+	size_t texWidth;            ///< Texture width
+	size_t texHeight;           ///< Texture height
+	size_t numLevels;           ///< Number of mipmap levels
+	size_t numFaces;            ///< Number of faces
+	size_t dataOffset;          ///< Offset of unchunked image data
+	uint8_t texFormat;          ///< Texture format
+	uint8_t extensionFlags;     ///< Extension flags
+};
+}
@@ -22,35 +22,184 @@
  */
 #pragma once
 
-#include <functional>
-#include <future>
-#include <queue>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
 #include <type_traits>
+#include <utility>
 
+class TaskGroup;
+
+/** @brief Work-stealing thread pool
+ *
+ *  @details
+ *  Every worker owns a bounded lock-free deque. A worker submits tasks to its
+ *  own deque and runs the newest first, so a worker waiting for a group runs
+ *  that group's tasks before older ones; other threads submit to a shared
+ *  queue. An idle worker takes from the shared queue, then steals the oldest
+ *  task of another worker. Tasks are stored inline, so submitting a task does
+ *  not allocate. If the queues are full, the task runs on the submitting
+ *  thread.
+ *
+ *  Tasks are submitted and waited for with a TaskGroup.
+ */
 class ThreadPool
 {
 public:
 	~ThreadPool ();
 
-	template <typename F, class... Args>
-	static auto enqueue (F &&f, Args &&... args) -> decltype (
-	    std::async (std::launch::deferred, std::forward<F> (f), std::forward<Args> (args)...)
-	        .share ())
+	/** @brief Type-erased task */
+	class Task
 	{
-		auto future =
-		    std::async (std::launch::deferred, std::forward<F> (f), std::forward<Args> (args)...)
-		        .share ();
+	public:
+		/** @brief Size of the inline storage for the callable */
+		static constexpr size_t STORAGE = 64;
 
-		pushJob (std::bind (&decltype (future)::wait, future));
+		Task () = default;
 
-		assert (future.valid ());
-		return future;
-	}
+		/** @brief Constructor
+		 *  @param[in] f     Callable; must fit in STORAGE
+		 *  @param[in] group Group to notify when the task completes
+		 */
+		template <typename F>
+		Task (F &&f, TaskGroup *group);
+
+		Task (Task &&other) noexcept;
+		Task &operator= (Task &&other) noexcept;
+		~Task ();
+
+		Task (const Task &other) = delete;
+		Task &operator= (const Task &other) = delete;
+
+		/** @brief Run the task and notify its group */
+		void run ();
+
+	private:
+		/** @brief Callable operation */
+		enum Op
+		{
+			OP_RUN,     ///< Invoke callable
+			OP_MOVE,    ///< Move callable to another task
+			OP_DESTROY, ///< Destroy callable
+		};
+
+		/** @brief Perform callable operation
+		 *  @param[in] op    Operation
+		 *  @param[in] self  Task holding the callable
+		 *  @param[in] other Destination task for OP_MOVE
+		 */
+		template <typename F>
+		static void manage (Op op, Task *self, Task *other);
+
+		/** @brief Destroy callable */
+		void reset ();
+
+		typename std::aligned_storage<STORAGE, alignof (std::max_align_t)>::type
+		    storage;                                 ///< Callable
+		void (*ops) (Op, Task *, Task *) = nullptr; ///< Callable operations
+		TaskGroup *group                 = nullptr; ///< Group to notify
+	};
+
+	/** @brief Get number of worker threads */
+	static size_t size ();
 
 private:
 	ThreadPool ();
 
-	static void pushJob (std::function<void(void)> &&job);
+	/** @brief Submit a task
+	 *  @param[in] task Task to submit
+	 */
+	static void push (Task &&task);
+
+	/** @brief Run a queued task
+	 *  @returns Whether a task was run
+	 */
+	static bool runOne ();
+
+	/** @brief Sleep until a task is queued or a group completes
+	 *  @param[in] group Group being waited for
+	 */
+	static void idle (const TaskGroup &group);
+
+	/** @brief Notify a group that one of its tasks completed
+	 *  @param[in] group Group
+	 *  @param[in] error Exception thrown by the task, if any
+	 */
+	static void complete (TaskGroup *group, std::exception_ptr error);
 
 	static ThreadPool pool;
+
+	friend class TaskGroup;
 };
+
+/** @brief Group of tasks which are waited for together */
+class TaskGroup
+{
+public:
+	TaskGroup () = default;
+
+	/** @brief Destructor; waits for outstanding tasks */
+	~TaskGroup ();
+
+	TaskGroup (const TaskGroup &other) = delete;
+	TaskGroup &operator= (const TaskGroup &other) = delete;
+
+	/** @brief Run a task in the thread pool
+	 *  @param[in] f Callable; must fit in ThreadPool::Task::STORAGE
+	 */
+	template <typename F>
+	void run (F &&f)
+	{
+		pending.fetch_add (1, std::memory_order_relaxed);
+		ThreadPool::push (ThreadPool::Task (std::forward<F> (f), this));
+	}
+
+	/** @brief Wait for every task in the group
+	 *  @note The calling thread runs queued tasks while it waits.
+	 *  @throws The first exception thrown by a task
+	 */
+	void wait ();
+
+private:
+	std::atomic<size_t> pending{0}; ///< Number of outstanding tasks
+	std::mutex mutex;               ///< Error mutex
+	std::exception_ptr error;       ///< First exception thrown by a task
+
+	friend class ThreadPool;
+};
+
+template <typename F>
+ThreadPool::Task::Task (F &&f, TaskGroup *group)
+    : ops (&manage<typename std::decay<F>::type>), group (group)
+{
+	typedef typename std::decay<F>::type Callable;
+
+	static_assert (sizeof (Callable) <= STORAGE, "Task is too large to store inline");
+	static_assert (alignof (Callable) <= alignof (std::max_align_t), "Task is over-aligned");
+
+	new (&storage) Callable (std::forward<F> (f));
+}
+
+template <typename F>
+void ThreadPool::Task::manage (Op op, Task *self, Task *other)
+{
+	F *callable = reinterpret_cast<F *> (&self->storage);
+
+	switch (op)
+	{
+	case OP_RUN:
+		(*callable) ();
+		break;
+
+	case OP_MOVE:
+		new (&other->storage) F (std::move (*callable));
+		callable->~F ();
+		break;
+
+	case OP_DESTROY:
+		callable->~F ();
+		break;
+	}
+}
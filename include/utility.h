@@ -23,7 +23,32 @@
 #pragma once
 
 #include "magick_compat.h"
+#include "subimage.h"
 
 Magick::Image applyTrim (Magick::Image &img);
 
+/** @brief Get the untrimmed size and trim offset recorded by applyTrim
+ *  @param[in]  img Image
+ *  @param[out] sub Sub-image to update
+ */
+void getTrim (const Magick::Image &img, SubImage &sub);
+
 void applyEdge (Magick::Image &img);
+
+/** @brief Color of invisible pixels */
+enum BleedMode
+{
+	BLEED_NONE,     ///< Keep the source color
+	BLEED_CONSTANT, ///< Black
+	BLEED_DILATE,   ///< Average color of the nearest visible pixels
+};
+
+/** @brief Set the color of invisible pixels
+ *  @param[in] img       Image to modify
+ *  @param[in] mode      Bleed mode
+ *  @param[in] alphaBits Alpha precision; a pixel is invisible if its alpha quantizes to 0
+ *  @returns Number of invisible pixels
+ *
+ *  @note The alpha of invisible pixels is not modified.
+ */
+size_t applyBleed (Magick::Image &img, BleedMode mode, unsigned alphaBits);
@@ -22,14 +22,25 @@
  */
 
 #include "atlas.h"
+#include "jobs.h"
+#include "rectpack.h"
+#include "stats.h"
 #include "subimage.h"
 #include "utility.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
-#include <set>
+#include <exception>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 namespace
@@ -42,8 +53,69 @@ inline size_t calcPOT (double x)
 	return std::pow (2.0, std::ceil (std::log2 (x)));
 }
 
+/** @brief Run a job for each index on worker threads
+ *  @param[in] count Number of indices
+ *  @param[in] job   Job to run for each index
+ *
+ *  @note Indices are handed out in increasing order. If any job throws, no
+ *  further indices are started and the exception from the lowest failing
+ *  index is rethrown.
+ */
+template <typename F>
+void parallelFor (size_t count, F &&job)
+{
+	std::atomic<size_t> next (0);
+	std::mutex mutex;
+	std::exception_ptr error;
+	size_t errorIndex = count;
+
+	auto worker = [&]() {
+		size_t index;
+		while ((index = next.fetch_add (1)) < count)
+		{
+			try
+			{
+				job (index);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock (mutex);
+				if (index < errorIndex)
+				{
+					error      = std::current_exception ();
+					errorIndex = index;
+				}
+
+				next.store (count);
+			}
+		}
+	};
+
+	const jobs::Slots slots (std::min (jobs::concurrency (), count));
+	const size_t numThreads = slots.size ();
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < numThreads; ++i)
+	{
+		workers.emplace_back ([&]() {
+			stats::threadName ("atlas");
+			worker ();
+		});
+	}
+
+	worker ();
+
+	for (auto &thread : workers)
+		thread.join ();
+
+	if (error)
+		std::rethrow_exception (error);
+}
+
 typedef std::pair<size_t, size_t> XY;
 
+typedef std::chrono::steady_clock Clock;
+
 struct Block
 {
 	size_t index;
@@ -84,10 +156,11 @@ struct Block
 		assert (right * width == x + w - edge);
 		assert ((1.0f - bottom) * height == y + h - edge);
 
-		if (rotated)
-			return SubImage (index, img.fileName (), bottom, left, top, right, true);
+		SubImage sub = rotated ? SubImage (index, img.fileName (), bottom, left, top, right, true)
+		                       : SubImage (index, img.fileName (), left, top, right, bottom, false);
 
-		return SubImage (index, img.fileName (), left, top, right, bottom, false);
+		getTrim (img, sub);
+		return sub;
 	}
 
 	bool operator< (const Block &other) const
@@ -105,14 +178,14 @@ struct Block
 	}
 };
 
+/** @brief Candidate atlas layout */
 struct Packer
 {
-	std::set<Block> placed;
-	std::vector<Block> next;
-	std::set<XY> free;
+	std::vector<Block> placed;
 
 	size_t width, height;
-	unsigned border;
+	rectpack::Heuristic heuristic;
+	rectpack::SortOrder order;
 
 	Packer ()                    = delete;
 	Packer (const Packer &other) = delete;
@@ -120,314 +193,586 @@ struct Packer
 	Packer &operator= (const Packer &other) = delete;
 	Packer &operator= (Packer &&other) = default;
 
-	Packer (const std::vector<Magick::Image> &images, size_t width, size_t height, unsigned border);
-
-	Magick::Image composite () const
+	Packer (size_t width, size_t height, rectpack::Heuristic heuristic, rectpack::SortOrder order)
+	    : placed (), width (width), height (height), heuristic (heuristic), order (order)
 	{
-		Magick::Image img (Magick::Geometry (width, height), transparent ());
+	}
 
-		for (const auto &block : placed)
-		{
-			if (!block.rotated)
-				img.composite (
-				    block.img, Magick::Geometry (0, 0, block.x, block.y), Magick::OverCompositeOp);
-			else
-			{
-				Magick::Image copy = block.img;
-				copy.rotate (-90);
-				img.composite (
-				    copy, Magick::Geometry (0, 0, block.x, block.y), Magick::OverCompositeOp);
-			}
-		}
+	Magick::Image composite () const;
 
-		return img;
+	template <typename F>
+	bool solve (const std::vector<Block> &fixed, const std::vector<Block> &blocks, F &&cancelled);
+};
+
+/** @brief Place blocks
+ *  @param[in] fixed     Blocks with a fixed placement
+ *  @param[in] blocks    Blocks to place
+ *  @param[in] cancelled Returns whether to give up
+ *  @returns Whether every block was placed
+ */
+template <typename F>
+bool Packer::solve (const std::vector<Block> &fixed, const std::vector<Block> &blocks, F &&cancelled)
+{
+	std::vector<const Block *> next;
+	for (const auto &block : blocks)
+		next.emplace_back (&block);
+
+	std::stable_sort (std::begin (next), std::end (next), [&](const Block *lhs, const Block *rhs) {
+		return rectpack::placeBefore (order, lhs->w, lhs->h, rhs->w, rhs->h);
+	});
+
+	auto packer = rectpack::Packer::create (heuristic, width, height);
+	for (const auto &block : fixed)
+	{
+		packer->reserve (rectpack::Rect{block.x, block.y, block.w, block.h, block.rotated});
+		placed.emplace_back (block);
 	}
 
-	void draw () const
+	for (const auto block : next)
 	{
-		Magick::Image img = composite ();
+		if (cancelled ())
+			return false;
+
+		rectpack::Rect rect;
+		if (!packer->insert (block->w, block->h, rect))
+			return false;
+
+		placed.emplace_back (*block);
+		placed.back ().x       = rect.x;
+		placed.back ().y       = rect.y;
+		placed.back ().w       = rect.w;
+		placed.back ().h       = rect.h;
+		placed.back ().rotated = rect.rotated;
 	}
 
-	void pack (size_t &x, size_t &y, size_t w, size_t h);
-	size_t calc_score (size_t x, size_t y, size_t w, size_t h);
-	bool solve ();
+	return true;
+}
+
+/** @brief Copy a placed block into an RGBA canvas
+ *  @param[in]  block  Block to copy
+ *  @param[out] canvas RGBA canvas
+ *  @param[in]  stride Canvas width (pixels)
+ *
+ *  @note Rotated blocks are copied transposed, equivalent to rotate (-90).
+ */
+void blit (const Block &block, Magick::Quantum *canvas, size_t stride)
+{
+	Magick::Image img = block.img;
+
+	const size_t columns = img.columns ();
+	const size_t rows    = img.rows ();
 
-	bool intersects_placed (size_t x, size_t y) const
+	std::vector<Magick::Quantum> row (4 * columns);
+	for (size_t y = 0; y < rows; ++y)
 	{
-		for (const auto &block : placed)
+		Magick::Quantum *out = canvas + 4 * ((block.y + y) * stride + block.x);
+		if (block.rotated)
+			out = row.data ();
+
+		img.write (0, y, columns, 1, "RGBA", Magick::QuantumPixel, out);
+
+		for (size_t x = 0; x < columns; ++x)
 		{
-			if (x >= block.x && x < block.x + block.w && y >= block.y && y < block.y + block.h)
-				return true;
-		}
+			Magick::Quantum *p = out + 4 * x;
 
-		return false;
-	}
+			// compositing over transparency clears invisible pixels
+			if (p[3] == 0)
+				p[0] = p[1] = p[2] = 0;
 
-	bool intersects_placed (const XY &xy) const
-	{
-		return intersects_placed (xy.first, xy.second);
+			if (block.rotated)
+				std::copy (p,
+				    p + 4,
+				    canvas + 4 * ((block.y + columns - 1 - x) * stride + block.x + y));
+		}
 	}
+}
+
+Magick::Image Packer::composite () const
+{
+	// placed blocks never overlap, so each can be copied straight into place
+	std::vector<Magick::Quantum> canvas (4 * width * height);
+	std::vector<const Block *> blocks;
+	for (const auto &block : placed)
+		blocks.emplace_back (&block);
 
-	void add_free (size_t x, size_t y, bool vert)
+	parallelFor (
+	    blocks.size (), [&](size_t index) { blit (*blocks[index], canvas.data (), width); });
+
+	return Magick::Image (width, height, "RGBA", Magick::QuantumPixel, canvas.data ());
+}
+
+struct AreaSizeComparator
+{
+	bool compare (size_t w1, size_t h1, size_t w2, size_t h2) const
 	{
-		if (x >= width || y >= height)
-			return;
+		size_t area1 = w1 * h1;
+		size_t area2 = w2 * h2;
 
-		if (intersects_placed (x, y))
-			return;
+		if (area1 != area2)
+			return area1 < area2;
+
+		if (std::max (w1, h1) == std::max (w2, h2))
+			return w1 < w2;
 
-		free.insert (XY (x, y));
+		return std::max (w1, h1) < std::max (w2, h2);
 	}
 
-	void fixup ()
+	bool operator() (const Magick::Image &lhs, const Magick::Image &rhs) const
 	{
-		auto it = std::begin (free);
-		while (it != std::end (free))
-		{
-			if (intersects_placed (*it))
-				it = free.erase (it);
-			else
-				++it;
-		}
+		return compare (lhs.columns (), lhs.rows (), rhs.columns (), rhs.rows ());
+	}
+
+	bool operator() (const Packer &lhs, const Packer &rhs) const
+	{
+		return compare (lhs.width, lhs.height, rhs.width, rhs.height);
 	}
 };
 
-Packer::Packer (const std::vector<Magick::Image> &images,
-    size_t width,
-    size_t height,
-    unsigned border)
-    : placed (), next (), free (), width (width), height (height), border (border)
+/** @brief Solve candidate packers concurrently
+ *  @param[in] packers  Candidate packers, in order of preference
+ *  @param[in] fixed    Blocks with a fixed placement
+ *  @param[in] blocks   Blocks to place
+ *  @param[in] deadline Time after which any known solution is accepted
+ *  @returns Index of the first packer in order which has a solution
+ *  @retval packers.size() no solution
+ *
+ *  @note Until the deadline, the result is the same as solving each packer in
+ *  order and stopping at the first success; candidates after a known solution
+ *  are cancelled. Once the deadline has passed and a solution is known, every
+ *  remaining candidate is cancelled.
+ */
+size_t solve (std::vector<Packer> &packers,
+    const std::vector<Block> &fixed,
+    const std::vector<Block> &blocks,
+    Clock::time_point deadline)
 {
-	for (const auto &img : images)
-		next.emplace_back (std::stoul (img.attribute ("index")), img, border);
+	std::atomic<size_t> solved (packers.size ());
 
-	free.insert (XY (0, 0));
+	auto cancelled = [&](size_t index) {
+		const size_t current = solved.load (std::memory_order_relaxed);
+		return current < index || (current != packers.size () && Clock::now () > deadline);
+	};
+
+	parallelFor (packers.size (), [&](size_t index) {
+		if (cancelled (index) ||
+		    !packers[index].solve (fixed, blocks, [&]() { return cancelled (index); }))
+			return;
+
+		// record the smallest solved candidate
+		size_t prev = solved.load ();
+		while (index < prev && !solved.compare_exchange_weak (prev, index))
+			;
+	});
+
+	return solved.load ();
 }
 
-bool Packer::solve ()
+/** @brief Load atlas inputs concurrently
+ *  @param[in] paths Input paths
+ *  @param[in] trim  Whether to trim inputs
+ *  @param[in] edge  Edge size to apply
+ *  @returns Images in input order
+ *
+ *  @note Each worker decodes one image at a time, so the number of untrimmed
+ *  images held in memory is bounded by the number of workers.
+ */
+std::vector<Magick::Image> load (const std::vector<std::string> &paths, bool trim, unsigned edge)
 {
-	while (!next.empty ())
-	{
-		Block block = next.back ();
-		next.pop_back ();
+	std::vector<Magick::Image> images (paths.size ());
 
-		XY best;
-		size_t best_score = 0;
-		bool best_rotated = false;
-		for (const auto &it : free)
-		{
-			block.x = it.first;
-			block.y = it.second;
+	parallelFor (paths.size (), [&](size_t index) {
+		stats::Span span ("load");
 
-			size_t score = calc_score (it.first, it.second, block.w, block.h);
-			if (score > best_score)
-			{
-				best         = it;
-				best_score   = score;
-				best_rotated = false;
-			}
+		Magick::Image img (paths[index]);
 
-			if (block.w != block.h)
-			{
-				size_t score = calc_score (it.first, it.second, block.h, block.w);
-				if (score > best_score)
-				{
-					best         = it;
-					best_score   = score;
-					best_rotated = true;
-				}
-			}
-		}
+		if (trim)
+			img = applyTrim (img);
 
-		if (best_score == 0)
-			return false;
+		if (edge)
+			applyEdge (img);
 
-		block.x = best.first;
-		block.y = best.second;
-		if (best_rotated)
-		{
-			std::swap (block.w, block.h);
-			block.rotated = true;
-		}
+		img.attribute ("index", std::to_string (index));
+
+		// compute the pixel hash while decoding in parallel
+		img.signature (true);
 
-		pack (block.x, block.y, block.w, block.h);
-		placed.insert (block);
-		free.erase (best);
+		images[index] = img;
 
-		add_free (block.x + block.w, block.y, true);
-		add_free (block.x, block.y + block.h, false);
+		stats::count ("load", 0, img.columns () * img.rows () * 4, 1);
+	});
 
-		fixup ();
+	return images;
+}
 
-		draw ();
+/** @brief Image with the same pixels as an earlier image */
+struct Alias
+{
+	Magick::Image img; ///< Duplicate image
+	size_t original;   ///< Index of the image it duplicates
+};
+
+/** @brief Remove duplicate images
+ *  @param[in,out] images Images in input order; duplicates are removed
+ *  @returns Removed duplicates
+ */
+std::vector<Alias> dedupe (std::vector<Magick::Image> &images)
+{
+	typedef std::tuple<size_t, size_t, std::string> Key;
+
+	std::map<Key, size_t> unique;
+	std::vector<Magick::Image> kept;
+	std::vector<Alias> aliases;
+	for (const auto &img : images)
+	{
+		const Key key (img.columns (), img.rows (), img.signature ());
+		const size_t index = std::stoul (img.attribute ("index"));
+
+		auto it = unique.find (key);
+		if (it == std::end (unique))
+		{
+			unique.emplace (key, index);
+			kept.emplace_back (img);
+		}
+		else
+			aliases.push_back (Alias{img, it->second});
 	}
 
-	return true;
+	images.swap (kept);
+	return aliases;
 }
 
-void Packer::pack (size_t &x, size_t &y, size_t w, size_t h)
+/** @brief Add sub-images for duplicates of images in an atlas
+ *  @param[in]     aliases Duplicate images
+ *  @param[in,out] atlas   Atlas to update
+ *
+ *  @note Duplicates share the placement of the image they duplicate.
+ */
+void addAliases (const std::vector<Alias> &aliases, Atlas &atlas)
 {
-	bool intersects_left = (x == 0) || intersects_placed (x - 1, y);
-	bool intersects_up   = (y == 0) || intersects_placed (x, y - 1);
-
-	if (!intersects_left && !intersects_up)
-		std::abort (); // should be adjacent to a placed block
+	const size_t count = atlas.subs.size ();
+	for (const auto &alias : aliases)
+	{
+		auto it = std::find_if (std::begin (atlas.subs),
+		    std::begin (atlas.subs) + count,
+		    [&](const SubImage &sub) { return sub.index == alias.original; });
+
+		if (it == std::begin (atlas.subs) + count)
+			continue;
+
+		SubImage sub (std::stoul (alias.img.attribute ("index")),
+		    alias.img.fileName (),
+		    it->left,
+		    it->top,
+		    it->right,
+		    it->bottom,
+		    it->rotated);
+		sub.page = it->page;
+		getTrim (alias.img, sub);
+
+		atlas.subs.emplace_back (std::move (sub));
+	}
 
-	if (intersects_left && intersects_up)
-		return;
+	std::sort (std::begin (atlas.subs), std::end (atlas.subs));
+}
 
-	if (intersects_left)
+/** @brief Fill in an atlas from a solved packer
+ *  @param[in]  packer Solved packer
+ *  @param[in]  border Border size
+ *  @param[in]  edge   Edge size
+ *  @param[out] atlas  Output atlas
+ */
+void finish (const Packer &packer, unsigned border, unsigned edge, Atlas &atlas)
+{
 	{
-		// move up as far as possible
-		--y;
-		while (y > 0 && !intersects_placed (x, y - 1))
-			--y;
+		stats::Span span ("composite");
+		atlas.img = packer.composite ();
 	}
-	else
+
+	for (auto &block : packer.placed)
+		atlas.subs.emplace_back (block.subImage (atlas.img, border, edge));
+
+	std::sort (std::begin (atlas.subs), std::end (atlas.subs));
+
+	atlas.layout.width  = packer.width;
+	atlas.layout.height = packer.height;
+	for (auto &block : packer.placed)
 	{
-		// move left as far as possible
-		--x;
-		while (x > 0 && !intersects_placed (x - 1, y))
-			--x;
+		atlas.layout.sprites.push_back (AtlasLayout::Sprite{
+		    block.img.fileName (), block.x, block.y, block.w, block.h, block.rotated});
 	}
 }
 
-size_t Packer::calc_score (size_t x, size_t y, size_t w, size_t h)
+/** @brief Pack images into a single atlas page
+ *  @param[in]  images  Images to pack
+ *  @param[in]  border  Border size
+ *  @param[in]  edge    Edge size
+ *  @param[in]  options Packing options
+ *  @param[out] atlas   Output atlas
+ *  @returns Whether a solution was found
+ */
+bool pack (const std::vector<Magick::Image> &images,
+    unsigned border,
+    unsigned edge,
+    const PackOptions &options,
+    Atlas &atlas)
 {
-	size_t score = 0;
+	stats::Span span ("pack");
 
-	pack (x, y, w, h);
+	const auto start = Clock::now ();
 
-	if (x + w > width)
-		return 0;
-	if (y + h > height)
-		return 0;
+	std::vector<Block> blocks;
 
-	for (const auto &block : placed)
+	size_t totalArea = 0;
+	size_t minSide   = 0;
+	size_t maxSide   = 0;
+	for (const auto &img : images)
 	{
-		if (x + w < block.x)
-			break;
+		blocks.emplace_back (std::stoul (img.attribute ("index")), img, border);
 
-		if (x < block.x + block.w && x + w > block.x && y < block.y + block.h && y + h > block.y)
-			return 0;
+		const size_t w = blocks.back ().w;
+		const size_t h = blocks.back ().h;
+
+		totalArea += w * h;
+
+		minSide = std::max (minSide, std::min (w, h));
+		maxSide = std::max (maxSide, std::max (w, h));
+	}
 
-		if (x == block.x + block.w || x + w == block.x)
+	std::vector<std::pair<rectpack::Heuristic, rectpack::SortOrder>> methods;
+	if (options.best)
+	{
+		for (size_t heuristic = 0; heuristic < rectpack::NUM_HEURISTICS; ++heuristic)
 		{
-			size_t start = std::max (y, block.y);
-			size_t end   = std::min (y + h, block.y + block.h);
-			if (end > start)
-				score += end - start;
+			for (size_t order = 0; order < rectpack::NUM_SORT_ORDERS; ++order)
+			{
+				methods.emplace_back (static_cast<rectpack::Heuristic> (heuristic),
+				    static_cast<rectpack::SortOrder> (order));
+			}
 		}
+	}
+	else
+		methods.emplace_back (options.heuristic, options.order);
+
+	// the search starts where the serial search started: at the smaller side of
+	// the largest image
+	size_t first = 8;
+	if (!images.empty ())
+	{
+		const auto &largest =
+		    *std::max_element (std::begin (images), std::end (images), AreaSizeComparator ());
+		first = calcPOT (std::min (largest.columns (), largest.rows ()));
+	}
 
-		if (y == block.y + block.h || y + h == block.y)
+	std::vector<Packer> packers;
+	for (size_t h = first; h <= 1024; h *= 2)
+	{
+		for (size_t w = first; w <= 1024; w *= 2)
 		{
-			size_t start = std::max (x, block.x);
-			size_t end   = std::min (x + w, block.x + block.w);
-			if (end > start)
-				score += end - start;
+			const size_t allowed_height = h - border;
+			const size_t allowed_width  = w - border;
+
+			if (allowed_width * allowed_height < totalArea)
+				continue;
+
+			// every block must fit in some orientation
+			if (minSide > std::min (allowed_width, allowed_height) ||
+			    maxSide > std::max (allowed_width, allowed_height))
+				continue;
+
+			for (const auto &method : methods)
+				packers.emplace_back (allowed_width, allowed_height, method.first, method.second);
 		}
 	}
 
-	if (x == 0)
-		score += h;
-	if (x + w == width)
-		score += h;
+	// smallest size first; methods keep their order within a size
+	std::stable_sort (std::begin (packers), std::end (packers), AreaSizeComparator ());
+
+	Clock::time_point deadline = Clock::time_point::max ();
+	if (options.best)
+		deadline = start + std::chrono::milliseconds (options.budget);
 
-	if (y == 0)
-		score += w;
-	if (y + h == height)
-		score += w;
+	const size_t index = solve (packers, std::vector<Block> (), blocks, deadline);
+	if (index == packers.size ())
+		return false;
 
-	return score;
+	finish (packers[index], border, edge, atlas);
+	return true;
 }
 
-struct AreaSizeComparator
+/** @brief Pack images around their placements in a previous layout
+ *  @param[in]  images   Images to pack
+ *  @param[in]  border   Border size
+ *  @param[in]  edge     Edge size
+ *  @param[in]  options  Packing options
+ *  @param[in]  previous Previous layout
+ *  @param[out] atlas    Output atlas
+ *  @returns Whether every image was placed
+ */
+bool repack (const std::vector<Magick::Image> &images,
+    unsigned border,
+    unsigned edge,
+    const PackOptions &options,
+    const AtlasLayout &previous,
+    Atlas &atlas)
 {
-	bool compare (size_t w1, size_t h1, size_t w2, size_t h2) const
+	stats::Span span ("pack");
+
+	if (previous.width + border > 1024 || previous.height + border > 1024)
+		return false;
+
+	std::multimap<std::string, const AtlasLayout::Sprite *> sprites;
+	for (const auto &sprite : previous.sprites)
+		sprites.emplace (sprite.name, &sprite);
+
+	std::vector<Block> fixed;
+	std::vector<Block> blocks;
+	for (const auto &img : images)
 	{
-		size_t area1 = w1 * h1;
-		size_t area2 = w2 * h2;
+		Block block (std::stoul (img.attribute ("index")), img, border);
 
-		if (area1 != area2)
-			return area1 < area2;
+		// keep the first previous placement with a matching name and size
+		auto range = sprites.equal_range (img.fileName ());
+		auto it    = range.first;
+		for (; it != range.second; ++it)
+		{
+			const AtlasLayout::Sprite &sprite = *it->second;
 
-		if (std::max (w1, h1) == std::max (w2, h2))
-			return w1 < w2;
+			const size_t w = sprite.rotated ? block.h : block.w;
+			const size_t h = sprite.rotated ? block.w : block.h;
 
-		return std::max (w1, h1) < std::max (w2, h2);
-	}
+			if (sprite.w != w || sprite.h != h || sprite.x + w > previous.width ||
+			    sprite.y + h > previous.height)
+				continue;
 
-	bool operator() (const Magick::Image &lhs, const Magick::Image &rhs) const
-	{
-		return compare (lhs.columns (), lhs.rows (), rhs.columns (), rhs.rows ());
-	}
+			const bool overlaps =
+			    std::any_of (std::begin (fixed), std::end (fixed), [&](const Block &other) {
+				    return sprite.x < other.x + other.w && sprite.x + w > other.x &&
+				           sprite.y < other.y + other.h && sprite.y + h > other.y;
+			    });
 
-	bool operator() (const Packer &lhs, const Packer &rhs) const
-	{
-		return compare (lhs.width, lhs.height, rhs.width, rhs.height);
+			if (!overlaps)
+				break;
+		}
+
+		if (it == range.second)
+		{
+			blocks.emplace_back (block);
+			continue;
+		}
+
+		const AtlasLayout::Sprite &sprite = *it->second;
+		sprites.erase (it);
+
+		block.x       = sprite.x;
+		block.y       = sprite.y;
+		block.w       = sprite.w;
+		block.h       = sprite.h;
+		block.rotated = sprite.rotated;
+		fixed.emplace_back (block);
 	}
-};
+
+	// the size is fixed, so there is nothing to search over
+	Packer packer (previous.width,
+	    previous.height,
+	    options.best ? rectpack::CONTACT : options.heuristic,
+	    options.best ? rectpack::SORT_AREA : options.order);
+
+	if (!packer.solve (fixed, blocks, []() { return false; }))
+		return false;
+
+	finish (packer, border, edge, atlas);
+	return true;
+}
 }
 
 Atlas Atlas::build (const std::vector<std::string> &paths,
     bool trim,
     unsigned border,
-    unsigned edge)
+    unsigned edge,
+    const PackOptions &options,
+    const AtlasLayout *previous)
 {
-	std::vector<Magick::Image> images;
+	std::vector<Magick::Image> images = load (paths, trim, edge);
+	const std::vector<Alias> aliases  = dedupe (images);
 
-	for (const auto &path : paths)
+	if (previous)
 	{
-		Magick::Image img (path);
+		Atlas atlas;
+		if (repack (images, border, edge, options, *previous, atlas))
+		{
+			addAliases (aliases, atlas);
+			return atlas;
+		}
+	}
 
-		if (trim)
-			img = applyTrim (img);
+	Atlas atlas;
+	if (!pack (images, border, edge, options, atlas))
+		throw std::runtime_error ("No atlas solution found.");
 
-		if (edge)
-			applyEdge (img);
+	addAliases (aliases, atlas);
+	return atlas;
+}
 
-		img.attribute ("index", std::to_string (images.size ()));
-		images.emplace_back (std::move (img));
-	}
+std::vector<Atlas> Atlas::buildPages (const std::vector<std::string> &paths,
+    bool trim,
+    unsigned border,
+    unsigned edge,
+    const PackOptions &options)
+{
+	std::vector<Magick::Image> images = load (paths, trim, edge);
+	const std::vector<Alias> aliases  = dedupe (images);
 
+	// largest images are distributed first
 	std::sort (std::begin (images), std::end (images), AreaSizeComparator ());
 
+	const size_t sheetSide = 1024 - border;
+
 	size_t totalArea = 0;
 	for (const auto &img : images)
-		totalArea += (img.rows () + border) * (img.columns () + border);
+	{
+		const size_t w = img.columns () + border;
+		const size_t h = img.rows () + border;
 
-	std::vector<Packer> packers;
-	for (size_t h = calcPOT (std::min (images.back ().columns (), images.back ().rows ()));
-	     h <= 1024;
-	     h *= 2)
+		if (std::max (w, h) > sheetSide)
+			throw std::runtime_error ("No atlas solution found.");
+
+		totalArea += w * h;
+	}
+
+	// start from the fewest pages that could hold the total area
+	size_t numPages = (totalArea + sheetSide * sheetSide - 1) / (sheetSide * sheetSide);
+	for (numPages = std::max<size_t> (numPages, 1); numPages <= images.size (); ++numPages)
 	{
-		for (size_t w = calcPOT (std::min (images.back ().columns (), images.back ().rows ()));
-		     w <= 1024;
-		     w *= 2)
+		// balance fill by giving each image to the emptiest page
+		std::vector<std::vector<Magick::Image>> bins (numPages);
+		std::vector<size_t> fill (numPages);
+		for (auto it = images.rbegin (); it != images.rend (); ++it)
 		{
-			const size_t allowed_height = h - border;
-			const size_t allowed_width  = w - border;
+			const auto   emptiest = std::min_element (std::begin (fill), std::end (fill));
+			const size_t page     = std::distance (std::begin (fill), emptiest);
 
-			if (allowed_width * allowed_height >= totalArea)
-				packers.emplace_back (images, allowed_width, allowed_height, border);
+			fill[page] += (it->columns () + border) * (it->rows () + border);
+			bins[page].emplace_back (*it);
 		}
-	}
 
-	std::sort (std::begin (packers), std::end (packers), AreaSizeComparator ());
+		std::vector<Atlas> pages (numPages);
 
-	for (auto &packer : packers)
-	{
-		if (packer.solve ())
-		{
-			Atlas atlas;
+		bool solved = true;
+		for (size_t page = 0; solved && page < numPages; ++page)
+			solved = pack (bins[page], border, edge, options, pages[page]);
 
-			atlas.img = packer.composite ();
-			for (auto &block : packer.placed)
-				atlas.subs.emplace_back (block.subImage (atlas.img, border, edge));
+		if (!solved)
+			continue;
 
-			std::sort (std::begin (atlas.subs), std::end (atlas.subs));
-			return atlas;
+		for (size_t page = 0; page < numPages; ++page)
+		{
+			for (auto &sub : pages[page].subs)
+				sub.page = page;
+
+			addAliases (aliases, pages[page]);
 		}
+
+		return pages;
 	}
 
 	throw std::runtime_error ("No atlas solution found.");
@@ -28,6 +28,7 @@
 #include "freetype.h"
 #include "future.h"
 #include "quantum.h"
+#include "stats.h"
 #include "swizzle.h"
 #include "threadPool.h"
 
@@ -349,7 +350,7 @@ void BCFNT::addFont (std::shared_ptr<freetype::Face> face_,
 	ascent  = std::max (ascent, static_cast<std::uint8_t> (face->size->metrics.ascender >> 6));
 	descent = std::min (descent, static_cast<int> (face->size->metrics.descender) >> 6);
 
-	std::vector<std::shared_future<void>> futures;
+	TaskGroup group;
 	std::mutex mutex;
 
 	// extract mappings from font face
@@ -376,8 +377,11 @@ void BCFNT::addFont (std::shared_ptr<freetype::Face> face_,
 		if (allowed (code, list, isBlacklist) && !glyphs.count (code))
 		{
 			auto job = [=, &mutex, &face_, &descent]() {
+				stats::Span span ("render");
+
 				auto face  = face_->getFace ();
 				auto glyph = renderGlyph (face, faceIndex);
+				stats::count ("render", 0, glyph.img.columns () * glyph.img.rows (), 1);
 
 				std::unique_lock<std::mutex> lock (mutex);
 
@@ -389,14 +393,13 @@ void BCFNT::addFont (std::shared_ptr<freetype::Face> face_,
 				glyphs.emplace (code, glyph);
 			};
 
-			futures.emplace_back (ThreadPool::enqueue (job));
+			group.run (job);
 		}
 
 		code = FT_Get_Next_Char (face, code, &faceIndex);
 	}
 
-	for (auto &future : futures)
-		future.wait ();
+	group.wait ();
 
 	if (glyphs.empty ())
 		return;
@@ -695,19 +698,22 @@ bool BCFNT::serialize (const std::string &path)
 
 	assert (std::distance (std::begin (output), it) == sheetOffset);
 
-	std::vector<std::shared_future<void>> futures;
+	TaskGroup group;
 
 	for (auto &sheet : sheetImages)
 	{
-		auto job = [&, it]() { appendSheet (it, sheet); };
+		auto job = [&, it]() {
+			stats::Span span ("encode");
+			appendSheet (it, sheet);
+			stats::count ("encode", SHEET_WIDTH * SHEET_HEIGHT, SHEET_SIZE, 1);
+		};
 
-		futures.emplace_back (ThreadPool::enqueue (job));
+		group.run (job);
 
 		std::advance (it, SHEET_SIZE);
 	}
 
-	for (auto &future : futures)
-		future.wait ();
+	group.wait ();
 
 	// CWDH header + data
 	assert (std::distance (std::begin (output), it) == cwdhOffset);
@@ -801,6 +807,9 @@ bool BCFNT::serialize (const std::string &path)
 	assert (std::distance (std::begin (output), it) == fileSize);
 	assert (it == std::end (output));
 
+	stats::Span span ("output");
+	stats::count ("output", output.size (), output.size ());
+
 	FILE *fp = std::fopen (path.c_str (), "wb");
 	if (!fp)
 		return false;
@@ -854,6 +863,9 @@ std::vector<Magick::Image> BCFNT::sheetify ()
 	std::vector<Magick::Image> sheets (numSheets);
 
 	auto buildSheet = [&](std::uint16_t num) {
+		stats::Span span ("sheet");
+		stats::count ("sheet", 0, 0, 1);
+
 		auto &sheet = sheets[num];
 		auto it     = iters[num];
 
@@ -879,12 +891,11 @@ std::vector<Magick::Image> BCFNT::sheetify ()
 		}
 	};
 
-	std::vector<std::shared_future<void>> futures;
+	TaskGroup group;
 	for (unsigned i = 0; i < numSheets; ++i)
-		futures.emplace_back (ThreadPool::enqueue (buildSheet, i));
+		group.run ([&buildSheet, i]() { buildSheet (i); });
 
-	for (auto &future : futures)
-		future.wait ();
+	group.wait ();
 
 	return sheets;
 }
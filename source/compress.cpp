@@ -0,0 +1,129 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file compress.cpp
+ *  @brief Generic decompression and compression estimate routines
+ */
+
+#include "compress.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+/** @brief Relative error allowed for an extrapolated estimate */
+#define ESTIMATE_MARGIN 0.04
+
+std::vector<uint8_t> decompress (const void *source, size_t len)
+{
+	const uint8_t *src = static_cast<const uint8_t *> (source);
+
+	if (len < 4)
+		throw std::runtime_error ("Truncated compression header");
+
+	uint8_t type = src[0];
+	size_t size  = src[1] | (src[2] << 8) | (src[3] << 16);
+	size_t skip  = 4;
+
+	if (type & 0x80)
+	{
+		if (len < 8)
+			throw std::runtime_error ("Truncated compression header");
+
+		type &= ~0x80;
+		size |= static_cast<size_t> (src[4]) << 24;
+		skip = 8;
+	}
+
+	std::vector<uint8_t> result (size);
+
+	switch (type)
+	{
+	case 0x00:
+		if (len - skip < size)
+			throw std::runtime_error ("Truncated data");
+		std::memcpy (result.data (), src + skip, size);
+		break;
+
+	case 0x10:
+		lzssDecode (src + skip, result.data (), size);
+		break;
+
+	case 0x11:
+		lz11Decode (src + skip, result.data (), size);
+		break;
+
+	case 0x28:
+		huffDecode (src + skip, result.data (), size);
+		break;
+
+	case 0x30:
+		rleDecode (src + skip, result.data (), size);
+		break;
+
+	default:
+		throw std::runtime_error ("Unknown compression type");
+	}
+
+	return result;
+}
+
+std::vector<CompressionEstimate> estimateCompression (const void *src, size_t len)
+{
+	std::vector<CompressionEstimate> estimates = {
+	    {"none", (len >= 0x1000000 ? 8 : 4) + ((len + 3) & ~static_cast<size_t> (0x3)), true},
+	    lzssEstimate (src, len),
+	    lz11Estimate (src, len),
+	    huffEstimate (src, len),
+	    rleEstimate (src, len),
+	};
+
+	std::stable_sort (std::begin (estimates),
+	    std::end (estimates),
+	    [](const CompressionEstimate &lhs, const CompressionEstimate &rhs) {
+		    return lhs.size < rhs.size;
+	    });
+
+	return estimates;
+}
+
+std::vector<CompressionEstimate> compressionCandidates (
+    const std::vector<CompressionEstimate> &estimates)
+{
+	assert (!estimates.empty ());
+
+	const CompressionEstimate &best = estimates.front ();
+
+	std::vector<CompressionEstimate> candidates = {best};
+	for (size_t i = 1; i < estimates.size (); ++i)
+	{
+		// exact sizes can't be wrong
+		if (best.exact && estimates[i].exact)
+			continue;
+
+		if (estimates[i].size <= best.size * (1.0 + ESTIMATE_MARGIN))
+			candidates.emplace_back (estimates[i]);
+	}
+
+	// too close to call; try everything
+	if (candidates.size () > 2)
+		return estimates;
+
+	return candidates;
+}
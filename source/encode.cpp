@@ -25,6 +25,9 @@
 #include "quantum.h"
 #include "rg_etc1.h"
 
+#include <cstring>
+#include <limits>
+
 namespace
 {
 /** @brief ETC1/ETC1A4 encoder
@@ -503,3 +506,232 @@ void etc1a4 (WorkUnit &work)
 	etc1_common (work, true);
 }
 }
+
+namespace
+{
+/** @brief Squared RGB error of a decoded ETC1 block
+ *  @param[in] src     Source pixels (RGBA)
+ *  @param[in] decoded Decoded pixels (RGBA)
+ *  @returns Sum of squared RGB error
+ */
+uint64_t blockError (const uint8_t src[4 * 4 * 4], const unsigned decoded[4 * 4])
+{
+	const uint8_t *dec = reinterpret_cast<const uint8_t *> (decoded);
+
+	uint64_t error = 0;
+	for (size_t i = 0; i < 4 * 4 * 4; i += 4)
+	{
+		for (size_t c = 0; c < 3; ++c)
+		{
+			int diff = static_cast<int> (src[i + c]) - static_cast<int> (dec[i + c]);
+			error += diff * diff;
+		}
+	}
+
+	return error;
+}
+
+/** @brief Recompute ETC1 selectors for new pixels
+ *  @param[in,out] block  ETC1 block (big-endian); colors are kept, selectors are replaced
+ *  @param[in]     src    Source pixels (RGBA)
+ *  @param[out]    pixels Decoded pixels (RGBA)
+ */
+void reselect (uint8_t block[8], const uint8_t src[4 * 4 * 4], unsigned pixels[4 * 4])
+{
+	// decode each selector applied to every pixel
+	unsigned decoded[4][4 * 4];
+	for (unsigned s = 0; s < 4; ++s)
+	{
+		uint8_t candidate[8];
+		std::memcpy (candidate, block, 4);
+		candidate[4] = candidate[5] = (s & 2) ? 0xFF : 0x00;
+		candidate[6] = candidate[7] = (s & 1) ? 0xFF : 0x00;
+
+		rg_etc1::unpack_etc1_block (candidate, decoded[s]);
+	}
+
+	uint16_t msb = 0;
+	uint16_t lsb = 0;
+	for (size_t y = 0; y < 4; ++y)
+	{
+		for (size_t x = 0; x < 4; ++x)
+		{
+			const uint8_t *in = &src[y * 16 + x * 4];
+
+			unsigned best      = 0;
+			unsigned bestError = std::numeric_limits<unsigned>::max ();
+			for (unsigned s = 0; s < 4; ++s)
+			{
+				const uint8_t *dec = reinterpret_cast<const uint8_t *> (&decoded[s][y * 4 + x]);
+
+				unsigned error = 0;
+				for (size_t c = 0; c < 3; ++c)
+				{
+					int diff = static_cast<int> (in[c]) - static_cast<int> (dec[c]);
+					error += diff * diff;
+				}
+
+				if (error < bestError)
+				{
+					best      = s;
+					bestError = error;
+				}
+			}
+
+			// selector bits are indexed column-major
+			unsigned bit = x * 4 + y;
+			msb |= ((best >> 1) & 1) << bit;
+			lsb |= ((best >> 0) & 1) << bit;
+
+			pixels[y * 4 + x] = decoded[best][y * 4 + x];
+		}
+	}
+
+	block[4] = msb >> 8;
+	block[5] = msb >> 0;
+	block[6] = lsb >> 8;
+	block[7] = lsb >> 0;
+}
+}
+
+namespace encode
+{
+ETC1Optimizer::ETC1Optimizer (double tolerance) : tolerance (tolerance * 4 * 4)
+{
+	history.reserve (HISTORY_SIZE);
+}
+
+void ETC1Optimizer::remember (const uint8_t block[8], const unsigned pixels[4 * 4])
+{
+	for (size_t i = 0; i < history.size (); ++i)
+	{
+		if (std::memcmp (history[i].block, block, 8) == 0)
+		{
+			last = i;
+			return;
+		}
+	}
+
+	if (history.size () < HISTORY_SIZE)
+		history.emplace_back ();
+
+	Entry &entry = history[next];
+	last         = next;
+	next         = (next + 1) % HISTORY_SIZE;
+
+	std::memcpy (entry.block, block, 8);
+	std::memcpy (entry.pixels, pixels, sizeof (entry.pixels));
+}
+
+void ETC1Optimizer::optimize (WorkUnit &work, bool alpha)
+{
+	const size_t blockSize = alpha ? 16 : 8;
+	if (work.result.size () != 4 * blockSize)
+		return;
+
+	uint8_t *out = work.result.data ();
+	for (size_t j = 0; j < 8; j += 4)
+	{
+		for (size_t i = 0; i < 8; i += 4)
+		{
+			uint8_t src[4 * 4 * 4];
+			for (size_t y = 0; y < 4; ++y)
+			{
+				for (size_t x = 0; x < 4; ++x)
+				{
+					Magick::Color c = work.p[(j + y) * work.stride + i + x];
+
+					src[y * 16 + x * 4 + 0] = quantum_to_bits<8> (quantumRed (c));
+					src[y * 16 + x * 4 + 1] = quantum_to_bits<8> (quantumGreen (c));
+					src[y * 16 + x * 4 + 2] = quantum_to_bits<8> (quantumBlue (c));
+					src[y * 16 + x * 4 + 3] = 0xFF;
+				}
+			}
+
+			// color block follows alpha block; convert back to big-endian
+			uint8_t *color = out + (alpha ? 8 : 0);
+			uint8_t block[8];
+			for (size_t k = 0; k < 8; ++k)
+				block[k] = color[8 - k - 1];
+
+			unsigned pixels[4 * 4];
+			rg_etc1::unpack_etc1_block (block, pixels);
+
+			const uint64_t error = blockError (src, pixels);
+			const double limit   = error + tolerance;
+
+			// prefer repeating a whole recent block
+			const Entry *match  = nullptr;
+			uint64_t matchError = std::numeric_limits<uint64_t>::max ();
+			for (const auto &entry : history)
+			{
+				uint64_t entryError = blockError (src, entry.pixels);
+				if (entryError <= limit && entryError < matchError)
+				{
+					match      = &entry;
+					matchError = entryError;
+				}
+			}
+
+			if (match && std::memcmp (match->block, block, 8) != 0)
+			{
+				std::memcpy (block, match->block, 8);
+				std::memcpy (pixels, match->pixels, sizeof (pixels));
+				++numReplaced;
+			}
+			else if (!match && !history.empty ())
+			{
+				// otherwise try repeating the previous block's colors
+				const Entry &prev = history[last];
+
+				uint8_t candidate[8];
+				unsigned candidatePixels[4 * 4];
+				std::memcpy (candidate, prev.block, 4);
+				reselect (candidate, src, candidatePixels);
+
+				if (std::memcmp (candidate, block, 4) != 0
+				    && blockError (src, candidatePixels) <= limit)
+				{
+					std::memcpy (block, candidate, 8);
+					std::memcpy (pixels, candidatePixels, sizeof (pixels));
+					++numReplaced;
+				}
+			}
+
+			remember (block, pixels);
+
+			for (size_t k = 0; k < 8; ++k)
+				color[8 - k - 1] = block[k];
+
+			if (work.preview)
+			{
+				const uint8_t *dec = reinterpret_cast<const uint8_t *> (pixels);
+
+				for (size_t y = 0; y < 4; ++y)
+				{
+					for (size_t x = 0; x < 4; ++x)
+					{
+						Magick::Color c = work.p[(j + y) * work.stride + i + x];
+
+						quantumRed (c, bits_to_quantum<8> (dec[y * 16 + x * 4 + 0]));
+						quantumGreen (c, bits_to_quantum<8> (dec[y * 16 + x * 4 + 1]));
+						quantumBlue (c, bits_to_quantum<8> (dec[y * 16 + x * 4 + 2]));
+
+						if (alpha)
+							quantumAlpha (c, quantize<4> (quantumAlpha (c)));
+						else
+						{
+							using Magick::Quantum;
+							quantumAlpha (c, QuantumRange);
+						}
+
+						work.p[(j + y) * work.stride + i + x] = c;
+					}
+				}
+			}
+
+			out += blockSize;
+		}
+	}
+}
+}
@@ -25,257 +25,278 @@
 #include "future.h"
 
 #include <algorithm>
+#include <cassert>
 #include <cstdlib>
 #include <cstring>
-#include <deque>
-#include <memory>
+#include <vector>
 
 namespace
 {
-/** @brief Huffman node */
-class Node
+/** @brief Maximum number of Huffman nodes (256 leaves and 255 parents) */
+constexpr size_t MAX_NODES = 511;
+
+/** @brief Huffman tree
+ *
+ *  @details
+ *  Nodes live in flat arrays and are referred to by index. A parent is always
+ *  added after both of its children, so children have lower indices than
+ *  their parents.
+ */
+class Tree
 {
 public:
-	/** @brief Parameterized constructor
-	 *  @param val   Node value
-	 *  @count count Node count
+	/** @brief Build Huffman tree
+	 *  @param[in] histogram Byte value histogram
+	 */
+	void build (const size_t histogram[256]);
+
+	/** @brief Encode Huffman tree
+	 *  @returns Encoded tree
 	 */
-	Node (uint8_t val, size_t count) : count (count), val (val)
+	std::vector<uint8_t> encode ();
+
+	/** @brief Get Huffman code
+	 *  @param[in] val Byte value
+	 */
+	uint32_t getCode (uint8_t val) const
 	{
+		return code[val];
 	}
 
-	/** @brief Parameterized constructor
-	 *  @param left  Left child
-	 *  @count right Right child
+	/** @brief Get Huffman code length
+	 *  @param[in] val Byte value
 	 */
-	Node (std::unique_ptr<Node> left, std::unique_ptr<Node> right)
-	    : child{std::move (left), std::move (right)}, count (child[0]->count + child[1]->count)
+	uint8_t getCodeLen (uint8_t val) const
 	{
-		// set children's parent to self
-		child[0]->parent = this;
-		child[1]->parent = this;
+		return codeLen[val];
 	}
 
-	Node () = delete;
-
-	Node (const Node &other) = delete;
-
-	Node (Node &&other) = delete;
+private:
+	/** @brief Add a data node
+	 *  @param[in] val   Node value
+	 *  @param[in] count Node weight
+	 *  @returns Node index
+	 */
+	uint16_t addLeaf (uint8_t val, size_t count)
+	{
+		assert (size < MAX_NODES);
 
-	Node &operator= (const Node &other) = delete;
+		this->count[size]  = count;
+		this->val[size]    = val;
+		this->leaves[size] = 1;
+		this->parent[size] = false;
 
-	Node &operator= (Node &&other) = delete;
+		return size++;
+	}
 
-	/** @brief Comparison operator
-	 *  @param other Object to compare
+	/** @brief Add a parent node
+	 *  @param[in] left  Left child
+	 *  @param[in] right Right child
+	 *  @returns Node index
 	 */
-	bool operator< (const Node &other) const
+	uint16_t addParent (uint16_t left, uint16_t right)
 	{
-		// major key is count
-		if (count != other.count)
-			return count < other.count;
+		assert (size < MAX_NODES);
 
-		// minor key is value
-		return val < other.val;
-	}
+		child[size][0] = left;
+		child[size][1] = right;
+		count[size]    = count[left] + count[right];
+		val[size]      = 0;
+		leaves[size]   = leaves[left] + leaves[right];
+		parent[size]   = true;
 
-	/** @brief Whether this node is a parent */
-	bool isParent () const
-	{
-		return static_cast<bool> (child[0]);
+		return size++;
 	}
 
-	/** @brief Build Huffman codes
-	 *  @param[in] node    Huffman node
-	 *  @param[in] code    Huffman code
-	 *  @param[in] codeLen Huffman code length (bits)
-	 */
-	static void buildCodes (std::unique_ptr<Node> &node, uint32_t code, size_t codeLen);
-
-	/** @brief Build lookup table
-	 *  @param[in] nodes Table to fill
-	 *  @param[in] n     Huffman node
-	 */
-	static void buildLookup (std::vector<Node *> &nodes, const std::unique_ptr<Node> &node);
+	/** @brief Build Huffman codes */
+	void buildCodes ();
 
 	/** @brief Serialize Huffman tree
-	 *  @param[out] tree Serialized tree
-	 *  @param[in]  node Root of subtree
-	 *  @param[in]  next Next available slot in tree
+	 *  @param[out] tree Serialized tree (node indices)
 	 */
-	static void serializeTree (std::vector<Node *> &tree, Node *node, unsigned next);
+	void serializeTree (std::vector<uint16_t> &tree);
 
 	/** @brief Fixup serialized Huffman tree
-	 *  @param[inout] tree Serialized tree
+	 *  @param[inout] tree Serialized tree (node indices)
 	 */
-	static void fixupTree (std::vector<Node *> &tree);
+	void fixupTree (std::vector<uint16_t> &tree);
+
+	size_t count[MAX_NODES];      ///< Node weight
+	uint16_t child[MAX_NODES][2]; ///< Children of parent nodes
+	uint16_t leaves[MAX_NODES];   ///< Number of leaves in subtree
+	uint8_t val[MAX_NODES];       ///< Data value, or child offset for parent nodes
+	bool parent[MAX_NODES];       ///< Whether node is a parent
+
+	uint32_t code[256]    = {}; ///< Huffman code of each byte value
+	uint8_t codeLen[256]  = {}; ///< Huffman code length (bits) of each byte value
+	size_t size           = 0;  ///< Number of nodes
+	uint16_t root         = 0;  ///< Root node
+};
 
-	/** @brief Encode Huffman tree
-	 *  @param[out] tree Huffman tree
-	 *  @param[in]  node Huffman node
-	 */
-	static void encodeTree (std::vector<uint8_t> &tree, Node *node);
+void Tree::build (const size_t histogram[256])
+{
+	std::vector<uint16_t> nodes;
+	nodes.reserve (256);
 
-	/** @brief Count number of nodes in subtree
-	 *  @returns Number of nodes in subtree
-	 */
-	size_t numNodes () const
+	for (unsigned val = 0; val < 256; ++val)
 	{
-		// sum of children plus self
-		if (isParent ())
-			return child[0]->numNodes () + child[1]->numNodes () + 1;
-
-		// this is a data node, just count self
-		return 1;
+		if (histogram[val] > 0)
+			nodes.emplace_back (addLeaf (val, histogram[val]));
 	}
 
-	/** @brief Count number of leaves in subtree
-	 *  @returns Number of leaves in subtree
-	 */
-	size_t numLeaves ()
-	{
-		if (leaves == 0)
-		{
-			if (isParent ())
-			{
-				// sum of children
-				leaves = child[0]->numLeaves () + child[1]->numLeaves ();
-			}
-			else
-			{
-				// this is a data node; it is a leaf
-				leaves = 1;
-			}
-		}
+	// no input; encode a single zero-weight value
+	if (nodes.empty ())
+		nodes.emplace_back (addLeaf (0x00, 0));
 
-		return leaves;
-	}
+	// major key is count, minor key is value
+	auto less = [this] (uint16_t lhs, uint16_t rhs) -> bool {
+		if (count[lhs] != count[rhs])
+			return count[lhs] < count[rhs];
 
-	/** @brief Get code */
-	uint32_t getCode () const
-	{
-		assert (!isParent ());
-		return code;
-	}
+		return val[lhs] < val[rhs];
+	};
 
-	/** @brief Get code length */
-	uint8_t getCodeLen () const
+	// combine nodes
+	while (nodes.size () > 1)
 	{
-		assert (!isParent ());
-		return codeLen;
+		// sort nodes by count; we will combine the two smallest nodes
+		std::sort (std::begin (nodes), std::end (nodes), less);
+
+		// replace first node with their parent
+		nodes[0] = addParent (nodes[0], nodes[1]);
+
+		// replace second node with last node
+		nodes[1] = nodes.back ();
+		nodes.pop_back ();
 	}
 
-private:
-	Node *parent;                   ///< Parent node
-	std::unique_ptr<Node> child[2]; ///< Children nodes
-	size_t count    = 0;            ///< Node weight
-	uint32_t code   = 0;            ///< Huffman encoding
-	unsigned leaves = 0;            ///< Number of leaves
-	uint8_t val     = 0;            ///< Huffman tree value
-	uint8_t codeLen = 0;            ///< Huffman code length (bits)
-#ifndef NDEBUG
-	uint16_t pos = 0; ///< Huffman tree position
-#endif
-};
+	// root is the last node left
+	root = nodes[0];
+
+	// root must have children
+	if (!parent[root])
+		root = addParent (root, addLeaf (0x00, 0));
+
+	buildCodes ();
+}
 
-void Node::buildCodes (std::unique_ptr<Node> &node, uint32_t code, size_t codeLen)
+void Tree::buildCodes ()
 {
-	// don't exceed 32-bit codes
-	assert (codeLen < 32);
+	uint32_t nodeCode[MAX_NODES];
+	uint8_t nodeCodeLen[MAX_NODES];
+
+	nodeCode[root]    = 0;
+	nodeCodeLen[root] = 0;
 
-	if (node->isParent ())
+	// parents have higher indices than their children, so walk down from the root
+	for (size_t i = root + 1; i-- > 0;)
 	{
-		// build codes for each subtree
-		assert (node->child[0] && node->child[1]);
-		buildCodes (node->child[0], (code << 1) | 0, codeLen + 1);
-		buildCodes (node->child[1], (code << 1) | 1, codeLen + 1);
+		if (!parent[i])
+			continue;
+
+		// don't exceed 32-bit codes
+		assert (nodeCodeLen[i] < 32);
+
+		for (unsigned j = 0; j < 2; ++j)
+		{
+			nodeCode[child[i][j]]    = (nodeCode[i] << 1) | j;
+			nodeCodeLen[child[i][j]] = nodeCodeLen[i] + 1;
+		}
 	}
-	else
+
+	// the zero-weight leaf added for a single-valued input comes last and wins
+	for (size_t i = 0; i < size; ++i)
 	{
-		// set code for data node
-		assert (!node->child[0] && !node->child[1]);
-		node->code    = code;
-		node->codeLen = codeLen;
+		if (parent[i])
+			continue;
+
+		code[val[i]]    = nodeCode[i];
+		codeLen[val[i]] = nodeCodeLen[i];
 	}
 }
 
-void Node::buildLookup (std::vector<Node *> &nodes, const std::unique_ptr<Node> &node)
+void Tree::serializeTree (std::vector<uint16_t> &tree)
 {
-	if (!node->isParent ())
+	/** @brief Subtree waiting to be serialized */
+	struct Subtree
 	{
-		// set lookup entry
-		nodes[node->val] = node.get ();
-		return;
-	}
+		uint16_t node; ///< Root of subtree
+		unsigned next; ///< Next available slot in tree
+	};
 
-	// build subtree lookups
-	buildLookup (nodes, node->child[0]);
-	buildLookup (nodes, node->child[1]);
-}
+	std::vector<Subtree> stack;
+	stack.push_back (Subtree{root, 2});
 
-void Node::serializeTree (std::vector<Node *> &tree, Node *node, unsigned next)
-{
-	assert (node->isParent ());
+	std::vector<uint16_t> queue;
+	queue.reserve (MAX_NODES);
 
-	if (node->numLeaves () > 0x40)
+	while (!stack.empty ())
 	{
-		// this subtree will overflow the offset field if inserted naively
-		tree[next + 0] = node->child[0].get ();
-		tree[next + 1] = node->child[1].get ();
+		uint16_t node = stack.back ().node;
+		unsigned next = stack.back ().next;
+		stack.pop_back ();
 
-		unsigned a = 0;
-		unsigned b = 1;
+		assert (parent[node]);
 
-		if (node->child[1]->numLeaves () < node->child[0]->numLeaves ())
-			std::swap (a, b);
-
-		if (node->child[a]->isParent ())
+		if (leaves[node] > 0x40)
 		{
-			node->child[a]->val = 0;
-			serializeTree (tree, node->child[a].get (), next + 2);
-		}
+			// this subtree will overflow the offset field if inserted naively
+			tree[next + 0] = child[node][0];
+			tree[next + 1] = child[node][1];
 
-		if (node->child[b]->isParent ())
-		{
-			node->child[b]->val = node->child[a]->numLeaves () - 1;
-			serializeTree (tree, node->child[b].get (), next + 2 * node->child[a]->numLeaves ());
-		}
+			uint16_t a = child[node][0];
+			uint16_t b = child[node][1];
 
-		return;
-	}
+			if (leaves[b] < leaves[a])
+				std::swap (a, b);
 
-	std::deque<Node *> queue;
+			if (parent[b])
+			{
+				val[b] = leaves[a] - 1;
+				stack.push_back (Subtree{b, next + 2 * leaves[a]});
+			}
 
-	queue.emplace_back (node->child[0].get ());
-	queue.emplace_back (node->child[1].get ());
+			if (parent[a])
+			{
+				val[a] = 0;
+				stack.push_back (Subtree{a, next + 2});
+			}
 
-	while (!queue.empty ())
-	{
-		node = queue.front ();
-		queue.pop_front ();
+			continue;
+		}
 
-		tree[next++] = node;
+		// breadth-first
+		queue.clear ();
+		queue.emplace_back (child[node][0]);
+		queue.emplace_back (child[node][1]);
 
-		if (!node->isParent ())
-			continue;
+		for (size_t head = 0; head < queue.size ();)
+		{
+			node = queue[head++];
 
-		node->val = queue.size () / 2;
+			tree[next++] = node;
 
-		queue.emplace_back (node->child[0].get ());
-		queue.emplace_back (node->child[1].get ());
+			if (!parent[node])
+				continue;
+
+			val[node] = (queue.size () - head) / 2;
+
+			queue.emplace_back (child[node][0]);
+			queue.emplace_back (child[node][1]);
+		}
 	}
 }
 
-void Node::fixupTree (std::vector<Node *> &tree)
+void Tree::fixupTree (std::vector<uint16_t> &tree)
 {
 	for (unsigned i = 1; i < tree.size (); ++i)
 	{
-		if (!tree[i]->isParent () || tree[i]->val <= 0x3F)
+		if (!parent[tree[i]] || val[tree[i]] <= 0x3F)
 			continue;
 
-		unsigned shift = tree[i]->val - 0x3F;
+		unsigned shift = val[tree[i]] - 0x3F;
 
-		if ((i & 1) && tree[i - 1]->val == 0x3F)
+		if ((i & 1) && val[tree[i - 1]] == 0x3F)
 		{
 			// right child, and left sibling would overflow if we shifted;
 			// shift the left child by 1 instead
@@ -283,261 +304,254 @@ void Node::fixupTree (std::vector<Node *> &tree)
 			shift = 1;
 		}
 
-		unsigned nodeEnd   = i / 2 + 1 + tree[i]->val;
+		unsigned nodeEnd   = i / 2 + 1 + val[tree[i]];
 		unsigned nodeBegin = nodeEnd - shift;
 
 		unsigned shiftBegin = 2 * nodeBegin;
 		unsigned shiftEnd   = 2 * nodeEnd;
 
 		// move last child pair to front
-		auto tmp = std::make_pair (tree[shiftEnd], tree[shiftEnd + 1]);
-		std::memmove (
-		    &tree[shiftBegin + 2], &tree[shiftBegin], sizeof (Node *) * (shiftEnd - shiftBegin));
-		std::tie (tree[shiftBegin], tree[shiftBegin + 1]) = tmp;
+		uint16_t tmp[2] = {tree[shiftEnd], tree[shiftEnd + 1]};
+		std::memmove (&tree[shiftBegin + 2],
+		    &tree[shiftBegin],
+		    sizeof (uint16_t) * (shiftEnd - shiftBegin));
+		tree[shiftBegin + 0] = tmp[0];
+		tree[shiftBegin + 1] = tmp[1];
 
 		// adjust offsets
-		tree[i]->val -= shift;
+		val[tree[i]] -= shift;
 		for (unsigned index = i + 1; index < shiftBegin; ++index)
 		{
-			if (!tree[index]->isParent ())
+			if (!parent[tree[index]])
 				continue;
 
-			unsigned node = index / 2 + 1 + tree[index]->val;
+			unsigned node = index / 2 + 1 + val[tree[index]];
 			if (node >= nodeBegin && node < nodeEnd)
-				++tree[index]->val;
+				++val[tree[index]];
 		}
 
-		if (tree[shiftBegin + 0]->isParent ())
-			tree[shiftBegin + 0]->val += shift;
-		if (tree[shiftBegin + 1]->isParent ())
-			tree[shiftBegin + 1]->val += shift;
+		if (parent[tree[shiftBegin + 0]])
+			val[tree[shiftBegin + 0]] += shift;
+		if (parent[tree[shiftBegin + 1]])
+			val[tree[shiftBegin + 1]] += shift;
 
 		for (unsigned index = shiftBegin + 2; index < shiftEnd + 2; ++index)
 		{
-			if (!tree[index]->isParent ())
+			if (!parent[tree[index]])
 				continue;
 
-			unsigned node = index / 2 + 1 + tree[index]->val;
+			unsigned node = index / 2 + 1 + val[tree[index]];
 			if (node > nodeEnd)
-				--tree[index]->val;
+				--val[tree[index]];
 		}
 	}
 }
 
-void Node::encodeTree (std::vector<uint8_t> &tree, Node *node)
+std::vector<uint8_t> Tree::encode ()
 {
-	std::vector<Node *> nodeTree (tree.size ());
-	nodeTree[1] = node;
-	serializeTree (nodeTree, node, 2);
+	// every node of the tree is reachable from the root
+	assert (size == 2u * leaves[root] - 1);
+
+	std::vector<uint16_t> nodeTree ((size + 2) & ~1);
+	nodeTree[1] = root;
+	serializeTree (nodeTree);
 	fixupTree (nodeTree);
 
 #ifndef NDEBUG
-	for (unsigned i = 1; i < nodeTree.size (); ++i)
 	{
-		assert (nodeTree[i]);
-		nodeTree[i]->pos = i;
-	}
+		std::vector<uint16_t> pos (size);
+		for (unsigned i = 1; i < nodeTree.size (); ++i)
+			pos[nodeTree[i]] = i;
 
-	for (unsigned i = 1; i < nodeTree.size (); ++i)
-	{
-		node = nodeTree[i];
-		if (!node->isParent ())
-			continue;
+		for (unsigned i = 1; i < nodeTree.size (); ++i)
+		{
+			uint16_t node = nodeTree[i];
+			if (!parent[node])
+				continue;
 
-		assert (!(node->val & 0x80));
-		assert (!(node->val & 0x40));
-		assert (node->child[0]->pos == (node->pos & ~1) + 2 * node->val + 2);
+			assert (!(val[node] & 0x80));
+			assert (!(val[node] & 0x40));
+			assert (pos[child[node][0]] == (i & ~1) + 2 * val[node] + 2);
+		}
 	}
 #endif
 
+	std::vector<uint8_t> tree (nodeTree.size ());
+
+	// first slot encodes tree size
+	tree[0] = size / 2;
+
 	for (unsigned i = 1; i < nodeTree.size (); ++i)
 	{
-		node = nodeTree[i];
+		uint16_t node = nodeTree[i];
 
-		tree[i] = node->val;
+		tree[i] = val[node];
 
-		if (!node->isParent ())
+		if (!parent[node])
 			continue;
 
-		if (!node->child[0]->isParent ())
+		if (!parent[child[node][0]])
 			tree[i] |= 0x80;
-		if (!node->child[1]->isParent ())
+		if (!parent[child[node][1]])
 			tree[i] |= 0x40;
 	}
+
+	return tree;
 }
 
-/** @brief Build Huffman tree
- *  @param[in] src Source data
- *  @param[in] len Source data length
- *  @returns Root node
+/** @brief Bitstream writer
+ *
+ *  @details
+ *  Codes are accumulated in a 64-bit word and written out in 32-bit
+ *  little-endian blocks, most significant bit first.
  */
-std::unique_ptr<Node> buildTree (const uint8_t *src, size_t len)
+class Bitstream
 {
-	// fill in histogram
-	std::vector<size_t> histogram (256);
-	for (size_t i = 0; i < len; ++i)
-		++histogram[src[i]];
+public:
+	/** @brief Parameterized constructor
+	 *  @param[in] out Output buffer; must have room for the whole bitstream
+	 */
+	explicit Bitstream (uint8_t *out) : out (out)
+	{
+	}
 
-	std::vector<std::unique_ptr<Node>> nodes;
+	/** @brief Push Huffman code onto bitstream
+	 *  @param[in] code Huffman code
+	 *  @param[in] len  Huffman code length (bits)
+	 */
+	void push (uint32_t code, unsigned len)
 	{
-		uint8_t val = 0;
-		for (const auto &count : histogram)
-		{
-			if (count > 0)
-				nodes.push_back (future::make_unique<Node> (val, count));
+		assert (len < 32);
+
+		bits = (bits << len) | code;
+		pos += len;
 
-			++val;
+		if (pos >= 32)
+		{
+			pos -= 32;
+			write (bits >> pos);
 		}
 	}
 
-	// done with histogram
-	histogram.clear ();
-
-	// combine nodes
-	while (nodes.size () > 1)
+	/** @brief Flush bitstream block, padded to 32 bits */
+	void flush ()
 	{
-		// sort nodes by count; we will combine the two smallest nodes
-		std::sort (std::begin (nodes),
-		    std::end (nodes),
-		    [] (const std::unique_ptr<Node> &lhs, const std::unique_ptr<Node> &rhs) -> bool {
-			    return *lhs < *rhs;
-		    });
-
-		// allocate a parent node
-		std::unique_ptr<Node> node =
-		    future::make_unique<Node> (std::move (nodes[0]), std::move (nodes[1]));
-
-		// replace first node with self
-		nodes[0] = std::move (node);
+		if (pos == 0)
+			return;
 
-		// replace second node with last node
-		nodes[1] = std::move (nodes.back ());
-		nodes.pop_back ();
+		write (bits << (32 - pos));
+		pos = 0;
 	}
 
-	// root is the last node left
-	std::unique_ptr<Node> root = std::move (nodes[0]);
+private:
+	/** @brief Write bitstream block
+	 *  @param[in] block Bitstream block
+	 */
+	void write (uint32_t block)
+	{
+		out[0] = block >> 0;
+		out[1] = block >> 8;
+		out[2] = block >> 16;
+		out[3] = block >> 24;
+		out += 4;
+	}
 
-	// root must have children
-	if (!root->isParent ())
-		root = future::make_unique<Node> (std::move (root), future::make_unique<Node> (0x00, 0));
+	uint8_t *out;      ///< Output pointer
+	uint64_t bits = 0; ///< Pending bits
+	unsigned pos  = 0; ///< Number of pending bits
+};
 
-	// build Huffman codes
-	Node::buildCodes (root, 0, 0);
+/** @brief Number of bits decoded by a single table lookup */
+constexpr unsigned LOOKUP_BITS = 10;
 
-	// return root node
-	return root;
-}
+/** @brief Decoding table entry */
+struct Lookup
+{
+	uint16_t node; ///< Node reached after LOOKUP_BITS bits, or 0 if a value was decoded
+	uint8_t bits;  ///< Number of bits consumed
+	uint8_t val;   ///< Decoded value
+};
 
-/** @brief Bitstream */
-class Bitstream
+/** @brief Build decoding table
+ *  @param[in]  tree   Encoded Huffman tree
+ *  @param[out] lookup Decoding table, indexed by the next LOOKUP_BITS bits
+ */
+void buildLookup (const uint8_t *tree, Lookup lookup[1 << LOOKUP_BITS])
 {
-public:
-	Bitstream (std::vector<uint8_t> &buffer) : buffer (buffer)
+	/** @brief Subtree waiting to be visited */
+	struct Subtree
 	{
-	}
+		unsigned node;   ///< Node position
+		unsigned prefix; ///< Bits leading to node
+		unsigned depth;  ///< Number of bits leading to node
+	};
 
-	/** @brief Flush bitstream block, padded to 32 bits */
-	void flush ()
+	std::vector<Subtree> stack;
+	stack.push_back (Subtree{1, 0, 0});
+
+	while (!stack.empty ())
 	{
-		if (pos >= 32)
-			return;
+		const Subtree subtree = stack.back ();
+		stack.pop_back ();
 
-		// append bitstream block to output buffer
-		buffer.reserve (buffer.size () + 4);
-		buffer.emplace_back (code >> 0);
-		buffer.emplace_back (code >> 8);
-		buffer.emplace_back (code >> 16);
-		buffer.emplace_back (code >> 24);
+		const unsigned child = (subtree.node & ~1) + (tree[subtree.node] & 0x3F) * 2 + 2;
 
-		// reset bitstream block
-		pos  = 32;
-		code = 0;
-	}
-
-	/** @brief Push Huffman code onto bitstream
-	 *  @param[in] code Huffman code
-	 *  @param[in] len  Huffman code length (bits)
-	 */
-	void push (uint32_t code, size_t len)
-	{
-		for (size_t i = 1; i <= len; ++i)
+		for (unsigned bit = 0; bit < 2; ++bit)
 		{
-			// get next bit position
-			--pos;
+			const unsigned prefix = subtree.prefix << 1 | bit;
+			const unsigned depth  = subtree.depth + 1;
 
-			// set/reset bit
-			if (code & (1U << (len - i)))
-				this->code |= (1U << pos);
+			if (tree[subtree.node] & (0x80 >> bit))
+			{
+				// data node; every entry starting with this code decodes it
+				const unsigned shift = LOOKUP_BITS - depth;
+				for (unsigned i = prefix << shift; i < (prefix + 1) << shift; ++i)
+					lookup[i] = Lookup{0, static_cast<uint8_t> (depth), tree[child + bit]};
+			}
+			else if (depth == LOOKUP_BITS)
+				lookup[prefix] = Lookup{static_cast<uint16_t> (child + bit), LOOKUP_BITS, 0};
 			else
-				this->code &= ~(1U << pos);
-
-			// flush bitstream block
-			if (pos == 0)
-				flush ();
+				stack.push_back (Subtree{child + bit, prefix, depth});
 		}
 	}
-
-private:
-	std::vector<uint8_t> &buffer; ///< Output buffer
-	size_t pos    = 32;           ///< Bit position
-	uint32_t code = 0;            ///< Bitstream block
-};
+}
 }
 
-std::vector<uint8_t> huffEncode (const void *source, size_t len)
+std::vector<uint8_t> huffEncodeHistogram (const void *source,
+    size_t len,
+    const size_t histogram[256])
 {
 	const uint8_t *src = (const uint8_t *)source;
-	size_t count;
 
 	// build Huffman tree
-	std::unique_ptr<Node> root = buildTree (src, len);
-
-	// build lookup table
-	std::vector<Node *> lookup (256);
-	Node::buildLookup (lookup, root);
-
-	// get number of nodes
-	count = root->numNodes ();
+	Tree tree;
+	tree.build (histogram);
 
-	// allocate Huffman encoded tree
-	std::vector<uint8_t> tree ((count + 2) & ~1);
-
-	// first slot encodes tree size
-	tree[0] = count / 2;
+	// size of the bitstream in bits
+	size_t bits = 0;
+	for (unsigned val = 0; val < 256; ++val)
+		bits += histogram[val] * tree.getCodeLen (val);
 
 	// encode Huffman tree
-	Node::encodeTree (tree, root.get ());
+	std::vector<uint8_t> encodedTree = tree.encode ();
 
 	// create output buffer
 	std::vector<uint8_t> result;
-	result.reserve (len); // hopefully our output will be smaller
+	result.reserve (8 + encodedTree.size () + (bits + 31) / 32 * 4 + 3);
 
 	// append compression header
 	compressionHeader (result, 0x28, len);
 
 	// append Huffman encoded tree
-	result.insert (std::end (result), std::begin (tree), std::end (tree));
-
-	// we're done with the Huffman encoded tree
-	tree.clear ();
-
-	// create bitstream
-	Bitstream bitstream (result);
+	result.insert (std::end (result), std::begin (encodedTree), std::end (encodedTree));
 
 	// encode each input byte
-	for (size_t i = 0; i < len; ++i)
-	{
-		// lookup the byte value's node
-		Node *node = lookup[src[i]];
+	size_t offset = result.size ();
+	result.resize (offset + (bits + 31) / 32 * 4);
 
-		// add Huffman code to bitstream
-		bitstream.push (node->getCode (), node->getCodeLen ());
-	}
-
-	// we're done with the Huffman tree and lookup table
-	root.reset ();
-	lookup.clear ();
+	Bitstream bitstream (result.data () + offset);
+	for (size_t i = 0; i < len; ++i)
+		bitstream.push (tree.getCode (src[i]), tree.getCodeLen (src[i]));
 
 	// flush the bitstream
 	bitstream.flush ();
@@ -550,78 +564,101 @@ std::vector<uint8_t> huffEncode (const void *source, size_t len)
 	return result;
 }
 
+std::vector<uint8_t> huffEncode (const void *source, size_t len)
+{
+	const uint8_t *src = (const uint8_t *)source;
+
+	// fill in histogram
+	size_t histogram[256] = {};
+	for (size_t i = 0; i < len; ++i)
+		++histogram[src[i]];
+
+	return huffEncodeHistogram (src, len, histogram);
+}
+
+CompressionEstimate huffEstimate (const void *source, size_t len)
+{
+	const uint8_t *src = (const uint8_t *)source;
+
+	// fill in histogram
+	size_t histogram[256] = {};
+	for (size_t i = 0; i < len; ++i)
+		++histogram[src[i]];
+
+	// build Huffman tree
+	Tree tree;
+	tree.build (histogram);
+
+	// size of the bitstream in bits
+	size_t bits = 0;
+	for (unsigned val = 0; val < 256; ++val)
+		bits += histogram[val] * tree.getCodeLen (val);
+
+	size_t size = (len >= 0x1000000 ? 8 : 4) + tree.encode ().size () + (bits + 31) / 32 * 4;
+	return {"huff", (size + 3) & ~static_cast<size_t> (0x3), true};
+}
+
 void huffDecode (const void *src, void *dst, size_t size)
 {
-	const size_t bits   = 8;
 	const uint8_t *in   = (const uint8_t *)src;
 	uint8_t *out        = (uint8_t *)dst;
 	uint32_t treeSize   = ((*in) + 1) * 2; // size of the huffman header
 	uint32_t word       = 0;               // 32-bits of input bitstream
-	uint32_t mask       = 0;               // which bit we are reading
-	uint8_t dataMask    = (1 << bits) - 1; // mask to apply to data
+	unsigned avail      = 0;               // unread bits in word
 	const uint8_t *tree = in;              // huffman tree
-	size_t node;                           // node in the huffman tree
-	size_t child;                          // child of a node
-	uint32_t offset;                       // offset from node to child
 
-	// point to the root of the huffman tree
-	node = 1;
+	// decode the first bits of each code with a table
+	Lookup lookup[1 << LOOKUP_BITS];
+	buildLookup (tree, lookup);
 
 	// move input pointer to beginning of bitstream
 	in += treeSize;
 
 	while (size > 0)
 	{
-		if (mask == 0) // we exhausted 32 bits
+		// point to the root of the huffman tree
+		unsigned node = 1;
+
+		if (avail >= LOOKUP_BITS)
 		{
-			// reset the mask
-			mask = 0x80000000;
+			const Lookup &entry =
+			    lookup[(word >> (avail - LOOKUP_BITS)) & ((1 << LOOKUP_BITS) - 1)];
 
-			// read the next 32 bits
-			word = (in[0] << 0) | (in[1] << 8) | (in[2] << 16) | (in[3] << 24);
-			in += 4;
-		}
+			avail -= entry.bits;
 
-		// read the current node's offset value
-		offset = tree[node] & 0x3F;
+			if (entry.node == 0)
+			{
+				*out++ = entry.val;
+				--size;
+				continue;
+			}
 
-		child = (node & ~1) + offset * 2 + 2;
+			// long code; finish it one bit at a time
+			node = entry.node;
+		}
 
-		if (word & mask) // we read a 1
+		while (true)
 		{
-			// point to the "right" child
-			++child;
-
-			if (tree[node] & 0x40) // "right" child is a data node
+			if (avail == 0) // we exhausted 32 bits
 			{
-				// copy the child node into the output buffer and apply mask
-				*out++ = tree[child] & dataMask;
-				size--;
-
-				// start over at the root node
-				node = 1;
+				// read the next 32 bits
+				word  = (in[0] << 0) | (in[1] << 8) | (in[2] << 16) | (in[3] << 24);
+				avail = 32;
+				in += 4;
 			}
-			else // traverse to the "right" child
-				node = child;
-		}
-		else // we read a 0
-		{
-			// pointed to the "left" child
 
-			if (tree[node] & 0x80) // "left" child is a data node
-			{
-				// copy the child node into the output buffer and apply mask
-				*out++ = tree[child] & dataMask;
-				size--;
+			// read bits from bit 31 to bit 0
+			const unsigned bit   = (word >> --avail) & 1;
+			const unsigned child = (node & ~1) + (tree[node] & 0x3F) * 2 + 2 + bit;
 
-				// start over at the root node
-				node = 1;
+			if (tree[node] & (0x80 >> bit)) // child is a data node
+			{
+				*out++ = tree[child];
+				--size;
+				break;
 			}
-			else // traverse to the "left" child
-				node = child;
-		}
 
-		// shift to read next bit (read bit 31 to bit 0)
-		mask >>= 1;
+			node = child;
+		}
 	}
 }
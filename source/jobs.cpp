@@ -0,0 +1,396 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file jobs.cpp
+ *  @brief Thread count and GNU make jobserver
+ */
+
+#include "jobs.h"
+
+#if defined(HAVE_POLL_H) && defined(HAVE_UNISTD_H)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_SCHED_GETAFFINITY)
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace
+{
+/** @brief Maximum number of threads; 0 for no maximum */
+size_t maximum = 0;
+
+/** @brief Combine CPU quotas
+ *  @param[in] a Quota; 0 if none
+ *  @param[in] b Quota; 0 if none
+ *  @returns The stricter quota
+ */
+size_t minQuota (size_t a, size_t b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	return std::min (a, b);
+}
+
+/** @brief Convert a CFS quota to a number of CPUs
+ *  @param[in] quota  Run time per period; negative if unlimited
+ *  @param[in] period Period
+ *  @returns Number of CPUs, rounded up; 0 if unlimited
+ */
+size_t quotaCPUs (long quota, long period)
+{
+	if (quota <= 0 || period <= 0)
+		return 0;
+
+	return (quota + period - 1) / period;
+}
+
+/** @brief Get the CPU quota of a cgroup and its ancestors
+ *  @param[in] root Mount point of the hierarchy
+ *  @param[in] path Path of the cgroup within the hierarchy
+ *  @param[in] read Reads the quota of one cgroup directory
+ *  @returns Number of CPUs; 0 if there is no quota
+ *
+ *  @note In a container the path may not exist under the mount point, which
+ *  then is the container's own cgroup, so only the existing directories count.
+ */
+template <typename Read>
+size_t walkCgroup (const std::string &root, std::string path, Read read)
+{
+	size_t quota = 0;
+	while (true)
+	{
+		quota = minQuota (quota, read (root + (path == "/" ? "" : path)));
+		if (path.empty () || path == "/")
+			return quota;
+
+		const size_t slash = path.rfind ('/');
+		if (slash == std::string::npos)
+			return quota;
+
+		path.resize (slash);
+		if (path.empty ())
+			path = "/";
+	}
+}
+
+/** @brief Get the CPU quota of a cgroup v2 directory
+ *  @param[in] dir cgroup directory
+ *  @returns Number of CPUs; 0 if there is no quota
+ */
+size_t cgroup2Quota (const std::string &dir)
+{
+	FILE *fp = std::fopen ((dir + "/cpu.max").c_str (), "r");
+	if (!fp)
+		return 0;
+
+	// "$MAX $PERIOD", where $MAX may be "max"
+	char max[32];
+	long period = 0;
+	const int rc = std::fscanf (fp, "%31s %ld", max, &period);
+	std::fclose (fp);
+
+	if (rc != 2 || std::strcmp (max, "max") == 0)
+		return 0;
+
+	return quotaCPUs (std::strtol (max, nullptr, 10), period);
+}
+
+/** @brief Read a number from a file
+ *  @param[in]  path  File path
+ *  @param[out] value Number
+ *  @returns Whether a number was read
+ */
+bool readNumber (const std::string &path, long &value)
+{
+	FILE *fp = std::fopen (path.c_str (), "r");
+	if (!fp)
+		return false;
+
+	const int rc = std::fscanf (fp, "%ld", &value);
+	std::fclose (fp);
+
+	return rc == 1;
+}
+
+/** @brief Get the CPU quota of a cgroup v1 cpu controller directory
+ *  @param[in] dir cgroup directory
+ *  @returns Number of CPUs; 0 if there is no quota
+ */
+size_t cgroup1Quota (const std::string &dir)
+{
+	long quota;
+	long period;
+	if (!readNumber (dir + "/cpu.cfs_quota_us", quota) ||
+	    !readNumber (dir + "/cpu.cfs_period_us", period))
+		return 0;
+
+	return quotaCPUs (quota, period);
+}
+
+/** @brief Get number of CPUs available to the process
+ *  @returns Number of CPUs
+ */
+size_t detectConcurrency ()
+{
+	size_t cpus = std::thread::hardware_concurrency ();
+
+#if defined(HAVE_SCHED_GETAFFINITY)
+	cpu_set_t set;
+	if (::sched_getaffinity (0, sizeof (set), &set) == 0)
+		cpus = CPU_COUNT (&set);
+#endif
+
+	const size_t quota = jobs::cgroupQuota ();
+	if (quota)
+		cpus = std::min (cpus, quota);
+
+	return std::max<size_t> (cpus, 1);
+}
+
+/** @brief GNU make jobserver client */
+class Jobserver
+{
+public:
+	/** @brief Connect to the jobserver named in MAKEFLAGS, if any */
+	Jobserver ()
+	{
+#if defined(HAVE_POLL_H) && defined(HAVE_UNISTD_H)
+		const char *flags = std::getenv ("MAKEFLAGS");
+		if (!flags)
+			return;
+
+		// the last option wins; make < 4.2 calls it --jobserver-fds
+		std::string auth;
+		for (const char *option : {"--jobserver-auth=", "--jobserver-fds="})
+		{
+			const char *p = flags;
+			while ((p = std::strstr (p, option)))
+			{
+				p += std::strlen (option);
+				auth = std::string (p, std::strcspn (p, " "));
+			}
+
+			if (!auth.empty ())
+				break;
+		}
+
+		if (auth.compare (0, 5, "fifo:") == 0)
+		{
+			// make >= 4.4 named pipe; open it for ourselves
+			readFd = ::open (auth.c_str () + 5, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+			if (readFd < 0)
+				return;
+
+			writeFd = ::open (auth.c_str () + 5, O_WRONLY | O_CLOEXEC);
+			if (writeFd < 0)
+			{
+				::close (readFd);
+				readFd = -1;
+				return;
+			}
+
+			present = true;
+			return;
+		}
+
+		int r;
+		int w;
+		if (std::sscanf (auth.c_str (), "%d,%d", &r, &w) != 2 || r < 0 || w < 0)
+			return;
+
+		// make doesn't pass the pipe to commands it doesn't think are recursive makes
+		if (!isFifo (r) || !isFifo (w))
+			return;
+
+		present = true;
+
+		// the pipe is shared with make, so it can't be made non-blocking; open
+		// a separate file description for it. Without one, a blocking read could
+		// wait for a token forever while this process holds others, so only the
+		// implicit slot is used.
+		char path[64];
+		std::snprintf (path, sizeof (path), "/proc/self/fd/%d", r);
+		readFd = ::open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (readFd >= 0)
+			writeFd = w;
+#endif
+	}
+
+	/** @brief Whether there is a jobserver */
+	bool valid () const
+	{
+		return present;
+	}
+
+	/** @brief Take a token without waiting
+	 *  @param[out] token Token
+	 *  @returns Whether a token was taken
+	 */
+	bool tryAcquire (char &token)
+	{
+#if defined(HAVE_POLL_H) && defined(HAVE_UNISTD_H)
+		if (readFd < 0)
+			return false;
+
+		// readFd is non-blocking, so this fails with EAGAIN when there is no token
+		ssize_t rc;
+		do
+		{
+			rc = ::read (readFd, &token, 1);
+		} while (rc < 0 && errno == EINTR);
+
+		return rc == 1;
+#else
+		(void)token;
+		return false;
+#endif
+	}
+
+	/** @brief Return a token
+	 *  @param[in] token Token
+	 */
+	void release (char token)
+	{
+#if defined(HAVE_POLL_H) && defined(HAVE_UNISTD_H)
+		while (::write (writeFd, &token, 1) < 0 && errno == EINTR)
+			;
+#else
+		(void)token;
+#endif
+	}
+
+private:
+#if defined(HAVE_POLL_H) && defined(HAVE_UNISTD_H)
+	/** @brief Check whether a file descriptor is an open pipe
+	 *  @param[in] fd File descriptor
+	 */
+	static bool isFifo (int fd)
+	{
+		struct stat st;
+		return ::fstat (fd, &st) == 0 && S_ISFIFO (st.st_mode);
+	}
+#endif
+
+	int readFd   = -1;    ///< Non-blocking read end; -1 if tokens can't be taken
+	int writeFd  = -1;    ///< Write end
+	bool present = false; ///< Whether make runs a jobserver for this process
+};
+
+/** @brief Get the jobserver
+ *  @note Never destroyed, so tokens can be returned during static destruction
+ */
+Jobserver &jobserver ()
+{
+	static Jobserver *instance = new Jobserver ();
+	return *instance;
+}
+}
+
+namespace jobs
+{
+void setMaximum (size_t jobs)
+{
+	maximum = jobs;
+}
+
+size_t cgroupQuota ()
+{
+	FILE *fp = std::fopen ("/proc/self/cgroup", "r");
+	if (!fp)
+		return 0;
+
+	size_t quota = 0;
+
+	char line[4096];
+	while (std::fgets (line, sizeof (line), fp))
+	{
+		// "$ID:$CONTROLLERS:$PATH"; cgroup v2 has no controllers
+		std::string entry (line, std::strcspn (line, "\n"));
+
+		const size_t first  = entry.find (':');
+		const size_t second = entry.find (':', first + 1);
+		if (first == std::string::npos || second == std::string::npos)
+			continue;
+
+		const std::string controllers = "," + entry.substr (first + 1, second - first - 1) + ",";
+		const std::string path        = entry.substr (second + 1);
+
+		if (controllers == ",,")
+			quota = minQuota (quota, walkCgroup ("/sys/fs/cgroup", path, cgroup2Quota));
+		else if (controllers.find (",cpu,") != std::string::npos)
+			quota = minQuota (quota, walkCgroup ("/sys/fs/cgroup/cpu", path, cgroup1Quota));
+	}
+
+	std::fclose (fp);
+
+	return quota;
+}
+
+void init ()
+{
+	jobserver ();
+}
+
+size_t concurrency ()
+{
+	static const size_t detected = detectConcurrency ();
+
+	if (maximum)
+		return std::min (maximum, detected);
+
+	return detected;
+}
+
+Slots::Slots (size_t count) : count (1)
+{
+	Jobserver &server = jobserver ();
+	if (!server.valid ())
+	{
+		this->count = std::max<size_t> (count, 1);
+		return;
+	}
+
+	// the process already owns one slot
+	char token;
+	while (this->count < count && server.tryAcquire (token))
+	{
+		tokens.emplace_back (token);
+		++this->count;
+	}
+}
+
+Slots::~Slots ()
+{
+	for (const auto &token : tokens)
+		jobserver ().release (token);
+}
+}
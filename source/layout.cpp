@@ -0,0 +1,197 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file layout.cpp
+ *  @brief Incremental build state
+ */
+
+#include "layout.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+/** @brief Sidecar file signature */
+const char *const SIGNATURE = "tex3ds-layout 2";
+}
+
+uint64_t fnv1a (const void *data, size_t size, uint64_t hash)
+{
+	const uint8_t *p = static_cast<const uint8_t *> (data);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t murmur64 (const void *data, size_t size, uint64_t seed)
+{
+	const uint64_t m = 0xC6A4A7935BD1E995ULL;
+	const int r      = 47;
+
+	const uint8_t *p = static_cast<const uint8_t *> (data);
+	uint64_t hash    = seed ^ (size * m);
+
+	for (const uint8_t *end = p + (size & ~size_t (7)); p != end; p += 8)
+	{
+		uint64_t k;
+		std::memcpy (&k, p, sizeof (k));
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		hash ^= k;
+		hash *= m;
+	}
+
+	if (size & 7)
+	{
+		uint64_t k = 0;
+		for (size_t i = size & 7; i > 0; --i)
+			k = k << 8 | p[i - 1];
+
+		hash ^= k;
+		hash *= m;
+	}
+
+	hash ^= hash >> r;
+	hash *= m;
+	hash ^= hash >> r;
+
+	return hash;
+}
+
+TileDigest TileDigest::of (const void *data, size_t size)
+{
+	TileDigest digest;
+	digest.fnv    = fnv1a (data, size);
+	digest.murmur = murmur64 (data, size);
+	return digest;
+}
+
+bool Layout::read (const std::string &path)
+{
+	std::ifstream file (path);
+	if (!file)
+		return false;
+
+	std::string line;
+	if (!std::getline (file, line) || line != SIGNATURE)
+		return false;
+
+	*this = Layout ();
+
+	size_t numTiles = 0;
+	while (std::getline (file, line))
+	{
+		std::istringstream in (line);
+		std::string key;
+		in >> key;
+
+		if (key == "settings")
+		{
+			in >> std::ws;
+			std::getline (in, settings);
+		}
+		else if (key == "encoding")
+		{
+			in >> std::ws;
+			std::getline (in, encoding);
+		}
+		else if (key == "atlas")
+			in >> atlas.width >> atlas.height;
+		else if (key == "sprite")
+		{
+			AtlasLayout::Sprite sprite;
+			in >> sprite.x >> sprite.y >> sprite.w >> sprite.h >> sprite.rotated >> std::ws;
+			std::getline (in, sprite.name);
+			atlas.sprites.emplace_back (std::move (sprite));
+		}
+		else if (key == "data")
+			in >> dataOffset >> dataSize >> std::hex >> dataHash;
+		else if (key == "tiles")
+		{
+			in >> numTiles;
+			tiles.reserve (numTiles);
+			for (size_t i = 0; i < numTiles && std::getline (file, line); ++i)
+			{
+				TileDigest tile;
+				std::istringstream digest (line);
+				if (!(digest >> std::hex >> tile.fnv >> tile.murmur))
+					return false;
+
+				tiles.emplace_back (tile);
+			}
+		}
+		else
+			return false;
+
+		if (in.fail ())
+			return false;
+	}
+
+	return tiles.size () == numTiles;
+}
+
+void Layout::write (const std::string &path) const
+{
+	FILE *fp = std::fopen (path.c_str (), "w");
+	if (!fp)
+		throw std::runtime_error ("Failed to open output layout file");
+
+	std::fprintf (fp, "%s\n", SIGNATURE);
+	std::fprintf (fp, "settings %s\n", settings.c_str ());
+	std::fprintf (fp, "encoding %s\n", encoding.c_str ());
+
+	if (!atlas.sprites.empty ())
+	{
+		std::fprintf (fp, "atlas %zu %zu\n", atlas.width, atlas.height);
+		for (const auto &sprite : atlas.sprites)
+		{
+			std::fprintf (fp,
+			    "sprite %zu %zu %zu %zu %d %s\n",
+			    sprite.x,
+			    sprite.y,
+			    sprite.w,
+			    sprite.h,
+			    sprite.rotated,
+			    sprite.name.c_str ());
+		}
+	}
+
+	if (dataSize)
+		std::fprintf (fp, "data %zu %zu %" PRIx64 "\n", dataOffset, dataSize, dataHash);
+
+	std::fprintf (fp, "tiles %zu\n", tiles.size ());
+	for (const auto &tile : tiles)
+		std::fprintf (fp, "%016" PRIx64 " %016" PRIx64 "\n", tile.fnv, tile.murmur);
+
+	if (std::fclose (fp) != 0)
+		throw std::runtime_error ("Failed to write layout file");
+}
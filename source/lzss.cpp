@@ -22,8 +22,15 @@
  */
 
 #include "compress.h"
+#include "future.h"
+#include "jobs.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 /** @brief LZSS/LZ10 maximum match length */
@@ -38,6 +45,15 @@
 /** @brief LZ11 maximum displacement */
 #define LZ11_MAX_DISP 4096
 
+/** @brief Parallel LZ compression segment size */
+#define LZ_SEGMENT_SIZE 0x10000
+
+/** @brief Number of samples parsed to estimate LZ compressed size */
+#define LZ_SAMPLE_COUNT 32
+
+/** @brief Size of each sample parsed to estimate LZ compressed size */
+#define LZ_SAMPLE_SIZE 0x1000
+
 namespace
 {
 /** @brief LZ compression mode */
@@ -59,6 +75,50 @@ const uint8_t *rfind (const uint8_t *first, const uint8_t *last, const uint8_t &
 	return nullptr;
 }
 
+/** @brief Copy a back-reference
+ *  @param[in] dst  Output position
+ *  @param[in] disp Displacement minus one
+ *  @param[in] len  Length
+ *  @returns New output position
+ */
+inline uint8_t *copyMatch (uint8_t *dst, size_t disp, size_t len)
+{
+	const size_t distance = disp + 1;
+
+	if (len <= 8)
+	{
+		// too short to be worth a call
+		for (const uint8_t *p = dst - distance; len > 0; --len)
+			*dst++ = *p++;
+		return dst;
+	}
+
+	if (distance >= len)
+	{
+		// source and destination don't overlap
+		std::memcpy (dst, dst - distance, len);
+		return dst + len;
+	}
+
+	if (distance == 1)
+	{
+		// run of a single byte
+		std::memset (dst, dst[-1], len);
+		return dst + len;
+	}
+
+	// repeating pattern; each chunk is a copy of the one before it
+	while (len > 0)
+	{
+		const size_t chunk = std::min (len, distance);
+		std::memcpy (dst, dst - distance, chunk);
+		dst += chunk;
+		len -= chunk;
+	}
+
+	return dst;
+}
+
 /** @brief Find best buffer match
  *  @param[in]  start     Input buffer
  *  @param[in]  buffer    Encoding buffer
@@ -126,14 +186,64 @@ const uint8_t *find_best_match (const uint8_t *start,
 	return nullptr;
 }
 
-/** @brief LZSS/LZ10/LZ11 compression
+/** @brief Parsed LZSS/LZ10/LZ11 tokens */
+struct Tokens
+{
+	std::vector<uint8_t> data; ///< Encoded tokens, without code bytes
+	std::vector<bool> flags;   ///< Whether each token is compressed
+};
+
+/** @brief Get the size of an encoded compressed token
+ *  @param[in] token First byte of the token
+ *  @param[in] mode  LZ mode
+ *  @returns Token size
+ */
+inline size_t tokenSize (uint8_t token, LZSS_t mode)
+{
+	if (mode == LZ10)
+		return 2;
+
+	switch (token >> 4)
+	{
+	case 0:
+		return 3;
+
+	case 1:
+		return 4;
+
+	default:
+		return 2;
+	}
+}
+
+/** @brief Get the lookahead needed to parse a token
+ *  @param[in] mode LZ mode
+ *  @returns Number of bytes which must follow a token's start for it to be
+ *           parsed the same as with all of the source available
+ */
+inline size_t lzssLookahead (LZSS_t mode)
+{
+	// a match is compared with the best match following it
+	return 2 * (mode == LZ10 ? LZ10_MAX_LEN : LZ11_MAX_LEN) + 1;
+}
+
+/** @brief Parse LZSS/LZ10/LZ11 tokens
+ *  @param[in]  start  Start of match history
  *  @param[in]  buffer Source buffer
- *  @param[in]  len    Source length
- *  @param[out] outlen Output length
+ *  @param[in]  stop   Parse tokens starting before this point
+ *  @param[in]  end    End of source
  *  @param[in]  mode   LZ mode
- *  @returns Compressed buffer
+ *  @param[out] tokens Parsed tokens
+ *  @returns Start of the next token
+ *
+ *  @note Matches may refer back to start but never extend past end.
  */
-std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t mode)
+const uint8_t *lzssParse (const uint8_t *start,
+    const uint8_t *buffer,
+    const uint8_t *stop,
+    const uint8_t *end,
+    LZSS_t mode,
+    Tokens &tokens)
 {
 	// get maximum match length
 	const size_t max_len = mode == LZ10 ? LZ10_MAX_LEN : LZ11_MAX_LEN;
@@ -143,31 +253,15 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 
 	assert (mode == LZ10 || mode == LZ11);
 
-	// create output buffer
-	std::vector<uint8_t> result;
-
-	// append compression header
-	if (mode == LZ10)
-		compressionHeader (result, 0x10, len);
-	else
-		compressionHeader (result, 0x11, len);
+	assert (stop <= end);
 
-	// reserve an encode byte in output buffer
-	size_t code_pos = result.size ();
-	result.push_back (0);
-
-	// initialize shift
-	size_t shift = 7;
+	std::vector<uint8_t> &result = tokens.data;
+	result.reserve (result.size () + (stop - buffer));
 
 	// encode every byte
-	const uint8_t *start = buffer;
-#ifndef NDEBUG
-	const uint8_t *end = buffer + len;
-#endif
-	while (len > 0)
+	while (buffer < stop)
 	{
-		assert (buffer < end);
-		assert (buffer + len == end);
+		const size_t len = end - buffer;
 
 		const uint8_t *tmp;
 		size_t tmplen;
@@ -224,6 +318,7 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 		if (tmplen < 3)
 		{
 			// this is a copy chunk; append this byte to the output buffer
+			tokens.flags.push_back (false);
 			result.push_back (*buffer);
 
 			// only one byte is copied
@@ -232,8 +327,7 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 		else if (mode == LZ10)
 		{
 			// mark this chunk as compressed
-			assert (code_pos < result.size ());
-			result[code_pos] |= (1 << shift);
+			tokens.flags.push_back (true);
 
 			// encode the displacement and length
 			size_t disp = buffer - tmp - 1;
@@ -245,8 +339,7 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 		else if (tmplen <= 0x10)
 		{
 			// mark this chunk as compressed
-			assert (code_pos < result.size ());
-			result[code_pos] |= (1 << shift);
+			tokens.flags.push_back (true);
 
 			// encode the displacement and length
 			size_t disp = buffer - tmp - 1;
@@ -259,8 +352,7 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 		else if (tmplen <= 0x110)
 		{
 			// mark this chunk as compressed
-			assert (code_pos < result.size ());
-			result[code_pos] |= (1 << shift);
+			tokens.flags.push_back (true);
 
 			// encode the displacement and length
 			size_t disp = buffer - tmp - 1;
@@ -274,8 +366,7 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 		else
 		{
 			// mark this chunk as compressed
-			assert (code_pos < result.size ());
-			result[code_pos] |= (1 << shift);
+			tokens.flags.push_back (true);
 
 			// encode the displacement and length
 			size_t disp = buffer - tmp - 1;
@@ -290,28 +381,308 @@ std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t
 
 		// advance input buffer
 		buffer += tmplen;
-		len -= tmplen;
+	}
 
-		if (shift == 0 && len != 0)
+	return buffer;
+}
+
+/** @brief LZSS/LZ10/LZ11 token writer */
+class TokenWriter
+{
+public:
+	/** @brief Parameterized constructor
+	 *  @param[in] result Output buffer
+	 *  @param[in] mode   LZ mode
+	 */
+	TokenWriter (std::vector<uint8_t> &result, LZSS_t mode) : result (result), mode (mode)
+	{
+	}
+
+	/** @brief Append parsed tokens
+	 *  @param[in] tokens Tokens
+	 */
+	void write (const Tokens &tokens)
+	{
+		const uint8_t *data = tokens.data.data ();
+
+		for (bool compressed : tokens.flags)
 		{
-			// we need to encode more data, so add a new code byte
-			shift    = 8;
-			code_pos = result.size ();
-			result.push_back (0);
+			// every eight tokens are preceded by a code byte
+			if (count % 8 == 0)
+			{
+				code_pos = result.size ();
+				result.push_back (0);
+			}
+
+			size_t tokenLen = 1;
+			if (compressed)
+			{
+				// mark this chunk as compressed
+				result[code_pos] |= 0x80 >> (count % 8);
+				tokenLen = tokenSize (*data, mode);
+			}
+
+			result.insert (std::end (result), data, data + tokenLen);
+			data += tokenLen;
+			++count;
 		}
 
-		// advance code byte bit position
-		if (shift != 0)
-			--shift;
+		assert (data == tokens.data.data () + tokens.data.size ());
 	}
 
-	// pad the output buffer to 4 bytes
-	if (result.size () & 0x3)
-		result.resize ((result.size () + 3) & ~0x3);
+	/** @brief Finish the stream */
+	void finish ()
+	{
+		// the stream always has at least one code byte
+		if (count == 0)
+			result.push_back (0);
+
+		// pad the output buffer to 4 bytes
+		if (result.size () & 0x3)
+			result.resize ((result.size () + 3) & ~0x3);
+	}
+
+private:
+	std::vector<uint8_t> &result; ///< Output buffer
+	LZSS_t mode;                  ///< LZ mode
+	size_t code_pos = 0;          ///< Position of the current code byte
+	size_t count    = 0;          ///< Number of tokens written
+};
+
+/** @brief Pack parsed tokens into a compressed stream
+ *  @param[in] segments Tokens of consecutive parts of the source
+ *  @param[in] len      Source length
+ *  @param[in] mode     LZ mode
+ *  @returns Compressed buffer
+ */
+std::vector<uint8_t> lzssPack (const std::vector<Tokens> &segments, size_t len, LZSS_t mode)
+{
+	size_t size = 0;
+	for (const auto &tokens : segments)
+		size += tokens.data.size () + (tokens.flags.size () + 7) / 8;
+
+	// create output buffer
+	std::vector<uint8_t> result;
+	result.reserve (size + 8 + segments.size () + 4);
+
+	// append compression header
+	if (mode == LZ10)
+		compressionHeader (result, 0x10, len);
+	else
+		compressionHeader (result, 0x11, len);
+
+	TokenWriter writer (result, mode);
+	for (const auto &tokens : segments)
+		writer.write (tokens);
+
+	writer.finish ();
 
 	// return the output data
 	return result;
 }
+
+/** @brief LZSS/LZ10/LZ11 compression
+ *  @param[in]  buffer Source buffer
+ *  @param[in]  len    Source length
+ *  @param[in]  mode   LZ mode
+ *  @returns Compressed buffer
+ */
+std::vector<uint8_t> lzssCommonEncode (const uint8_t *buffer, size_t len, LZSS_t mode)
+{
+	std::vector<Tokens> segments (1);
+	lzssParse (buffer, buffer, buffer + len, buffer + len, mode, segments[0]);
+
+	return lzssPack (segments, len, mode);
+}
+
+/** @brief Parallel LZSS/LZ10/LZ11 compression
+ *  @param[in]  buffer Source buffer
+ *  @param[in]  len    Source length
+ *  @param[in]  mode   LZ mode
+ *  @returns Compressed buffer
+ *
+ *  @details
+ *  The source is split into fixed-size segments which are parsed
+ *  concurrently, each using the preceding bytes within the maximum
+ *  displacement as its match history. Matches never cross a segment
+ *  boundary, so the segments' tokens can be concatenated into one stream.
+ *  The output only depends on the source, not on the number of threads.
+ */
+std::vector<uint8_t> lzssParallelEncode (const uint8_t *buffer, size_t len, LZSS_t mode)
+{
+	const size_t max_disp = mode == LZ10 ? LZ10_MAX_DISP : LZ11_MAX_DISP;
+
+	const size_t count = std::max<size_t> (1, (len + LZ_SEGMENT_SIZE - 1) / LZ_SEGMENT_SIZE);
+	std::vector<Tokens> segments (count);
+
+	std::atomic<size_t> next (0);
+	std::exception_ptr error;
+	std::mutex mutex;
+
+	auto parse = [&]() {
+		for (size_t i; (i = next++) < count;)
+		{
+			const size_t begin   = i * LZ_SEGMENT_SIZE;
+			const size_t end     = std::min<size_t> (begin + LZ_SEGMENT_SIZE, len);
+			const size_t history = begin > max_disp ? begin - max_disp : 0;
+
+			try
+			{
+				lzssParse (buffer + history,
+				    buffer + begin,
+				    buffer + end,
+				    buffer + end,
+				    mode,
+				    segments[i]);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock (mutex);
+				if (!error)
+					error = std::current_exception ();
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	const jobs::Slots slots (std::min (count, jobs::concurrency ()));
+	const size_t numThreads = slots.size ();
+	for (size_t i = 1; i < numThreads; ++i)
+		threads.emplace_back (parse);
+
+	parse ();
+
+	for (auto &thread : threads)
+		thread.join ();
+
+	if (error)
+		std::rethrow_exception (error);
+
+	return lzssPack (segments, len, mode);
+}
+
+/** @brief Estimate LZSS/LZ10/LZ11 compressed size
+ *  @param[in] buffer Source buffer
+ *  @param[in] len    Source length
+ *  @param[in] mode   LZ mode
+ *  @returns Estimate
+ *
+ *  @details
+ *  Each sample is parsed with its preceding match history and enough
+ *  lookahead that its tokens are the ones the full parse would produce, so
+ *  the only error comes from how representative the samples are.
+ */
+CompressionEstimate lzssEstimateCommon (const uint8_t *buffer, size_t len, LZSS_t mode)
+{
+	const size_t max_disp = mode == LZ10 ? LZ10_MAX_DISP : LZ11_MAX_DISP;
+	const size_t header   = len >= 0x1000000 ? 8 : 4;
+	const char *name      = mode == LZ10 ? "lzss" : "lz11";
+
+	Tokens tokens;
+	if (len <= LZ_SAMPLE_COUNT * LZ_SAMPLE_SIZE)
+	{
+		// small enough to parse whole
+		lzssParse (buffer, buffer, buffer + len, buffer + len, mode, tokens);
+
+		const size_t codes = std::max<size_t> (1, (tokens.flags.size () + 7) / 8);
+		const size_t size  = header + tokens.data.size () + codes;
+		return {name, (size + 3) & ~static_cast<size_t> (0x3), true};
+	}
+
+	// parse a sample from the middle of each stride
+	const size_t stride = len / LZ_SAMPLE_COUNT;
+	size_t sampled      = 0;
+	for (size_t i = 0; i < LZ_SAMPLE_COUNT; ++i)
+	{
+		const size_t begin   = i * stride + (stride - LZ_SAMPLE_SIZE) / 2;
+		const size_t stop    = begin + LZ_SAMPLE_SIZE;
+		const size_t end     = std::min (len, stop + lzssLookahead (mode));
+		const size_t history = begin > max_disp ? begin - max_disp : 0;
+
+		const uint8_t *next = lzssParse (
+		    buffer + history, buffer + begin, buffer + stop, buffer + end, mode, tokens);
+		sampled += next - (buffer + begin);
+	}
+
+	// each token has a code bit
+	const double bytes = tokens.data.size () + tokens.flags.size () / 8.0;
+	const size_t size  = header + static_cast<size_t> (bytes * len / sampled + 0.5);
+	return {name, (size + 3) & ~static_cast<size_t> (0x3), false};
+}
+
+/** @brief Streaming LZSS/LZ10/LZ11 compressor
+ *
+ *  @details
+ *  Pushed data is kept in a window along with the match history. Tokens are
+ *  parsed once enough data follows them that the parse can't change, and are
+ *  written out immediately.
+ */
+class LZCompressor : public Compressor
+{
+public:
+	/** @brief Parameterized constructor
+	 *  @param[in] mode LZ mode
+	 */
+	explicit LZCompressor (LZSS_t mode)
+	    : result (COMPRESSION_HEADER_MAX), writer (result, mode), mode (mode)
+	{
+	}
+
+	void push (const void *src, size_t len) override
+	{
+		const uint8_t *source = static_cast<const uint8_t *> (src);
+		window.insert (std::end (window), source, source + len);
+		total += len;
+
+		if (window.size () - pos > lzssLookahead (mode))
+			parse (window.data () + window.size () - lzssLookahead (mode));
+	}
+
+	std::vector<uint8_t> finish () override
+	{
+		parse (window.data () + window.size ());
+		writer.finish ();
+
+		finishCompressionHeader (result, mode == LZ10 ? 0x10 : 0x11, total);
+		return std::move (result);
+	}
+
+private:
+	/** @brief Parse and write tokens
+	 *  @param[in] stop Parse tokens starting before this point
+	 */
+	void parse (const uint8_t *stop)
+	{
+		const size_t max_disp = mode == LZ10 ? LZ10_MAX_DISP : LZ11_MAX_DISP;
+
+		Tokens tokens;
+		const uint8_t *next = lzssParse (window.data (),
+		    window.data () + pos,
+		    stop,
+		    window.data () + window.size (),
+		    mode,
+		    tokens);
+
+		pos = next - window.data ();
+		writer.write (tokens);
+
+		// drop history beyond the maximum displacement once that frees at
+		// least half of the window, so each byte is moved a bounded number
+		// of times
+		if (pos > max_disp && pos - max_disp >= window.size () / 2)
+		{
+			window.erase (std::begin (window), std::begin (window) + (pos - max_disp));
+			pos = max_disp;
+		}
+	}
+
+	std::vector<uint8_t> window; ///< Match history and unparsed data
+	std::vector<uint8_t> result; ///< Output buffer
+	TokenWriter writer;          ///< Token writer
+	LZSS_t mode;                 ///< LZ mode
+	size_t pos   = 0;            ///< Window position of the next token
+	size_t total = 0;            ///< Total length of pushed data
+};
 }
 
 std::vector<uint8_t> lzssEncode (const void *src, size_t len)
@@ -324,53 +695,87 @@ std::vector<uint8_t> lz11Encode (const void *src, size_t len)
 	return lzssCommonEncode (reinterpret_cast<const uint8_t *> (src), len, LZ11);
 }
 
+std::vector<uint8_t> lzssEncodeParallel (const void *src, size_t len)
+{
+	return lzssParallelEncode (reinterpret_cast<const uint8_t *> (src), len, LZ10);
+}
+
+std::vector<uint8_t> lz11EncodeParallel (const void *src, size_t len)
+{
+	return lzssParallelEncode (reinterpret_cast<const uint8_t *> (src), len, LZ11);
+}
+
+CompressionEstimate lzssEstimate (const void *src, size_t len)
+{
+	return lzssEstimateCommon (reinterpret_cast<const uint8_t *> (src), len, LZ10);
+}
+
+CompressionEstimate lz11Estimate (const void *src, size_t len)
+{
+	return lzssEstimateCommon (reinterpret_cast<const uint8_t *> (src), len, LZ11);
+}
+
+std::unique_ptr<Compressor> lzssCompressor ()
+{
+	return future::make_unique<LZCompressor> (LZ10);
+}
+
+std::unique_ptr<Compressor> lz11Compressor ()
+{
+	return future::make_unique<LZCompressor> (LZ11);
+}
+
 void lzssDecode (const void *source, void *dest, size_t size)
 {
 	const uint8_t *src = (const uint8_t *)source;
 	uint8_t *dst       = (uint8_t *)dest;
-	uint8_t flags      = 0;
-	uint8_t mask       = 0;
-	unsigned len;
-	unsigned disp;
+	size_t len;
+	size_t disp;
 
 	while (size > 0)
 	{
-		if (mask == 0)
+		// read in the flags data
+		// from bit 7 to bit 0:
+		//     0: raw byte
+		//     1: compressed block
+		uint8_t flags = *src++;
+
+		if (flags == 0 && size >= 8)
 		{
-			// read in the flags data
-			// from bit 7 to bit 0:
-			//     0: raw byte
-			//     1: compressed block
-			flags = *src++;
-			mask  = 0x80;
+			// eight raw bytes
+			std::memcpy (dst, src, 8);
+			dst += 8;
+			src += 8;
+			size -= 8;
+			continue;
 		}
 
-		if (flags & mask) // compressed block
+		for (unsigned i = 0; i < 8 && size > 0; ++i, flags <<= 1)
 		{
-			// disp: displacement
-			// len:  length
-			len  = (((*src) & 0xF0) >> 4) + 3;
-			disp = ((*src++) & 0x0F);
-			disp = disp << 8 | (*src++);
+			if (flags & 0x80) // compressed block
+			{
+				// disp: displacement
+				// len:  length
+				len  = (((*src) & 0xF0) >> 4) + 3;
+				disp = ((*src++) & 0x0F);
+				disp = disp << 8 | (*src++);
 
-			if (len > size)
-				len = size;
+				if (len > size)
+					len = size;
 
-			size -= len;
+				size -= len;
 
-			// for len, copy data from the displacement
-			// to the current buffer position
-			for (uint8_t *p = dst - disp - 1; len > 0; --len)
-				*dst++ = *p++;
-		}
-		else
-		{ // uncompressed block
-			// copy a raw byte from the input to the output
-			*dst++ = *src++;
-			size--;
+				// for len, copy data from the displacement
+				// to the current buffer position
+				dst = copyMatch (dst, disp, len);
+			}
+			else
+			{ // uncompressed block
+				// copy a raw byte from the input to the output
+				*dst++ = *src++;
+				size--;
+			}
 		}
-
-		mask >>= 1;
 	}
 }
 
@@ -388,6 +793,17 @@ void lz11Decode (const void *source, void *dest, size_t size)
 		//     0: raw byte
 		//     1: compressed block
 		flags = *src++;
+
+		if (flags == 0 && size >= 8)
+		{
+			// eight raw bytes
+			std::memcpy (dst, src, 8);
+			dst += 8;
+			src += 8;
+			size -= 8;
+			continue;
+		}
+
 		for (i = 0; i < 8 && size > 0; i++, flags <<= 1)
 		{
 			if (flags & 0x80) // compressed block
@@ -422,8 +838,7 @@ void lz11Decode (const void *source, void *dest, size_t size)
 
 				// for len, copy data from the displacement
 				// to the current buffer position
-				for (uint8_t *p = dst - disp - 1; len > 0; --len)
-					*dst++ = *p++;
+				dst = copyMatch (dst, disp, len);
 			}
 
 			else
@@ -24,11 +24,14 @@
 #include "bcfnt.h"
 #include "freetype.h"
 #include "future.h"
+#include "jobs.h"
+#include "stats.h"
 
 #include <getopt.h>
 
 #include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -69,12 +72,15 @@ void printUsage (const char *prog)
 	std::printf (
 	    "  Options:\n"
 	    "    -h, --help                   Show this help message\n"
+	    "    -j, --jobs <jobs>            Maximum number of threads\n"
 	    "    -o, --output <output>        Output file\n"
 	    "    -s, --size <size>            Set font size in points\n"
 	    "    -b, --blacklist <file>       Excludes the whitespace-separated list of codepoints\n"
 	    "    -w, --whitelist <file>       Includes only the whitespace-separated list of "
 	    "codepoints\n"
 	    "    -v, --version                Show version and copyright information\n"
+	    "        --stats                  Print time spent in each stage\n"
+	    "        --trace <file>           Write Chrome trace of each stage\n"
 	    "    <inputN>                     Input file(s). Lower numbers get priority\n\n");
 }
 
@@ -109,13 +115,23 @@ bool parseList (std::vector<std::uint16_t> &out, const char *path)
 	return true;
 }
 
+/** @brief Values of options without a short option */
+enum LongOption
+{
+	OPT_STATS = 256, ///< --stats
+	OPT_TRACE,       ///< --trace
+};
+
 /** @brief Program long options */
 const struct option longOptions[] = {
     /* clang-format off */
 	{ "blacklist", required_argument, nullptr, 'b', },
 	{ "help",      no_argument,       nullptr, 'h', },
+	{ "jobs",      required_argument, nullptr, 'j', },
 	{ "output",    required_argument, nullptr, 'o', },
 	{ "size",      required_argument, nullptr, 's', },
+	{ "stats",     no_argument,       nullptr, OPT_STATS, },
+	{ "trace",     required_argument, nullptr, OPT_TRACE, },
 	{ "version",   no_argument,       nullptr, 'v', },
 	{ "whitelist", required_argument, nullptr, 'w', },
 	{ nullptr,     no_argument,       nullptr,   0, },
@@ -133,6 +149,9 @@ int main (int argc, char *argv[])
 {
 	const char *prog = argv[0];
 
+	// before anything opens a file which could reuse the jobserver's descriptors
+	jobs::init ();
+
 	// set line buffering
 	std::setvbuf (stdout, nullptr, _IOLBF, 0);
 	std::setvbuf (stderr, nullptr, _IOLBF, 0);
@@ -144,7 +163,7 @@ int main (int argc, char *argv[])
 
 	// parse options
 	int c;
-	while ((c = ::getopt_long (argc, argv, "b:ho:s:vw:", longOptions, nullptr)) != -1)
+	while ((c = ::getopt_long (argc, argv, "b:hj:o:s:vw:", longOptions, nullptr)) != -1)
 	{
 		switch (c)
 		{
@@ -153,6 +172,21 @@ int main (int argc, char *argv[])
 			printUsage (prog);
 			return EXIT_SUCCESS;
 
+		case 'j':
+		{
+			// set maximum number of threads
+			char *end;
+			unsigned long count = std::strtoul (optarg, &end, 10);
+			if (*optarg == 0 || *end != 0 || count == 0 || count > UINT_MAX)
+			{
+				std::fprintf (stderr, "Invalid number of jobs '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+
+			jobs::setMaximum (count);
+			break;
+		}
+
 		case 'o':
 			// set output path option
 			outputPath = optarg;
@@ -193,6 +227,16 @@ int main (int argc, char *argv[])
 			isBlacklist = false;
 			break;
 
+		case OPT_STATS:
+			// print statistics
+			stats::enable ();
+			break;
+
+		case OPT_TRACE:
+			// write trace file
+			stats::setTracePath (optarg);
+			break;
+
 		default:
 			printUsage (prog);
 			return EXIT_FAILURE;
@@ -254,7 +298,12 @@ int main (int argc, char *argv[])
 			// not BCFNT; try loading with freetype
 			std::fclose (fp);
 
-			auto face = freetype::Face::makeFace (library, input, ptSize);
+			std::shared_ptr<freetype::Face> face;
+			{
+				stats::Span span ("load");
+				face = freetype::Face::makeFace (library, input, ptSize);
+			}
+
 			if (!face)
 				return EXIT_FAILURE;
 
@@ -285,6 +334,9 @@ int main (int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 
+		stats::Span span ("load");
+		stats::count ("load", fileSize, 0);
+
 		std::vector<std::uint8_t> data (fileSize);
 
 		std::size_t offset = 0;
@@ -316,5 +368,8 @@ int main (int argc, char *argv[])
 		bcfnt->addFont (*font, list, isBlacklist);
 	}
 
-	return bcfnt->serialize (outputPath) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (!bcfnt->serialize (outputPath))
+		return EXIT_FAILURE;
+
+	return stats::report () ? EXIT_SUCCESS : EXIT_FAILURE;
 }
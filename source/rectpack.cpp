@@ -0,0 +1,822 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file rectpack.cpp
+ *  @brief Rectangle packing heuristics
+ */
+
+#include "rectpack.h"
+#include "future.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace
+{
+using rectpack::Packer;
+using rectpack::Rect;
+
+/** @brief Size comparator
+ *  @returns Whether w1 x h1 is smaller than w2 x h2
+ *
+ *  @note Sizes are ordered by area, then by longest side, then by width.
+ */
+bool smaller (size_t w1, size_t h1, size_t w2, size_t h2)
+{
+	size_t area1 = w1 * h1;
+	size_t area2 = w2 * h2;
+
+	if (area1 != area2)
+		return area1 < area2;
+
+	if (std::max (w1, h1) == std::max (w2, h2))
+		return w1 < w2;
+
+	return std::max (w1, h1) < std::max (w2, h2);
+}
+
+/** @brief Check whether two rectangles overlap
+ *  @param[in] a First rectangle
+ *  @param[in] b Second rectangle
+ *  @returns Whether the rectangles overlap
+ */
+bool intersects (const Rect &a, const Rect &b)
+{
+	return a.x < b.x + b.w && a.x + a.w > b.x && a.y < b.y + b.h && a.y + a.h > b.y;
+}
+
+/** @brief Check whether a rectangle contains another
+ *  @param[in] a Outer rectangle
+ *  @param[in] b Inner rectangle
+ *  @returns Whether a contains b
+ */
+bool contains (const Rect &a, const Rect &b)
+{
+	return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+}
+
+/** @brief Get the length of the overlap of two spans
+ *  @param[in] start1 First span start
+ *  @param[in] end1   First span end
+ *  @param[in] start2 Second span start
+ *  @param[in] end2   Second span end
+ *  @returns Overlap length
+ */
+size_t overlap (size_t start1, size_t end1, size_t start2, size_t end2)
+{
+	const size_t start = std::max (start1, start2);
+	const size_t end   = std::min (end1, end2);
+
+	return end > start ? end - start : 0;
+}
+
+typedef std::pair<size_t, size_t> XY;
+
+/** @brief Orders rectangles by position */
+struct PositionComparator
+{
+	bool operator() (const Rect &lhs, const Rect &rhs) const
+	{
+		if (lhs.x != rhs.x)
+			return lhs.x < rhs.x;
+		return lhs.y < rhs.y;
+	}
+};
+
+/** @brief Corner point packer
+ *
+ *  @details
+ *  Candidate positions are the corners to the right of and below placed
+ *  rectangles. From each corner, a rectangle is slid up or left until it
+ *  touches something, and the position with the most contact with placed
+ *  rectangles and the bin edges wins.
+ */
+class ContactPacker : public Packer
+{
+public:
+	ContactPacker (size_t width, size_t height) : width (width), height (height)
+	{
+		free.insert (XY (0, 0));
+	}
+
+	void reserve (const Rect &rect) override
+	{
+		placed.insert (rect);
+
+		add_free (rect.x + rect.w, rect.y);
+		add_free (rect.x, rect.y + rect.h);
+
+		fixup ();
+	}
+
+	bool insert (size_t w, size_t h, Rect &rect) override
+	{
+		XY best;
+		size_t best_score = 0;
+		bool best_rotated = false;
+		for (const auto &it : free)
+		{
+			size_t score = calc_score (it.first, it.second, w, h);
+			if (score > best_score)
+			{
+				best         = it;
+				best_score   = score;
+				best_rotated = false;
+			}
+
+			if (w != h)
+			{
+				size_t score = calc_score (it.first, it.second, h, w);
+				if (score > best_score)
+				{
+					best         = it;
+					best_score   = score;
+					best_rotated = true;
+				}
+			}
+		}
+
+		if (best_score == 0)
+			return false;
+
+		rect.x       = best.first;
+		rect.y       = best.second;
+		rect.w       = best_rotated ? h : w;
+		rect.h       = best_rotated ? w : h;
+		rect.rotated = best_rotated;
+
+		pack (rect.x, rect.y, rect.w, rect.h);
+		placed.insert (rect);
+		free.erase (best);
+
+		add_free (rect.x + rect.w, rect.y);
+		add_free (rect.x, rect.y + rect.h);
+
+		fixup ();
+		return true;
+	}
+
+private:
+	std::set<Rect, PositionComparator> placed; ///< Placed rectangles
+	std::set<XY> free;                         ///< Candidate positions
+	size_t width;                              ///< Bin width
+	size_t height;                             ///< Bin height
+
+	bool intersects_placed (size_t x, size_t y) const
+	{
+		for (const auto &rect : placed)
+		{
+			if (x >= rect.x && x < rect.x + rect.w && y >= rect.y && y < rect.y + rect.h)
+				return true;
+		}
+
+		return false;
+	}
+
+	void add_free (size_t x, size_t y)
+	{
+		if (x >= width || y >= height)
+			return;
+
+		if (intersects_placed (x, y))
+			return;
+
+		free.insert (XY (x, y));
+	}
+
+	void fixup ()
+	{
+		auto it = std::begin (free);
+		while (it != std::end (free))
+		{
+			if (intersects_placed (it->first, it->second))
+				it = free.erase (it);
+			else
+				++it;
+		}
+	}
+
+	void pack (size_t &x, size_t &y, size_t w, size_t h) const
+	{
+		bool intersects_left = (x == 0) || intersects_placed (x - 1, y);
+		bool intersects_up   = (y == 0) || intersects_placed (x, y - 1);
+
+		if (!intersects_left && !intersects_up)
+			std::abort (); // should be adjacent to a placed rectangle
+
+		if (intersects_left && intersects_up)
+			return;
+
+		if (intersects_left)
+		{
+			// move up as far as possible
+			--y;
+			while (y > 0 && !intersects_placed (x, y - 1))
+				--y;
+		}
+		else
+		{
+			// move left as far as possible
+			--x;
+			while (x > 0 && !intersects_placed (x - 1, y))
+				--x;
+		}
+	}
+
+	size_t calc_score (size_t x, size_t y, size_t w, size_t h) const
+	{
+		size_t score = 0;
+
+		pack (x, y, w, h);
+
+		if (x + w > width)
+			return 0;
+		if (y + h > height)
+			return 0;
+
+		for (const auto &rect : placed)
+		{
+			if (x + w < rect.x)
+				break;
+
+			if (x < rect.x + rect.w && x + w > rect.x && y < rect.y + rect.h && y + h > rect.y)
+				return 0;
+
+			if (x == rect.x + rect.w || x + w == rect.x)
+				score += overlap (y, y + h, rect.y, rect.y + rect.h);
+
+			if (y == rect.y + rect.h || y + h == rect.y)
+				score += overlap (x, x + w, rect.x, rect.x + rect.w);
+		}
+
+		if (x == 0)
+			score += h;
+		if (x + w == width)
+			score += h;
+
+		if (y == 0)
+			score += w;
+		if (y + h == height)
+			score += w;
+
+		return score;
+	}
+};
+
+/** @brief MaxRects packer
+ *
+ *  @details
+ *  Tracks every maximal free rectangle. Placing a rectangle splits each free
+ *  rectangle it overlaps into the up to four maximal rectangles around it.
+ */
+class MaxRectsPacker : public Packer
+{
+public:
+	MaxRectsPacker (size_t width, size_t height, bool contact)
+	    : width (width), height (height), contact (contact)
+	{
+		freeRects.push_back (Rect{0, 0, width, height, false});
+	}
+
+	void reserve (const Rect &rect) override
+	{
+		place (rect);
+	}
+
+	bool insert (size_t w, size_t h, Rect &rect) override
+	{
+		// lower scores are better
+		size_t best1 = SIZE_MAX;
+		size_t best2 = SIZE_MAX;
+		bool found   = false;
+
+		for (const auto &free : freeRects)
+		{
+			for (int rotated = 0; rotated < 2; ++rotated)
+			{
+				if (rotated && w == h)
+					break;
+
+				const size_t rw = rotated ? h : w;
+				const size_t rh = rotated ? w : h;
+
+				if (rw > free.w || rh > free.h)
+					continue;
+
+				size_t score1;
+				size_t score2;
+				if (contact)
+				{
+					score1 = SIZE_MAX - contactScore (free.x, free.y, rw, rh);
+					score2 = 0;
+				}
+				else
+				{
+					// best short side fit
+					score1 = std::min (free.w - rw, free.h - rh);
+					score2 = std::max (free.w - rw, free.h - rh);
+				}
+
+				if (score1 < best1 || (score1 == best1 && score2 < best2))
+				{
+					best1 = score1;
+					best2 = score2;
+					rect  = Rect{free.x, free.y, rw, rh, rotated != 0};
+					found = true;
+				}
+			}
+		}
+
+		if (!found)
+			return false;
+
+		place (rect);
+		return true;
+	}
+
+private:
+	std::vector<Rect> used;      ///< Placed rectangles
+	std::vector<Rect> freeRects; ///< Maximal free rectangles
+	size_t width;                ///< Bin width
+	size_t height;               ///< Bin height
+	bool contact;                ///< Whether to use the contact point rule
+
+	size_t contactScore (size_t x, size_t y, size_t w, size_t h) const
+	{
+		size_t score = 0;
+
+		if (x == 0 || x + w == width)
+			score += h;
+		if (y == 0 || y + h == height)
+			score += w;
+
+		for (const auto &rect : used)
+		{
+			if (rect.x == x + w || rect.x + rect.w == x)
+				score += overlap (rect.y, rect.y + rect.h, y, y + h);
+			if (rect.y == y + h || rect.y + rect.h == y)
+				score += overlap (rect.x, rect.x + rect.w, x, x + w);
+		}
+
+		return score;
+	}
+
+	void place (const Rect &rect)
+	{
+		std::vector<Rect> created;
+		for (size_t i = 0; i < freeRects.size ();)
+		{
+			const Rect free = freeRects[i];
+			if (!intersects (free, rect))
+			{
+				++i;
+				continue;
+			}
+
+			freeRects[i] = freeRects.back ();
+			freeRects.pop_back ();
+
+			if (rect.x > free.x)
+				created.push_back (Rect{free.x, free.y, rect.x - free.x, free.h, false});
+
+			if (rect.x + rect.w < free.x + free.w)
+			{
+				created.push_back (Rect{rect.x + rect.w,
+				    free.y,
+				    free.x + free.w - rect.x - rect.w,
+				    free.h,
+				    false});
+			}
+
+			if (rect.y > free.y)
+				created.push_back (Rect{free.x, free.y, free.w, rect.y - free.y, false});
+
+			if (rect.y + rect.h < free.y + free.h)
+			{
+				created.push_back (Rect{free.x,
+				    rect.y + rect.h,
+				    free.w,
+				    free.y + free.h - rect.y - rect.h,
+				    false});
+			}
+		}
+
+		// free rectangles never contain each other, and a new rectangle lies
+		// inside a removed one, so only new rectangles can be redundant
+		const size_t count = freeRects.size ();
+		for (size_t i = 0; i < created.size (); ++i)
+		{
+			bool redundant = std::any_of (std::begin (freeRects),
+			    std::begin (freeRects) + count,
+			    [&](const Rect &free) { return contains (free, created[i]); });
+
+			for (size_t j = 0; !redundant && j < created.size (); ++j)
+			{
+				// of two identical rectangles, keep the first
+				redundant = j != i && contains (created[j], created[i]) &&
+				            (j < i || !contains (created[i], created[j]));
+			}
+
+			if (!redundant)
+				freeRects.push_back (created[i]);
+		}
+
+		used.push_back (rect);
+	}
+};
+
+/** @brief Skyline packer
+ *
+ *  @details
+ *  Tracks the top edge of the used area as a list of horizontal segments and
+ *  places each rectangle where its top edge ends up lowest. Space below the
+ *  skyline is never reused.
+ */
+class SkylinePacker : public Packer
+{
+public:
+	SkylinePacker (size_t width, size_t height) : width (width), height (height)
+	{
+		skyline.push_back (Segment{0, 0, width});
+	}
+
+	void reserve (const Rect &rect) override
+	{
+		raise (rect.x, rect.w, rect.y + rect.h);
+	}
+
+	bool insert (size_t w, size_t h, Rect &rect) override
+	{
+		size_t bestTop   = SIZE_MAX;
+		size_t bestWidth = SIZE_MAX;
+		bool found       = false;
+
+		for (size_t i = 0; i < skyline.size (); ++i)
+		{
+			for (int rotated = 0; rotated < 2; ++rotated)
+			{
+				if (rotated && w == h)
+					break;
+
+				const size_t rw = rotated ? h : w;
+				const size_t rh = rotated ? w : h;
+
+				size_t y;
+				if (!fits (i, rw, rh, y))
+					continue;
+
+				// bottom-left rule; prefer the narrowest segment on ties
+				if (y + rh < bestTop || (y + rh == bestTop && skyline[i].w < bestWidth))
+				{
+					bestTop   = y + rh;
+					bestWidth = skyline[i].w;
+					rect      = Rect{skyline[i].x, y, rw, rh, rotated != 0};
+					found     = true;
+				}
+			}
+		}
+
+		if (!found)
+			return false;
+
+		raise (rect.x, rect.w, rect.y + rect.h);
+		return true;
+	}
+
+private:
+	/** @brief Skyline segment */
+	struct Segment
+	{
+		size_t x; ///< Left coordinate
+		size_t y; ///< Height of the used area
+		size_t w; ///< Width
+	};
+
+	std::vector<Segment> skyline; ///< Segments from left to right
+	size_t width;                 ///< Bin width
+	size_t height;                ///< Bin height
+
+	bool fits (size_t index, size_t w, size_t h, size_t &y) const
+	{
+		const size_t x = skyline[index].x;
+		if (x + w > width)
+			return false;
+
+		// rest on the highest segment under the rectangle
+		y = 0;
+		for (size_t i = index; i < skyline.size () && skyline[i].x < x + w; ++i)
+		{
+			y = std::max (y, skyline[i].y);
+			if (y + h > height)
+				return false;
+		}
+
+		return true;
+	}
+
+	void raise (size_t x, size_t w, size_t top)
+	{
+		std::vector<Segment> result;
+		for (const auto &segment : skyline)
+		{
+			const size_t end = segment.x + segment.w;
+
+			if (segment.x < x)
+				result.push_back (Segment{segment.x, segment.y, std::min (end, x) - segment.x});
+
+			const size_t start = std::max (segment.x, x);
+			const size_t stop  = std::min (end, x + w);
+			if (start < stop)
+				result.push_back (Segment{start, std::max (segment.y, top), stop - start});
+
+			if (end > x + w)
+			{
+				const size_t start = std::max (segment.x, x + w);
+				result.push_back (Segment{start, segment.y, end - start});
+			}
+		}
+
+		// merge neighbours of the same height
+		skyline.clear ();
+		for (const auto &segment : result)
+		{
+			if (!skyline.empty () && skyline.back ().y == segment.y)
+				skyline.back ().w += segment.w;
+			else
+				skyline.push_back (segment);
+		}
+	}
+};
+
+/** @brief Guillotine packer
+ *
+ *  @details
+ *  Tracks disjoint free rectangles. Each rectangle goes into the free
+ *  rectangle it fills best, and the leftover space is cut in two along the
+ *  shorter leftover axis.
+ */
+class GuillotinePacker : public Packer
+{
+public:
+	GuillotinePacker (size_t width, size_t height)
+	{
+		freeRects.push_back (Rect{0, 0, width, height, false});
+	}
+
+	void reserve (const Rect &rect) override
+	{
+		// cut every overlapping free rectangle around the reserved area
+		std::vector<Rect> result;
+		for (const auto &free : freeRects)
+		{
+			if (!intersects (free, rect))
+			{
+				result.push_back (free);
+				continue;
+			}
+
+			const size_t start = std::max (free.x, rect.x);
+			const size_t stop  = std::min (free.x + free.w, rect.x + rect.w);
+
+			if (rect.x > free.x)
+				result.push_back (Rect{free.x, free.y, rect.x - free.x, free.h, false});
+
+			if (rect.x + rect.w < free.x + free.w)
+			{
+				result.push_back (Rect{rect.x + rect.w,
+				    free.y,
+				    free.x + free.w - rect.x - rect.w,
+				    free.h,
+				    false});
+			}
+
+			if (rect.y > free.y)
+				result.push_back (Rect{start, free.y, stop - start, rect.y - free.y, false});
+
+			if (rect.y + rect.h < free.y + free.h)
+			{
+				result.push_back (Rect{start,
+				    rect.y + rect.h,
+				    stop - start,
+				    free.y + free.h - rect.y - rect.h,
+				    false});
+			}
+		}
+
+		freeRects.swap (result);
+	}
+
+	bool insert (size_t w, size_t h, Rect &rect) override
+	{
+		size_t bestArea  = SIZE_MAX;
+		size_t bestShort = SIZE_MAX;
+		size_t bestIndex = freeRects.size ();
+
+		for (size_t i = 0; i < freeRects.size (); ++i)
+		{
+			const Rect &free = freeRects[i];
+			for (int rotated = 0; rotated < 2; ++rotated)
+			{
+				if (rotated && w == h)
+					break;
+
+				const size_t rw = rotated ? h : w;
+				const size_t rh = rotated ? w : h;
+
+				if (rw > free.w || rh > free.h)
+					continue;
+
+				// best area fit; prefer the smaller short side leftover on ties
+				const size_t area  = free.w * free.h - rw * rh;
+				const size_t extra = std::min (free.w - rw, free.h - rh);
+				if (area < bestArea || (area == bestArea && extra < bestShort))
+				{
+					bestArea  = area;
+					bestShort = extra;
+					bestIndex = i;
+					rect      = Rect{free.x, free.y, rw, rh, rotated != 0};
+				}
+			}
+		}
+
+		if (bestIndex == freeRects.size ())
+			return false;
+
+		const Rect free = freeRects[bestIndex];
+		freeRects.erase (std::begin (freeRects) + bestIndex);
+
+		// split along the shorter leftover axis
+		const size_t right  = free.w - rect.w;
+		const size_t bottom = free.h - rect.h;
+
+		Rect r, b;
+		if (right <= bottom)
+		{
+			r = Rect{free.x + rect.w, free.y, right, rect.h, false};
+			b = Rect{free.x, free.y + rect.h, free.w, bottom, false};
+		}
+		else
+		{
+			r = Rect{free.x + rect.w, free.y, right, free.h, false};
+			b = Rect{free.x, free.y + rect.h, rect.w, bottom, false};
+		}
+
+		if (r.w && r.h)
+			freeRects.push_back (r);
+		if (b.w && b.h)
+			freeRects.push_back (b);
+
+		merge ();
+		return true;
+	}
+
+private:
+	std::vector<Rect> freeRects; ///< Disjoint free rectangles
+
+	void merge ()
+	{
+		for (size_t i = 0; i < freeRects.size (); ++i)
+		{
+			for (size_t j = i + 1; j < freeRects.size (); ++j)
+			{
+				Rect &a       = freeRects[i];
+				const Rect &b = freeRects[j];
+
+				if (a.x == b.x && a.w == b.w && (a.y + a.h == b.y || b.y + b.h == a.y))
+				{
+					a.y = std::min (a.y, b.y);
+					a.h += b.h;
+				}
+				else if (a.y == b.y && a.h == b.h && (a.x + a.w == b.x || b.x + b.w == a.x))
+				{
+					a.x = std::min (a.x, b.x);
+					a.w += b.w;
+				}
+				else
+					continue;
+
+				freeRects.erase (std::begin (freeRects) + j);
+				j = i;
+			}
+		}
+	}
+};
+}
+
+namespace rectpack
+{
+const char *name (Heuristic heuristic)
+{
+	switch (heuristic)
+	{
+	case CONTACT:
+		return "contact";
+	case MAXRECTS_BSSF:
+		return "maxrects-bssf";
+	case MAXRECTS_CONTACT:
+		return "maxrects-contact";
+	case SKYLINE:
+		return "skyline";
+	case GUILLOTINE:
+		return "guillotine";
+	}
+
+	std::abort ();
+}
+
+const char *name (SortOrder order)
+{
+	switch (order)
+	{
+	case SORT_AREA:
+		return "area";
+	case SORT_PERIMETER:
+		return "perimeter";
+	case SORT_SIDE:
+		return "side";
+	case SORT_WIDTH:
+		return "width";
+	case SORT_HEIGHT:
+		return "height";
+	}
+
+	std::abort ();
+}
+
+bool placeBefore (SortOrder order, size_t w1, size_t h1, size_t w2, size_t h2)
+{
+	size_t key1 = 0;
+	size_t key2 = 0;
+
+	switch (order)
+	{
+	case SORT_AREA:
+		break;
+
+	case SORT_PERIMETER:
+		key1 = w1 + h1;
+		key2 = w2 + h2;
+		break;
+
+	case SORT_SIDE:
+		key1 = std::max (w1, h1);
+		key2 = std::max (w2, h2);
+		break;
+
+	case SORT_WIDTH:
+		key1 = w1;
+		key2 = w2;
+		break;
+
+	case SORT_HEIGHT:
+		key1 = h1;
+		key2 = h2;
+		break;
+	}
+
+	if (key1 != key2)
+		return key1 > key2;
+
+	// larger first
+	return smaller (w2, h2, w1, h1);
+}
+
+std::unique_ptr<Packer> Packer::create (Heuristic heuristic, size_t width, size_t height)
+{
+	switch (heuristic)
+	{
+	case CONTACT:
+		return future::make_unique<ContactPacker> (width, height);
+	case MAXRECTS_BSSF:
+		return future::make_unique<MaxRectsPacker> (width, height, false);
+	case MAXRECTS_CONTACT:
+		return future::make_unique<MaxRectsPacker> (width, height, true);
+	case SKYLINE:
+		return future::make_unique<SkylinePacker> (width, height);
+	case GUILLOTINE:
+		return future::make_unique<GuillotinePacker> (width, height);
+	}
+
+	std::abort ();
+}
+}
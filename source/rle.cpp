@@ -22,12 +22,18 @@
  */
 
 #include "compress.h"
+#include "future.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /** @brief Minimum run length */
 #define RLE_MIN_RUN 3
 
@@ -37,27 +43,92 @@
 /** @brief Maximum copy length */
 #define RLE_MAX_COPY 128
 
-std::vector<uint8_t> rleEncode (const void *source, size_t len)
+namespace
 {
-	// create output buffer
-	std::vector<uint8_t> result;
+/** @brief Find the length of the run at the start of a buffer
+ *  @param[in] src Buffer
+ *  @param[in] len Buffer length; the longest run to look for
+ *  @returns Run length
+ */
+inline size_t runLength (const uint8_t *src, size_t len)
+{
+	size_t run = 1;
 
-	// append compression header
-	compressionHeader (result, 0x30, len);
+#if defined(__SSE2__)
+	// compare 16 bytes at a time
+	const __m128i value = _mm_set1_epi8 (static_cast<char> (*src));
+	while (run + 16 <= len)
+	{
+		const __m128i data = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (src + run));
+		const unsigned mismatch = ~_mm_movemask_epi8 (_mm_cmpeq_epi8 (data, value)) & 0xFFFF;
+		if (mismatch)
+			return run + __builtin_ctz (mismatch);
 
-	// encode all bytes
-	const uint8_t *src  = (const uint8_t *)source;
-	const uint8_t *save = src, *end = src + len;
-	size_t save_len = 0, run;
-	while (src < end)
+		run += 16;
+	}
+#else
+	// compare 8 bytes at a time
+	const uint64_t value = UINT64_C (0x0101010101010101) * *src;
+	while (run + 8 <= len)
 	{
-		// calculate current run
-		for (run = 1; src + run < end && run < RLE_MAX_RUN; ++run)
+		uint64_t data;
+		std::memcpy (&data, src + run, sizeof (data));
+
+		const uint64_t mismatch = data ^ value;
+		if (mismatch)
 		{
-			if (src[run] != *src)
-				break;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return run + __builtin_ctzll (mismatch) / 8;
+#else
+			return run + __builtin_clzll (mismatch) / 8;
+#endif
 		}
 
+		run += 8;
+	}
+#endif
+
+	while (run < len && src[run] == *src)
+		++run;
+
+	return run;
+}
+/** @brief Get worst-case encoded size
+ *  @param[in] len Source length
+ *  @returns Size when every byte is copied
+ */
+inline size_t rleBound (size_t len)
+{
+	return len + (len + RLE_MAX_COPY - 1) / RLE_MAX_COPY;
+}
+
+/** @brief Encode runs and copies
+ *  @param[inout] save     Start of bytes pending a copy; the next byte to encode
+ *                         follows them
+ *  @param[inout] save_len Number of bytes pending a copy
+ *  @param[in]    stop     Encode bytes before this point
+ *  @param[in]    end      End of source
+ *  @param[in]    out      Output position
+ *  @returns New output position
+ *
+ *  @note Runs may extend past stop but not past end. Pending bytes are left
+ *        for the caller to flush with rleFlush.
+ */
+uint8_t *rleEncodeRange (const uint8_t *&save,
+    size_t &save_len,
+    const uint8_t *stop,
+    const uint8_t *end,
+    uint8_t *out)
+{
+	const uint8_t *src = save + save_len;
+	size_t run;
+	while (src < stop)
+	{
+		// calculate current run
+		run = 1;
+		if (end - src >= RLE_MIN_RUN && src[1] == src[0] && src[2] == src[0])
+			run = runLength (src, std::min<size_t> (end - src, RLE_MAX_RUN));
+
 		if (run < RLE_MIN_RUN)
 		{
 			// run not long enough to encode
@@ -70,8 +141,9 @@ std::vector<uint8_t> rleEncode (const void *source, size_t len)
 		{
 			// append encoded copy length followed by copy buffer
 			assert (save_len - 1 < RLE_MAX_COPY);
-			result.push_back (save_len - 1);
-			result.insert (std::end (result), save, save + save_len);
+			*out++ = save_len - 1;
+			std::memcpy (out, save, save_len);
+			out += save_len;
 
 			// reset save point
 			save += save_len;
@@ -83,8 +155,8 @@ std::vector<uint8_t> rleEncode (const void *source, size_t len)
 		{
 			// append encoded run to output buffer
 			assert (run - 3 < RLE_MAX_RUN);
-			result.push_back (0x80 | (run - 3));
-			result.push_back (*src);
+			*out++ = 0x80 | (run - 3);
+			*out++ = *src;
 
 			// reset save point
 			src += run;
@@ -93,17 +165,135 @@ std::vector<uint8_t> rleEncode (const void *source, size_t len)
 		}
 	}
 
-	assert (save + save_len == end);
+	assert (save + save_len == src);
+	return out;
+}
 
+/** @brief Encode bytes pending a copy
+ *  @param[in] save     Start of bytes pending a copy
+ *  @param[in] save_len Number of bytes pending a copy
+ *  @param[in] out      Output position
+ *  @returns New output position
+ */
+uint8_t *rleFlush (const uint8_t *save, size_t save_len, uint8_t *out)
+{
 	// check if there is data left to copy
 	if (save_len)
 	{
 		// append encoded copy length followed by copy buffer
 		assert (save_len - 1 < RLE_MAX_COPY);
-		result.push_back (save_len - 1);
-		result.insert (std::end (result), save, save + save_len);
+		*out++ = save_len - 1;
+		std::memcpy (out, save, save_len);
+		out += save_len;
+	}
+
+	return out;
+}
+
+/** @brief Streaming run-length encoding compressor
+ *
+ *  @details
+ *  Pushed data is kept until it is encoded. A byte is encoded once a
+ *  maximum-length run could follow it.
+ */
+class RLECompressor : public Compressor
+{
+public:
+	RLECompressor () : result (COMPRESSION_HEADER_MAX)
+	{
+	}
+
+	void push (const void *src, size_t len) override
+	{
+		const uint8_t *source = static_cast<const uint8_t *> (src);
+		window.insert (std::end (window), source, source + len);
+		total += len;
+
+		if (window.size () - save - save_len > RLE_MAX_RUN)
+			encode (window.size () - RLE_MAX_RUN);
+	}
+
+	std::vector<uint8_t> finish () override
+	{
+		encode (window.size ());
+
+		const size_t pos = result.size ();
+		result.resize (pos + rleBound (save_len));
+
+		uint8_t *out = rleFlush (window.data () + save, save_len, result.data () + pos);
+		result.resize (out - result.data ());
+
+		// pad the output buffer to 4 bytes
+		if (result.size () & 0x3)
+			result.resize ((result.size () + 3) & ~0x3);
+
+		finishCompressionHeader (result, 0x30, total);
+		return std::move (result);
 	}
 
+private:
+	/** @brief Encode runs and copies
+	 *  @param[in] stop Window position to encode up to
+	 */
+	void encode (size_t stop)
+	{
+		// runs and copies never take more room than their bytes plus length bytes
+		const size_t pos = result.size ();
+		result.resize (pos + rleBound (window.size () - save));
+
+		const uint8_t *begin = window.data () + save;
+
+		uint8_t *out = rleEncodeRange (begin,
+		    save_len,
+		    window.data () + stop,
+		    window.data () + window.size (),
+		    result.data () + pos);
+
+		result.resize (out - result.data ());
+		save = begin - window.data ();
+
+		// drop encoded bytes once that frees at least half of the window
+		if (save >= window.size () / 2)
+		{
+			window.erase (std::begin (window), std::begin (window) + save);
+			save = 0;
+		}
+	}
+
+	std::vector<uint8_t> window; ///< Unencoded data
+	std::vector<uint8_t> result; ///< Output buffer
+	size_t save     = 0;         ///< Window position of bytes pending a copy
+	size_t save_len = 0;         ///< Number of bytes pending a copy
+	size_t total    = 0;         ///< Total length of pushed data
+};
+}
+
+std::vector<uint8_t> rleEncode (const void *source, size_t len)
+{
+	// create output buffer
+	std::vector<uint8_t> result;
+
+	// append compression header
+	compressionHeader (result, 0x30, len);
+
+	// worst case is all copies
+	const size_t header = result.size ();
+	result.resize (header + rleBound (len));
+	uint8_t *out = result.data () + header;
+
+	// encode all bytes
+	const uint8_t *save = (const uint8_t *)source;
+	const uint8_t *end  = save + len;
+	size_t save_len     = 0;
+
+	out = rleEncodeRange (save, save_len, end, end, out);
+	assert (save + save_len == end);
+
+	out = rleFlush (save, save_len, out);
+
+	assert (out <= result.data () + result.size ());
+	result.resize (out - result.data ());
+
 	// pad the output buffer to 4 bytes
 	if (result.size () & 0x3)
 		result.resize ((result.size () + 3) & ~0x3);
@@ -112,6 +302,55 @@ std::vector<uint8_t> rleEncode (const void *source, size_t len)
 	return result;
 }
 
+CompressionEstimate rleEstimate (const void *source, size_t len)
+{
+	const uint8_t *src = (const uint8_t *)source;
+	const uint8_t *end = src + len;
+
+	// make the same decisions as rleEncodeRange, but only count the output
+	size_t size = 0, save_len = 0, run;
+	while (src < end)
+	{
+		// calculate current run
+		run = 1;
+		if (end - src >= RLE_MIN_RUN && src[1] == src[0] && src[2] == src[0])
+			run = runLength (src, std::min<size_t> (end - src, RLE_MAX_RUN));
+
+		if (run < RLE_MIN_RUN)
+		{
+			// run not long enough to encode
+			++src;
+			++save_len;
+		}
+
+		// check if we need to encode a copy
+		if (save_len == RLE_MAX_COPY || (save_len > 0 && run > 2))
+		{
+			size += 1 + save_len;
+			save_len = 0;
+		}
+
+		// check if run is long enough to encode
+		if (run > 2)
+		{
+			size += 2;
+			src += run;
+		}
+	}
+
+	// check if there is data left to copy
+	if (save_len)
+		size += 1 + save_len;
+
+	size += len >= 0x1000000 ? 8 : 4;
+	return {"rle", (size + 3) & ~static_cast<size_t> (0x3), true};
+}
+
+std::unique_ptr<Compressor> rleCompressor ()
+{
+	return future::make_unique<RLECompressor> ();
+}
+
 void rleDecode (const void *source, void *dest, size_t size)
 {
 	const uint8_t *src = reinterpret_cast<const uint8_t *> (source);
@@ -0,0 +1,655 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file stats.cpp
+ *  @brief Per-stage timing statistics and Chrome trace output
+ */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <vector>
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+/** @brief Completed span */
+struct Event
+{
+	const char *stage; ///< Stage name
+	uint64_t start;    ///< Start time (ns)
+	uint64_t duration; ///< Duration (ns)
+	uint64_t cpu;      ///< Thread CPU time (ns)
+};
+
+/** @brief Events of one thread */
+struct ThreadLog
+{
+	size_t id;                 ///< Thread number
+	const char *name;          ///< Thread name
+	std::vector<Event> events; ///< Completed spans
+};
+
+/** @brief Data processed by a stage */
+struct Counters
+{
+	size_t in    = 0; ///< Bytes in
+	size_t out   = 0; ///< Bytes out
+	size_t items = 0; ///< Items processed
+};
+
+/** @brief Whether statistics are being collected
+ *  @note Read from operator new on every thread, so it is only ever loaded relaxed.
+ */
+std::atomic<bool> active (false);
+
+/** @brief Check whether statistics are being collected */
+inline bool isActive ()
+{
+	return active.load (std::memory_order_relaxed);
+}
+
+/** @brief Trace output path */
+std::string tracePath;
+
+/** @brief Collection start time */
+Clock::time_point epoch;
+
+/** @brief Process CPU time at collection start */
+std::clock_t epochCPU;
+
+/** @brief Guards logs and counters */
+std::mutex mutex;
+
+/** @brief Events of every thread, including threads which have exited */
+std::vector<std::unique_ptr<ThreadLog>> logs;
+
+/** @brief Data processed by each stage */
+std::map<std::string, Counters> counters;
+
+/** @brief Current thread's log */
+thread_local ThreadLog *local = nullptr;
+
+/** @brief Get the current thread's log
+ *  @returns Log
+ */
+ThreadLog &threadLog ()
+{
+	if (!local)
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		logs.emplace_back (new ThreadLog{logs.size (), nullptr, {}});
+		local = logs.back ().get ();
+	}
+
+	return *local;
+}
+
+/** @brief Get time since collection start
+ *  @returns Time (ns)
+ */
+uint64_t now ()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds> (Clock::now () - epoch).count ();
+}
+
+/** @brief Get CPU time of the current thread
+ *  @returns Time (ns); 0 if unsupported
+ */
+uint64_t threadCPU ()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+	if (::clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		return static_cast<uint64_t> (ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+	return 0;
+}
+
+#if defined(ENABLE_ALLOC_STATS)
+/** @brief Maximum number of stages with allocation counters */
+constexpr size_t MAX_ALLOC_STAGES = 64;
+
+/** @brief Stage of allocations made before statistics were enabled */
+constexpr size_t UNCOUNTED = SIZE_MAX;
+
+/** @brief Allocation counters
+ *
+ *  @note Zero-initialized before any dynamic initialization, so allocations
+ *  made by static constructors are safe.
+ */
+struct AllocCounters
+{
+	std::atomic<const char *> stage; ///< Stage name; null if unused
+	std::atomic<uint64_t> count;     ///< Number of allocations
+	std::atomic<uint64_t> bytes;     ///< Bytes allocated
+	std::atomic<int64_t> live;       ///< Bytes allocated and not yet freed
+	std::atomic<int64_t> peak;       ///< Most bytes live at once
+};
+
+/** @brief Counters of each stage; index 0 counts allocations outside any span */
+AllocCounters allocStages[MAX_ALLOC_STAGES];
+
+/** @brief Counters of every allocation */
+AllocCounters allocTotal;
+
+/** @brief Stage of the current thread's innermost span */
+thread_local size_t allocStage = 0;
+
+/** @brief Header in front of every allocation */
+struct alignas (alignof (std::max_align_t)) AllocHeader
+{
+	size_t size;  ///< Requested size
+	size_t stage; ///< Stage which made the allocation
+};
+
+/** @brief Get the allocation counters of a stage
+ *  @param[in] stage Stage name
+ *  @returns Index in allocStages; 0 if every slot is taken
+ */
+size_t allocIndex (const char *stage)
+{
+	for (size_t i = 1; i < MAX_ALLOC_STAGES; ++i)
+	{
+		const char *name = allocStages[i].stage.load ();
+		if (!name && allocStages[i].stage.compare_exchange_strong (name, stage))
+			return i;
+
+		// name holds the stage which took the slot
+		if (name == stage || std::strcmp (name, stage) == 0)
+			return i;
+	}
+
+	return 0;
+}
+
+/** @brief Add to live bytes and update the peak
+ *  @param[in] counters Counters
+ *  @param[in] size     Bytes allocated
+ */
+void allocated (AllocCounters &counters, size_t size)
+{
+	counters.count.fetch_add (1, std::memory_order_relaxed);
+	counters.bytes.fetch_add (size, std::memory_order_relaxed);
+
+	const int64_t live = counters.live.fetch_add (size, std::memory_order_relaxed) + size;
+
+	int64_t peak = counters.peak.load (std::memory_order_relaxed);
+	while (live > peak &&
+	       !counters.peak.compare_exchange_weak (peak, live, std::memory_order_relaxed))
+		;
+}
+
+/** @brief Allocate memory with a header recording its size and stage
+ *  @param[in] size Bytes to allocate
+ *  @returns Memory; null on failure
+ */
+void *allocate (size_t size)
+{
+	auto header = static_cast<AllocHeader *> (std::malloc (sizeof (AllocHeader) + size));
+	if (!header)
+		return nullptr;
+
+	header->size  = size;
+	header->stage = UNCOUNTED;
+
+	if (isActive ())
+	{
+		header->stage = allocStage;
+		allocated (allocStages[allocStage], size);
+		allocated (allocTotal, size);
+	}
+
+	return header + 1;
+}
+
+/** @brief Free memory from allocate ()
+ *  @param[in] ptr Memory; may be null
+ */
+void release (void *ptr)
+{
+	if (!ptr)
+		return;
+
+	AllocHeader *header = static_cast<AllocHeader *> (ptr) - 1;
+	if (header->stage != UNCOUNTED)
+	{
+		allocStages[header->stage].live.fetch_sub (header->size, std::memory_order_relaxed);
+		allocTotal.live.fetch_sub (header->size, std::memory_order_relaxed);
+	}
+
+	std::free (header);
+}
+
+/** @brief Count the current thread's allocations outside any stage while in scope
+ *  @note Keeps the allocations of the statistics themselves out of the stages.
+ */
+class Untagged
+{
+public:
+	Untagged () : stage (allocStage)
+	{
+		allocStage = 0;
+	}
+
+	~Untagged ()
+	{
+		allocStage = stage;
+	}
+
+private:
+	size_t stage; ///< Stage to restore
+};
+
+/** @brief Print the allocations of each stage */
+void reportAllocations ()
+{
+	std::printf ("\n%-12s %10s %12s %12s %12s %12s\n",
+	    "stage",
+	    "allocs",
+	    "bytes",
+	    "peak live",
+	    "live",
+	    "allocs/item");
+
+	for (size_t i = 0; i < MAX_ALLOC_STAGES; ++i)
+	{
+		const AllocCounters &stage = allocStages[i];
+		const char *name           = i == 0 ? "(none)" : stage.stage.load ();
+		if (!name || stage.count == 0)
+			continue;
+
+		std::printf ("%-12s %10llu %12llu %12lld %12lld",
+		    name,
+		    static_cast<unsigned long long> (stage.count),
+		    static_cast<unsigned long long> (stage.bytes),
+		    static_cast<long long> (stage.peak),
+		    static_cast<long long> (stage.live));
+
+		auto it = counters.find (name);
+		if (it != counters.end () && it->second.items)
+			std::printf (" %12.1f\n", static_cast<double> (stage.count) / it->second.items);
+		else
+			std::printf (" %12s\n", "-");
+	}
+
+	std::printf ("total: %llu allocations, %llu bytes, peak %lld bytes live\n",
+	    static_cast<unsigned long long> (allocTotal.count),
+	    static_cast<unsigned long long> (allocTotal.bytes),
+	    static_cast<long long> (allocTotal.peak));
+}
+#else
+/** @brief No-op without allocation statistics */
+class Untagged
+{
+public:
+	Untagged ()
+	{
+	}
+};
+#endif
+
+/** @brief Summary of a stage */
+struct Summary
+{
+	const char *stage;       ///< Stage name
+	uint64_t first;          ///< Start of the first span (ns)
+	size_t spans;            ///< Number of spans
+	uint64_t wall;           ///< Time any span was running (ns)
+	uint64_t busy;           ///< Sum of span durations (ns)
+	uint64_t cpu;            ///< Sum of span CPU time (ns)
+	std::set<size_t> threads; ///< Threads with spans
+	Counters counters;       ///< Data processed
+};
+
+/** @brief Summarize every stage
+ *  @returns Summaries in order of first span
+ */
+std::vector<Summary> summarize ()
+{
+	std::map<std::string, Summary> summaries;
+	std::map<std::string, std::vector<std::pair<uint64_t, uint64_t>>> intervals;
+
+	for (const auto &log : logs)
+	{
+		for (const auto &event : log->events)
+		{
+			auto it = summaries.find (event.stage);
+			if (it == summaries.end ())
+			{
+				Summary summary{event.stage, event.start, 0, 0, 0, 0, {}, {}};
+				it = summaries.emplace (event.stage, summary).first;
+			}
+
+			Summary &summary = it->second;
+			summary.first    = std::min (summary.first, event.start);
+			summary.spans += 1;
+			summary.busy += event.duration;
+			summary.cpu += event.cpu;
+			summary.threads.emplace (log->id);
+
+			intervals[event.stage].emplace_back (event.start, event.start + event.duration);
+		}
+	}
+
+	for (const auto &entry : counters)
+	{
+		auto it = summaries.find (entry.first);
+		if (it == summaries.end ())
+		{
+			Summary summary{entry.first.c_str (), UINT64_MAX, 0, 0, 0, 0, {}, {}};
+			it = summaries.emplace (entry.first, summary).first;
+		}
+
+		it->second.counters = entry.second;
+	}
+
+	std::vector<Summary> result;
+	for (auto &entry : summaries)
+	{
+		// wall time is the union of the spans, so overlapping spans count once
+		auto &spans = intervals[entry.first];
+		std::sort (std::begin (spans), std::end (spans));
+
+		uint64_t end = 0;
+		for (const auto &span : spans)
+		{
+			const uint64_t start = std::max (span.first, end);
+			if (span.second > start)
+				entry.second.wall += span.second - start;
+			end = std::max (end, span.second);
+		}
+
+		result.emplace_back (std::move (entry.second));
+	}
+
+	std::stable_sort (std::begin (result),
+	    std::end (result),
+	    [](const Summary &lhs, const Summary &rhs) { return lhs.first < rhs.first; });
+
+	return result;
+}
+
+/** @brief Write Chrome trace_event file
+ *  @param[in] path Output path
+ *  @returns Whether the file was written
+ */
+bool writeTrace (const std::string &path)
+{
+	FILE *fp = std::fopen (path.c_str (), "w");
+	if (!fp)
+	{
+		std::fprintf (stderr, "fopen '%s': %s\n", path.c_str (), std::strerror (errno));
+		return false;
+	}
+
+	std::fprintf (fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+	bool first = true;
+	for (const auto &log : logs)
+	{
+		char name[64];
+		if (log->name)
+			std::snprintf (name, sizeof (name), "%s %zu", log->name, log->id);
+		else
+			std::snprintf (name, sizeof (name), "thread %zu", log->id);
+
+		std::fprintf (fp,
+		    "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, "
+		    "\"args\": {\"name\": \"%s\"}}",
+		    first ? "" : ",",
+		    log->id,
+		    name);
+		first = false;
+
+		for (const auto &event : log->events)
+		{
+			std::fprintf (fp,
+			    ",\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, "
+			    "\"dur\": %.3f, \"args\": {\"cpu_ms\": %.3f}}",
+			    event.stage,
+			    log->id,
+			    event.start / 1e3,
+			    event.duration / 1e3,
+			    event.cpu / 1e6);
+		}
+	}
+
+	std::fprintf (fp, "\n]}\n");
+
+	const bool error = std::ferror (fp);
+	if (std::fclose (fp) != 0 || error)
+	{
+		std::fprintf (stderr, "Failed to write '%s'\n", path.c_str ());
+		return false;
+	}
+
+	return true;
+}
+}
+
+namespace stats
+{
+void enable ()
+{
+	if (isActive ())
+		return;
+
+	epoch    = Clock::now ();
+	epochCPU = std::clock ();
+	active.store (true, std::memory_order_release);
+
+	threadName ("main");
+}
+
+bool enabled ()
+{
+	return isActive ();
+}
+
+void setTracePath (const std::string &path)
+{
+	tracePath = path;
+	enable ();
+}
+
+void threadName (const char *name)
+{
+	if (isActive ())
+		threadLog ().name = name;
+}
+
+void count (const char *stage, size_t in, size_t out, size_t items)
+{
+	if (!isActive ())
+		return;
+
+	Untagged untagged;
+	std::lock_guard<std::mutex> lock (mutex);
+	Counters &counter = counters[stage];
+	counter.in += in;
+	counter.out += out;
+	counter.items += items;
+}
+
+bool report ()
+{
+	if (!isActive ())
+		return true;
+
+	const double wall = now () / 1e6;
+	const double cpu  = 1e3 * (std::clock () - epochCPU) / CLOCKS_PER_SEC;
+
+	std::lock_guard<std::mutex> lock (mutex);
+
+	std::printf ("%-12s %6s %10s %10s %10s %4s %7s %12s %12s %8s %10s\n",
+	    "stage",
+	    "spans",
+	    "wall ms",
+	    "busy ms",
+	    "cpu ms",
+	    "thr",
+	    "util",
+	    "bytes in",
+	    "bytes out",
+	    "items",
+	    "items/s");
+
+	for (const auto &summary : summarize ())
+	{
+		// fraction of the threads' time spent in the stage while it ran
+		const size_t threads = summary.threads.size ();
+		const double util    = summary.wall ? 100.0 * summary.busy / (summary.wall * threads) : 0.0;
+
+		std::printf ("%-12s %6zu %10.1f %10.1f %10.1f %4zu %6.1f%% %12zu %12zu %8zu",
+		    summary.stage,
+		    summary.spans,
+		    summary.wall / 1e6,
+		    summary.busy / 1e6,
+		    summary.cpu / 1e6,
+		    threads,
+		    util,
+		    summary.counters.in,
+		    summary.counters.out,
+		    summary.counters.items);
+
+		if (summary.counters.items && summary.wall)
+			std::printf (" %10.0f\n", summary.counters.items / (summary.wall / 1e9));
+		else
+			std::printf (" %10s\n", "-");
+	}
+
+	std::printf ("total: wall %.1f ms, cpu %.1f ms\n", wall, cpu);
+
+#if defined(ENABLE_ALLOC_STATS)
+	reportAllocations ();
+#endif
+
+	if (tracePath.empty ())
+		return true;
+
+	return writeTrace (tracePath);
+}
+
+Span::Span (const char *stage)
+    : stage (isActive () ? stage : nullptr), start (0), cpu (0), previous (0)
+{
+	if (!this->stage)
+		return;
+
+#if defined(ENABLE_ALLOC_STATS)
+	previous   = allocStage;
+	allocStage = allocIndex (stage);
+#endif
+
+	start = now ();
+	cpu   = threadCPU ();
+}
+
+Span::~Span ()
+{
+	if (!stage)
+		return;
+
+	const uint64_t end = now ();
+
+	{
+		Untagged untagged;
+		threadLog ().events.emplace_back (Event{stage, start, end - start, threadCPU () - cpu});
+	}
+
+#if defined(ENABLE_ALLOC_STATS)
+	allocStage = previous;
+#endif
+}
+}
+
+#if defined(ENABLE_ALLOC_STATS)
+void *operator new (std::size_t size)
+{
+	while (true)
+	{
+		void *ptr = allocate (size);
+		if (ptr)
+			return ptr;
+
+		std::new_handler handler = std::get_new_handler ();
+		if (!handler)
+			throw std::bad_alloc ();
+
+		handler ();
+	}
+}
+
+void *operator new[] (std::size_t size)
+{
+	return ::operator new (size);
+}
+
+void *operator new (std::size_t size, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return ::operator new (size);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void *operator new[] (std::size_t size, const std::nothrow_t &) noexcept
+{
+	return ::operator new (size, std::nothrow);
+}
+
+void operator delete (void *ptr) noexcept
+{
+	release (ptr);
+}
+
+void operator delete[] (void *ptr) noexcept
+{
+	release (ptr);
+}
+
+void operator delete (void *ptr, const std::nothrow_t &) noexcept
+{
+	release (ptr);
+}
+
+void operator delete[] (void *ptr, const std::nothrow_t &) noexcept
+{
+	release (ptr);
+}
+#endif
@@ -0,0 +1,277 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file t3x.cpp
+ *  @brief Reference .t3x reader
+ */
+
+#include "t3x.h"
+#include "compress.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+namespace
+{
+/** @brief Bits per pixel of each texture format */
+const uint8_t formatBits[t3x::NUM_FORMATS] = {
+    32, // RGBA8888
+    24, // RGB888
+    16, // RGBA5551
+    16, // RGB565
+    16, // RGBA4444
+    16, // LA88
+    16, // HILO88
+    8,  // L8
+    8,  // A8
+    8,  // LA44
+    4,  // L4
+    4,  // A4
+    4,  // ETC1
+    8,  // ETC1A4
+};
+
+/** @brief Little-endian file reader */
+class Reader
+{
+public:
+	/** @brief Parameterized constructor
+	 *  @param[in] file File contents
+	 */
+	explicit Reader (const std::vector<uint8_t> &file) : file (file)
+	{
+	}
+
+	/** @brief Read u8 */
+	uint8_t u8 ()
+	{
+		if (pos >= file.size ())
+			throw std::runtime_error ("Truncated header");
+
+		return file[pos++];
+	}
+
+	/** @brief Read u16 */
+	uint16_t u16 ()
+	{
+		uint16_t value = u8 ();
+		return value | u8 () << 8;
+	}
+
+	/** @brief Read u32 */
+	uint32_t u32 ()
+	{
+		uint32_t value = u16 ();
+		return value | static_cast<uint32_t> (u16 ()) << 16;
+	}
+
+	/** @brief Read texture coordinate */
+	float coord ()
+	{
+		return u16 () / 1024.0f;
+	}
+
+	/** @brief Get read position */
+	size_t tell () const
+	{
+		return pos;
+	}
+
+private:
+	const std::vector<uint8_t> &file; ///< File contents
+	size_t pos = 0;                   ///< Read position
+};
+}
+
+namespace t3x
+{
+Texture::Texture (std::vector<uint8_t> file) : file (std::move (file))
+{
+	Reader reader (this->file);
+
+	const uint16_t numSubs = reader.u16 ();
+	const uint8_t params   = reader.u8 ();
+
+	texWidth  = 8u << (params & 0x7);
+	texHeight = 8u << ((params >> 3) & 0x7);
+	numFaces  = (params & PARAM_CUBEMAP) ? 6 : 1;
+
+	if (texWidth > 1024 || texHeight > 1024)
+		throw std::runtime_error ("Invalid texture size");
+
+	texFormat = reader.u8 ();
+	if (texFormat >= NUM_FORMATS)
+		throw std::runtime_error ("Invalid texture format");
+
+	numLevels = reader.u8 () + 1;
+	if (texWidth >> (numLevels - 1) < 8 || texHeight >> (numLevels - 1) < 8)
+		throw std::runtime_error ("Invalid number of mipmaps");
+
+	extensionFlags = 0;
+	if (params & PARAM_EXTENSION)
+		extensionFlags = reader.u8 ();
+
+	if (extensionFlags & ~(EXTENSION_TRIM | EXTENSION_CHUNKED))
+		throw std::runtime_error ("Unknown extension");
+
+	for (size_t i = 0; i < numSubs; ++i)
+	{
+		SubImage sub = {};
+		sub.width    = reader.u16 ();
+		sub.height   = reader.u16 ();
+		sub.left     = reader.coord ();
+		sub.top      = reader.coord ();
+		sub.right    = reader.coord ();
+		sub.bottom   = reader.coord ();
+
+		if (extensionFlags & EXTENSION_TRIM)
+		{
+			sub.srcWidth  = reader.u16 ();
+			sub.srcHeight = reader.u16 ();
+			sub.trimLeft  = reader.u16 ();
+			sub.trimTop   = reader.u16 ();
+		}
+
+		subs.emplace_back (sub);
+	}
+
+	if (extensionFlags & EXTENSION_CHUNKED)
+	{
+		const uint16_t numChunks = reader.u16 ();
+		if (numChunks != numFaces * numLevels)
+			throw std::runtime_error ("Invalid number of chunks");
+
+		for (size_t i = 0; i < numChunks; ++i)
+		{
+			Chunk chunk;
+			chunk.type = reader.u8 ();
+			reader.u8 (); /* Reserved */
+			reader.u8 (); /* Reserved */
+			reader.u8 (); /* Reserved */
+			chunk.offset           = reader.u32 ();
+			chunk.size             = reader.u32 ();
+			chunk.uncompressedSize = reader.u32 ();
+
+			if (chunk.offset % CHUNK_ALIGN != 0)
+				throw std::runtime_error ("Misaligned chunk");
+
+			if (chunk.offset > this->file.size () || chunk.size > this->file.size () - chunk.offset)
+				throw std::runtime_error ("Truncated chunk");
+
+			if (chunk.uncompressedSize != levelSize (i % numLevels))
+				throw std::runtime_error ("Invalid chunk size");
+
+			if (chunk.type == 0x00 && chunk.size != chunk.uncompressedSize)
+				throw std::runtime_error ("Invalid chunk size");
+
+			table.emplace_back (chunk);
+		}
+	}
+
+	dataOffset = reader.tell ();
+}
+
+Texture Texture::read (const std::string &path)
+{
+	FILE *fp = std::fopen (path.c_str (), "rb");
+	if (!fp)
+		throw std::runtime_error ("Failed to open " + path);
+
+	std::vector<uint8_t> file;
+
+	uint8_t buffer[4096];
+	size_t rc;
+	while ((rc = std::fread (buffer, 1, sizeof (buffer), fp)) > 0)
+		file.insert (std::end (file), buffer, buffer + rc);
+
+	const bool error = std::ferror (fp);
+	std::fclose (fp);
+
+	if (error)
+		throw std::runtime_error ("Failed to read " + path);
+
+	return Texture (std::move (file));
+}
+
+size_t Texture::levelSize (size_t level) const
+{
+	return (texWidth >> level) * (texHeight >> level) * formatBits[texFormat] / 8;
+}
+
+std::vector<uint8_t> Texture::load (size_t face, size_t level) const
+{
+	if (face >= numFaces || level >= numLevels)
+		throw std::runtime_error ("No such mipmap level");
+
+	if (table.empty ())
+	{
+		// the whole blob has to be decompressed
+		std::vector<uint8_t> data = load ();
+
+		size_t offset = 0;
+		for (size_t i = 0; i < face * numLevels + level; ++i)
+			offset += levelSize (i % numLevels);
+
+		return std::vector<uint8_t> (data.begin () + offset, data.begin () + offset + levelSize (level));
+	}
+
+	const Chunk &chunk  = table[face * numLevels + level];
+	const uint8_t *data = file.data () + chunk.offset;
+
+	std::vector<uint8_t> result;
+	if (chunk.type == 0x00)
+		result.assign (data, data + chunk.size);
+	else if ((data[0] & ~0x80) != chunk.type)
+		throw std::runtime_error ("Chunk compression type mismatch");
+	else
+		result = decompress (data, chunk.size);
+
+	if (result.size () != chunk.uncompressedSize)
+		throw std::runtime_error ("Invalid chunk size");
+
+	return result;
+}
+
+std::vector<uint8_t> Texture::load () const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < numLevels; ++i)
+		total += levelSize (i) * numFaces;
+
+	std::vector<uint8_t> result;
+	if (table.empty ())
+		result = decompress (file.data () + dataOffset, file.size () - dataOffset);
+	else
+	{
+		for (size_t face = 0; face < numFaces; ++face)
+		{
+			for (size_t level = 0; level < numLevels; ++level)
+			{
+				std::vector<uint8_t> data = load (face, level);
+				result.insert (std::end (result), std::begin (data), std::end (data));
+			}
+		}
+	}
+
+	if (result.size () != total)
+		throw std::runtime_error ("Invalid image data size");
+
+	return result;
+}
+}
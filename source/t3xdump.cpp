@@ -0,0 +1,188 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017-2022
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of tex3ds.
+ *
+ * tex3ds is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tex3ds is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tex3ds.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file t3xdump.cpp
+ *  @brief Print and verify the contents of a .t3x file
+ */
+
+#include "t3x.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+namespace
+{
+/** @brief Texture format names */
+const char *const formatNames[t3x::NUM_FORMATS] = {
+    "RGBA8888",
+    "RGB888",
+    "RGBA5551",
+    "RGB565",
+    "RGBA4444",
+    "LA88",
+    "HILO88",
+    "L8",
+    "A8",
+    "LA44",
+    "L4",
+    "A4",
+    "ETC1",
+    "ETC1A4",
+};
+
+/** @brief Get compression type name
+ *  @param[in] type Compression type
+ */
+const char *compressionName (uint8_t type)
+{
+	switch (type)
+	{
+	case 0x00:
+		return "none";
+	case 0x10:
+		return "lzss";
+	case 0x11:
+		return "lz11";
+	case 0x28:
+		return "huff";
+	case 0x30:
+		return "rle";
+	}
+
+	return "unknown";
+}
+
+/** @brief Print and verify a .t3x file
+ *  @param[in] path File path
+ *  @returns Whether every mipmap level loaded successfully
+ */
+bool dump (const char *path)
+{
+	const t3x::Texture texture = t3x::Texture::read (path);
+
+	std::printf ("%s: %zux%zu %s, %zu level(s), %zu face(s)",
+	    path,
+	    texture.width (),
+	    texture.height (),
+	    formatNames[texture.format ()],
+	    texture.levels (),
+	    texture.faces ());
+
+	if (texture.extensions () & t3x::EXTENSION_TRIM)
+		std::printf (", trim offsets");
+	if (texture.extensions () & t3x::EXTENSION_CHUNKED)
+		std::printf (", chunked");
+	std::printf ("\n");
+
+	const std::vector<t3x::SubImage> &subs = texture.subImages ();
+	for (size_t i = 0; i < subs.size (); ++i)
+	{
+		const t3x::SubImage &sub = subs[i];
+		std::printf ("  sub %zu: %ux%u (%.4f, %.4f)-(%.4f, %.4f)",
+		    i,
+		    sub.width,
+		    sub.height,
+		    sub.left,
+		    sub.top,
+		    sub.right,
+		    sub.bottom);
+
+		if (texture.extensions () & t3x::EXTENSION_TRIM)
+			std::printf (" src %ux%u trim %u,%u",
+			    sub.srcWidth,
+			    sub.srcHeight,
+			    sub.trimLeft,
+			    sub.trimTop);
+
+		std::printf ("\n");
+	}
+
+	const std::vector<t3x::Chunk> &chunks = texture.chunks ();
+	for (size_t i = 0; i < chunks.size (); ++i)
+	{
+		const t3x::Chunk &chunk = chunks[i];
+		std::printf ("  chunk face %zu level %zu: %-4s offset 0x%" PRIx32 " size %" PRIu32
+		             " uncompressed %" PRIu32 "\n",
+		    i / texture.levels (),
+		    i % texture.levels (),
+		    compressionName (chunk.type),
+		    chunk.offset,
+		    chunk.size,
+		    chunk.uncompressedSize);
+	}
+
+	bool ok = true;
+	for (size_t face = 0; face < texture.faces (); ++face)
+	{
+		for (size_t level = 0; level < texture.levels (); ++level)
+		{
+			try
+			{
+				const std::vector<uint8_t> data = texture.load (face, level);
+				if (data.size () == texture.levelSize (level))
+					continue;
+
+				std::fprintf (stderr,
+				    "%s: face %zu level %zu: expected %zu bytes, got %zu\n",
+				    path,
+				    face,
+				    level,
+				    texture.levelSize (level),
+				    data.size ());
+			}
+			catch (const std::exception &e)
+			{
+				std::fprintf (stderr, "%s: face %zu level %zu: %s\n", path, face, level, e.what ());
+			}
+
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+}
+
+int main (int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		std::fprintf (stderr, "Usage: %s <file.t3x>...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int rc = EXIT_SUCCESS;
+	for (int i = 1; i < argc; ++i)
+	{
+		try
+		{
+			if (!dump (argv[i]))
+				rc = EXIT_FAILURE;
+		}
+		catch (const std::exception &e)
+		{
+			std::fprintf (stderr, "%s: %s\n", argv[i], e.what ());
+			rc = EXIT_FAILURE;
+		}
+	}
+
+	return rc;
+}
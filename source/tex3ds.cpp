@@ -24,9 +24,13 @@
 #include "atlas.h"
 #include "compress.h"
 #include "encode.h"
+#include "future.h"
+#include "jobs.h"
+#include "layout.h"
 #include "magick_compat.h"
 #include "quantum.h"
 #include "rg_etc1.h"
+#include "stats.h"
 #include "subimage.h"
 #include "swizzle.h"
 #include "utility.h"
@@ -34,18 +38,29 @@
 #include <getopt.h>
 #include <libgen.h>
 
+#if defined(HAVE_SYS_UIO_H) && defined(HAVE_WRITEV)
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <climits>
 #include <cmath>
 #include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
+#include <memory>
 #include <queue>
 #include <set>
 #include <stdexcept>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace
@@ -135,12 +150,13 @@ const ProcessFormatMap output_format_strings[] = {
 /** @brief Compression format */
 enum CompressionFormat
 {
-	COMPRESSION_NONE, ///< No compression
-	COMPRESSION_LZ10, ///< LZSS/LZ10 compression
-	COMPRESSION_LZ11, ///< LZ11 compression
-	COMPRESSION_RLE,  ///< Run-length encoding compression
-	COMPRESSION_HUFF, ///< Huffman encoding
-	COMPRESSION_AUTO, ///< Choose best compression
+	COMPRESSION_NONE,      ///< No compression
+	COMPRESSION_LZ10,      ///< LZSS/LZ10 compression
+	COMPRESSION_LZ11,      ///< LZ11 compression
+	COMPRESSION_RLE,       ///< Run-length encoding compression
+	COMPRESSION_HUFF,      ///< Huffman encoding
+	COMPRESSION_AUTO,      ///< Choose best compression
+	COMPRESSION_AUTO_FAST, ///< Choose compression predicted to be best
 };
 
 typedef std::pair<const char *, CompressionFormat> CompressionFormatMap;
@@ -149,14 +165,15 @@ typedef CaseInsensitiveComparator<CompressionFormat> CompressionFormatComparator
 /** @brief Compression format strings */
 const CompressionFormatMap compression_format_strings[] = {
     /* clang-format off */
-	{ "auto",     COMPRESSION_AUTO, },
-	{ "huff",     COMPRESSION_HUFF, },
-	{ "huffman",  COMPRESSION_HUFF, },
-	{ "lz10",     COMPRESSION_LZ10, },
-	{ "lz11",     COMPRESSION_LZ11, },
-	{ "lzss",     COMPRESSION_LZ10, },
-	{ "none",     COMPRESSION_NONE, },
-	{ "rle",      COMPRESSION_RLE,  },
+	{ "auto",      COMPRESSION_AUTO,      },
+	{ "auto-fast", COMPRESSION_AUTO_FAST, },
+	{ "huff",      COMPRESSION_HUFF,      },
+	{ "huffman",   COMPRESSION_HUFF,      },
+	{ "lz10",      COMPRESSION_LZ10,      },
+	{ "lz11",      COMPRESSION_LZ11,      },
+	{ "lzss",      COMPRESSION_LZ10,      },
+	{ "none",      COMPRESSION_NONE,      },
+	{ "rle",       COMPRESSION_RLE,       },
     /* clang-format on */
 };
 
@@ -199,6 +216,34 @@ const FilterTypeMap filter_type_strings[] = {
     /* clang-format on */
 };
 
+typedef std::pair<const char *, rectpack::Heuristic> HeuristicMap;
+typedef CaseInsensitiveComparator<rectpack::Heuristic> HeuristicComparator;
+
+/** @brief Packing heuristic strings */
+const HeuristicMap heuristic_strings[] = {
+    /* clang-format off */
+	{ "contact",          rectpack::CONTACT,          },
+	{ "guillotine",       rectpack::GUILLOTINE,       },
+	{ "maxrects-bssf",    rectpack::MAXRECTS_BSSF,    },
+	{ "maxrects-contact", rectpack::MAXRECTS_CONTACT, },
+	{ "skyline",          rectpack::SKYLINE,          },
+    /* clang-format on */
+};
+
+typedef std::pair<const char *, rectpack::SortOrder> SortOrderMap;
+typedef CaseInsensitiveComparator<rectpack::SortOrder> SortOrderComparator;
+
+/** @brief Packing sort order strings */
+const SortOrderMap sort_order_strings[] = {
+    /* clang-format off */
+	{ "area",      rectpack::SORT_AREA,      },
+	{ "height",    rectpack::SORT_HEIGHT,    },
+	{ "perimeter", rectpack::SORT_PERIMETER, },
+	{ "side",      rectpack::SORT_SIDE,      },
+	{ "width",     rectpack::SORT_WIDTH,     },
+    /* clang-format on */
+};
+
 /** @brief Processing mode */
 enum ProcessingMode
 {
@@ -226,12 +271,18 @@ std::string output_path;
 /** @brief Preview path option */
 std::string preview_path;
 
+/** @brief Layout sidecar path option */
+std::string layout_path;
+
 /** @brief Process format option */
 ProcessFormat process_format = RGBA8888;
 
 /** @brief ETC1 quality option */
 rg_etc1::etc1_quality etc1_quality = rg_etc1::cMediumQuality;
 
+/** @brief ETC1 rate-distortion tolerance option; negative when disabled */
+double etc1_rd = -1.0;
+
 /** @brief Compression format option */
 CompressionFormat compression_format = COMPRESSION_AUTO;
 
@@ -244,12 +295,57 @@ ProcessingMode process_mode = PROCESS_NORMAL;
 /** @brief Trim input images */
 bool trim = false;
 
+/** @brief Compress LZ10/LZ11 segments in parallel */
+bool parallel_lz = false;
+
+/** @brief Record trim offsets in output */
+bool trim_offsets = false;
+
+/** @brief Output chunked container */
+bool chunked = false;
+
+/** @brief Choose bleed mode by output format */
+bool bleed_auto = false;
+
+/** @brief Color of invisible pixels */
+BleedMode bleed_mode = BLEED_NONE;
+
+/** @brief Spill atlas onto multiple pages */
+bool multi_atlas = false;
+
+/** @brief Atlas packing options */
+PackOptions pack_options;
+
+/** @brief Number of output pages */
+size_t num_pages = 1;
+
 /** @brief Output subimage data */
 std::vector<SubImage> subimage_data;
 
 /** @brief Output image data */
 encode::Buffer image_data;
 
+/** @brief Streaming compressors of image data; see start_compression () */
+std::vector<std::unique_ptr<Compressor>> compressors;
+
+/** @brief Byte histogram of image data for Huffman compression; see start_compression () */
+size_t huff_histogram[256];
+
+/** @brief Whether huff_histogram is counted as image data is appended */
+bool huff_streamed = false;
+
+/** @brief Separately compressed part of the image data */
+struct Chunk
+{
+	size_t offset;               ///< Offset in image data
+	size_t size;                 ///< Uncompressed size
+	std::vector<uint8_t> buffer; ///< Compressed data, or the compression header if uncompressed
+	bool uncompressed;           ///< Whether the data is stored uncompressed
+};
+
+/** @brief Chunks of image data, with --chunked */
+std::vector<Chunk> chunks;
+
 /** @brief Output width */
 size_t output_width;
 
@@ -271,6 +367,36 @@ unsigned border = 0;
 /** @brief Add an colored edge between atlased images */
 unsigned edge = 0;
 
+/** @brief Incremental build state for this build */
+Layout layout;
+
+/** @brief Size of a tile's source pixels */
+constexpr size_t TILE_PIXEL_SIZE = 8 * 8 * 4 * sizeof (Magick::Quantum);
+
+/** @brief Hash tile digests for lookup */
+struct TileDigestHash
+{
+	size_t operator() (const TileDigest &digest) const
+	{
+		return digest.fnv;
+	}
+};
+
+/** @brief Previous tile indices by pixel digest */
+std::unordered_map<TileDigest, size_t, TileDigestHash> previous_tiles;
+
+/** @brief Previous encoded tiles */
+encode::Buffer previous_data;
+
+/** @brief Previous encoded tile size */
+size_t previous_tile_size = 0;
+
+/** @brief Index of the first tile of the current mipmap level */
+size_t tile_base = 0;
+
+/** @brief Number of reused tiles */
+std::atomic<size_t> reused_tiles (0);
+
 /** @brief Load image
  *  @param[in] img Input image
  *  @returns vector of images to process
@@ -369,6 +495,7 @@ std::vector<Magick::Image> load_image (Magick::Image &img)
 
 		size_t image_width  = img.columns ();
 		size_t image_height = img.rows ();
+		const Magick::Image source = img;
 		if (image_width != output_width || image_height != output_height)
 		{
 			// expand canvas
@@ -389,6 +516,7 @@ std::vector<Magick::Image> load_image (Magick::Image &img)
 			    static_cast<float> (border + image_width - edge) / output_width,
 			    1.0f - static_cast<float> (border + image_height - edge) / output_height,
 			    false);
+			getTrim (source, subimage_data.back ());
 		}
 
 		// push the source image
@@ -508,6 +636,28 @@ std::string add_prefix (std::string path, std::string prefix)
 	return prefix + path;
 }
 
+/** @brief Output page */
+struct Page
+{
+	std::vector<Magick::Image> images; ///< Images to process
+	std::vector<SubImage> subs;        ///< Sub-image data
+	size_t width;                      ///< Output width
+	size_t height;                     ///< Output height
+};
+
+/** @brief Get output path for a page
+ *  @param[in] path Output path
+ *  @param[in] page Page number
+ *  @returns Path with page prefix if there are multiple pages
+ */
+std::string page_path (const std::string &path, size_t page)
+{
+	if (num_pages == 1)
+		return path;
+
+	return add_prefix (path, "page" + std::to_string (page) + "_");
+}
+
 /** @brief Finalize process format
  *  @param[in] images Input images
  */
@@ -533,6 +683,60 @@ void finalize_process_format (std::vector<Magick::Image> &images)
 		process_format = ETC1;
 }
 
+/** @brief Finalize bleed mode
+ *
+ *  @details
+ *  Invisible pixels keep arbitrary colors from the source, which defeat
+ *  run-length and LZ matches. Formats with color and alpha give them the color
+ *  of nearby visible pixels, which compresses well and doesn't darken edges
+ *  when the texture is filtered or mipmapped. Formats without alpha show every
+ *  pixel, and alpha-only formats store no color, so they are left alone.
+ *
+ *  @note Must be called after finalize_process_format ().
+ */
+void finalize_bleed_mode ()
+{
+	if (!bleed_auto)
+		return;
+
+	switch (process_format)
+	{
+	case RGBA8888:
+	case RGBA5551:
+	case RGBA4444:
+	case LA88:
+	case LA44:
+	case ETC1A4:
+		bleed_mode = BLEED_DILATE;
+		break;
+
+	default:
+		bleed_mode = BLEED_NONE;
+		break;
+	}
+}
+
+/** @brief Get alpha precision of the output format
+ *  @returns Number of alpha bits; 8 for formats without alpha
+ */
+unsigned alpha_bits ()
+{
+	switch (process_format)
+	{
+	case RGBA5551:
+		return 1;
+
+	case RGBA4444:
+	case LA44:
+	case A4:
+	case ETC1A4:
+		return 4;
+
+	default:
+		return 8;
+	}
+}
+
 /** @brief Work queue */
 std::queue<encode::WorkUnit> work_queue;
 
@@ -554,11 +758,74 @@ std::mutex result_mutex;
 /** @brief Whether anymore work is coming */
 bool work_done = false;
 
+/** @brief Copy a tile's pixels
+ *  @param[in]  p      Pixel data
+ *  @param[in]  stride Pixel data stride
+ *  @param[out] out    Output buffer of TILE_PIXEL_SIZE bytes
+ */
+void copy_tile (const PixelPacket &p, size_t stride, uint8_t *out)
+{
+	for (size_t y = 0; y < 8; ++y)
+	{
+		for (size_t x = 0; x < 8; ++x)
+		{
+			Magick::Color c = p[y * stride + x];
+
+			const Magick::Quantum q[] = {
+			    quantumRed (c), quantumGreen (c), quantumBlue (c), quantumAlpha (c),
+			};
+
+			std::memcpy (out, q, sizeof (q));
+			out += sizeof (q);
+		}
+	}
+}
+
+/** @brief Process a work unit
+ *  @param[in] work Work unit
+ *
+ *  @note When building incrementally, tiles whose pixels match a tile from the
+ *  previous build reuse its encoding.
+ */
+void process_work (encode::WorkUnit &work)
+{
+	stats::Span span ("encode");
+
+	if (layout_path.empty ())
+	{
+		work.process (work);
+		stats::count ("encode", 8 * 8 * 4, work.result.size (), 1);
+		return;
+	}
+
+	uint8_t pixels[TILE_PIXEL_SIZE];
+	copy_tile (work.p, work.stride, pixels);
+
+	// the previous pixels aren't kept, so tiles are matched by a 128-bit digest
+	const TileDigest digest = TileDigest::of (pixels, sizeof (pixels));
+
+	layout.tiles[tile_base + work.sequence] = digest;
+
+	auto it = previous_tiles.find (digest);
+	if (it == std::end (previous_tiles))
+	{
+		work.process (work);
+		stats::count ("encode", 8 * 8 * 4, work.result.size (), 1);
+		return;
+	}
+
+	auto begin = std::begin (previous_data) + it->second * previous_tile_size;
+	work.result.assign (begin, begin + previous_tile_size);
+	++reused_tiles;
+}
+
 /** @brief Work thread
  *  @param[in] param Unused
  */
 void work_thread (void *param)
 {
+	stats::threadName ("worker");
+
 	while (true)
 	{
 		std::unique_lock<std::mutex> lock (work_mutex);
@@ -577,7 +844,7 @@ void work_thread (void *param)
 		lock.unlock ();
 
 		// process the work unit
-		work.process (work);
+		process_work (work);
 
 		{
 			// put result on the result queue
@@ -590,6 +857,208 @@ void work_thread (void *param)
 	}
 }
 
+/** @brief Compression routine */
+struct Compression
+{
+	const char *name;                                      ///< Compression name
+	std::vector<uint8_t> (*encode) (const void *, size_t); ///< One-shot encoder
+	std::unique_ptr<Compressor> (*stream) ();              ///< Streaming encoder, if any
+};
+
+/** @brief Get compression routines for the compression format option
+ *  @returns Routines to try, in order of preference
+ *
+ *  @note Parallel LZ compression needs all of the data, so it doesn't stream.
+ */
+std::vector<Compression> compression_routines ()
+{
+	const bool all =
+	    compression_format == COMPRESSION_AUTO || compression_format == COMPRESSION_AUTO_FAST;
+
+	std::vector<Compression> routines;
+	if (all || compression_format == COMPRESSION_LZ10)
+	{
+		if (parallel_lz)
+			routines.push_back ({"lzss", &lzssEncodeParallel, nullptr});
+		else
+			routines.push_back ({"lzss", &lzssEncode, &lzssCompressor});
+	}
+
+	if (all || compression_format == COMPRESSION_LZ11)
+	{
+		if (parallel_lz)
+			routines.push_back ({"lz11", &lz11EncodeParallel, nullptr});
+		else
+			routines.push_back ({"lz11", &lz11Encode, &lz11Compressor});
+	}
+
+	if (all || compression_format == COMPRESSION_HUFF)
+		routines.push_back ({"huff", &huffEncode, nullptr});
+
+	if (all || compression_format == COMPRESSION_RLE)
+		routines.push_back ({"rle", &rleEncode, &rleCompressor});
+
+	return routines;
+}
+
+/** @brief Start streaming compression of the image data
+ *
+ *  @details
+ *  Every image_data append is also pushed to the streaming compressors, so
+ *  compression overlaps with encoding. The Huffman tree needs all of the data,
+ *  so only its histogram is counted as data is appended; the data itself is
+ *  encoded from image_data at the end, without another copy of it.
+ */
+void start_compression ()
+{
+	compressors.clear ();
+	huff_streamed = false;
+	std::fill (std::begin (huff_histogram), std::end (huff_histogram), 0);
+
+	// predicting the best compression needs all of the data
+	if (output_path.empty () || compression_format == COMPRESSION_AUTO_FAST)
+		return;
+
+	for (const auto &routine : compression_routines ())
+	{
+		compressors.emplace_back (routine.stream ? routine.stream () : nullptr);
+		if (std::strcmp (routine.name, "huff") == 0)
+			huff_streamed = true;
+	}
+}
+
+/** @brief Append to image data
+ *  @param[in] data Encoded data
+ */
+void append_image_data (const encode::Buffer &data)
+{
+	stats::Span span ("compress");
+
+	image_data.insert (std::end (image_data), std::begin (data), std::end (data));
+
+	for (auto &compressor : compressors)
+	{
+		if (compressor)
+			compressor->push (data.data (), data.size ());
+	}
+
+	if (huff_streamed)
+	{
+		for (const auto &byte : data)
+			++huff_histogram[byte];
+	}
+}
+
+/** @brief Get uncompressed output size
+ *  @param[in] len Source length
+ *  @returns Size of the compression header plus the data padded to 4 bytes
+ */
+size_t uncompressedSize (size_t len)
+{
+	return (len >= 0x1000000 ? 8 : 4) + ((len + 3) & ~static_cast<size_t> (0x3));
+}
+
+/** @brief Compress data
+ *  @param[in]  data   Source buffer; all of it must have been pushed to the compressors
+ *  @param[in]  len    Source length
+ *  @param[out] buffer Compressed data, or the compression header if uncompressed
+ *  @returns Whether the data is uncompressed; the source and padding to 4 bytes follow buffer
+ *
+ *  @note With -z auto, uncompressed data is used unless compression is smaller.
+ *  With -z auto-fast, only the compression predicted to be smallest is tried,
+ *  unless the prediction is uncertain.
+ */
+bool compress_data (const uint8_t *data, size_t len, std::vector<uint8_t> &buffer)
+{
+	stats::Span span ("compress");
+
+	std::vector<Compression> routines = compression_routines ();
+	assert (compressors.empty () || compressors.size () == routines.size ());
+
+	if (compression_format == COMPRESSION_AUTO_FAST)
+	{
+		const std::vector<CompressionEstimate> candidates =
+		    compressionCandidates (estimateCompression (data, len));
+
+		auto skipped = [&](const Compression &routine) {
+			return std::none_of (std::begin (candidates),
+			    std::end (candidates),
+			    [&](const CompressionEstimate &estimate) {
+				    return std::strcmp (estimate.name, routine.name) == 0;
+			    });
+		};
+
+		routines.erase (std::remove_if (std::begin (routines), std::end (routines), skipped),
+		    std::end (routines));
+	}
+
+	// any compression beats uncompressed data unless auto-selecting
+	const bool all   = compression_format == COMPRESSION_AUTO ||
+	                   compression_format == COMPRESSION_AUTO_FAST;
+	size_t best_size = std::numeric_limits<size_t>::max ();
+	if (all)
+		best_size = uncompressedSize (len);
+
+	const char *best_type = "none";
+
+	for (size_t i = 0; i < routines.size (); ++i)
+	{
+		std::vector<uint8_t> output;
+		if (i < compressors.size () && compressors[i])
+			output = compressors[i]->finish ();
+		else if (huff_streamed && std::strcmp (routines[i].name, "huff") == 0)
+			output = huffEncodeHistogram (data, len, huff_histogram);
+		else
+			output = routines[i].encode (data, len);
+
+		if (output.empty () && !all)
+			throw std::runtime_error ("Failed to compress data");
+
+		if (!output.empty () && output.size () < best_size)
+		{
+			buffer.swap (output);
+			best_size = buffer.size ();
+			best_type = routines[i].name;
+		}
+	}
+
+	compressors.clear ();
+	huff_streamed = false;
+
+	if (all)
+		std::printf ("Used %s for compression\n", best_type);
+
+	stats::count ("compress", len, buffer.empty () ? uncompressedSize (len) : buffer.size ());
+
+	if (!buffer.empty ())
+		return false;
+
+	// uncompressed data is written straight from the source
+	compressionHeader (buffer, 0x00, len);
+	return true;
+}
+
+/** @brief Finish a chunk of image data
+ *
+ *  @details
+ *  With --chunked, every mipmap level of every face is compressed on its own.
+ *  The compressors are restarted for the next chunk.
+ */
+void end_chunk ()
+{
+	if (!chunked || output_path.empty ())
+		return;
+
+	Chunk chunk;
+	chunk.offset = chunks.empty () ? 0 : chunks.back ().offset + chunks.back ().size;
+	chunk.size   = image_data.size () - chunk.offset;
+
+	chunk.uncompressed = compress_data (image_data.data () + chunk.offset, chunk.size, chunk.buffer);
+	chunks.emplace_back (std::move (chunk));
+
+	start_compression ();
+}
+
 /** @brief Process image
  *  @param[in] img Image to process
  */
@@ -671,6 +1140,10 @@ void process_image (Magick::Image &img)
 	std::queue<Magick::Image> img_queue;
 
 	// add base level
+	{
+		stats::Span span ("bleed");
+		applyBleed (img, bleed_mode, alpha_bits ());
+	}
 	img_queue.push (img);
 
 	// keep preview width/height
@@ -699,8 +1172,17 @@ void process_image (Magick::Image &img)
 			width  = width / 2;
 			height = height / 2;
 
-			// resize the image
-			img.resize (Magick::Geometry (width, height));
+			{
+				// resize the image
+				stats::Span span ("mipmap");
+				img.resize (Magick::Geometry (width, height));
+			}
+
+			{
+				// resizing blends invisible pixels into visible ones and vice versa
+				stats::Span span ("bleed");
+				applyBleed (img, bleed_mode, alpha_bits ());
+			}
 
 			// add to mipmap queue
 			img_queue.push (img);
@@ -710,10 +1192,20 @@ void process_image (Magick::Image &img)
 	// create the preview image
 	Magick::Image preview (Magick::Geometry (preview_width, preview_height), transparent ());
 
+	// ETC1 rate-distortion optimization
+	std::unique_ptr<encode::ETC1Optimizer> optimizer;
+	if (etc1_rd >= 0.0 && (process_format == ETC1 || process_format == ETC1A4) &&
+	    !output_path.empty ())
+		optimizer = future::make_unique<encode::ETC1Optimizer> (etc1_rd);
+
 	// create worker threads
 	std::vector<std::thread> workers;
+
+	// one worker per job slot
+	const jobs::Slots slots (jobs::concurrency ());
+
 	work_done = false;
-	for (size_t i = 0; i < std::thread::hardware_concurrency (); ++i)
+	for (size_t i = 0; i < slots.size (); ++i)
 		workers.emplace_back (work_thread, nullptr);
 
 	size_t voff = 0; // vertical offset for mipmap preview
@@ -735,12 +1227,20 @@ void process_image (Magick::Image &img)
 
 		// all formats are swizzled except ETC1/ETC1A4
 		if (process_format != ETC1 && process_format != ETC1A4)
+		{
+			stats::Span span ("swizzle");
 			swizzle (img, false);
+		}
 
 		// get pixel cache
 		Pixels cache (img);
 		PixelPacket p = cache.get (0, 0, img.columns (), img.rows ());
 
+		// tiles are numbered across all mipmap levels and sub-images
+		tile_base = layout.tiles.size ();
+		if (!layout_path.empty ())
+			layout.tiles.resize (tile_base + (width / 8) * (height / 8));
+
 		// process each 8x8 tile
 		uint64_t num_work = 0;
 		for (size_t j = 0; j < height; j += 8)
@@ -753,7 +1253,7 @@ void process_image (Magick::Image &img)
 				    width,
 				    etc1_quality,
 				    !output_path.empty (),
-				    !preview_path.empty (),
+				    !preview_path.empty () && !optimizer,
 				    process);
 
 				{
@@ -785,22 +1285,34 @@ void process_image (Magick::Image &img)
 			while (result_queue.empty () || result_queue.front ().sequence != num_result)
 				result_cond.wait (mutex);
 
-			// get the result's output buffer
-			encode::Buffer result;
+			// get the result
 			std::pop_heap (result_queue.begin (), result_queue.end ());
-			result.swap (result_queue.back ().result);
+			encode::WorkUnit work = std::move (result_queue.back ());
 			result_queue.pop_back ();
 			mutex.unlock ();
 
+			// rate-distortion pass; depends on every preceding tile
+			if (optimizer)
+			{
+				stats::Span span ("etc1-rd");
+				work.preview = !preview_path.empty ();
+				optimizer->optimize (work, process_format == ETC1A4);
+			}
+
 			// append the result's output buffer
-			image_data.insert (image_data.end (), result.begin (), result.end ());
+			append_image_data (work.result);
 		}
 
+		// every mipmap level is a chunk
+		end_chunk ();
+
 		// synchronize the pixel cache
 		cache.sync ();
 
 		if (!preview_path.empty ())
 		{
+			stats::Span span ("preview");
+
 			// unswizzle the mipmap image
 			if (process_format != ETC1 && process_format != ETC1A4)
 				swizzle (img, true);
@@ -827,6 +1339,8 @@ void process_image (Magick::Image &img)
 
 	if (!preview_path.empty ())
 	{
+		stats::Span span ("preview");
+
 		try
 		{
 			// output the preview image
@@ -848,6 +1362,14 @@ void process_image (Magick::Image &img)
 	}
 }
 
+/** @brief Output data segment */
+struct Segment
+{
+	const void *data; ///< Segment data
+	size_t size;      ///< Segment size
+};
+
+#if !defined(HAVE_SYS_UIO_H) || !defined(HAVE_WRITEV)
 /** @brief Write buffer
  *  @param[in] fp File handle
  */
@@ -868,11 +1390,81 @@ void write_buffer (FILE *fp, const void *buffer, size_t size)
 		pos += rc;
 	}
 }
+#endif
 
-/** @brief Write Tex3DS header
- *  @param[in] fp File handle
+/** @brief Write output file
+ *  @param[in] path     Output path
+ *  @param[in] segments Data to write, in order
+ *
+ *  @note The segments are gathered by writev () where available, so they are
+ *  never copied into a single buffer.
  */
-void write_tex3ds_header (FILE *fp)
+void write_file (const std::string &path, const std::vector<Segment> &segments)
+{
+	stats::Span span ("output");
+
+	size_t total = 0;
+	for (const auto &segment : segments)
+		total += segment.size;
+	stats::count ("output", total, total);
+
+#if defined(HAVE_SYS_UIO_H) && defined(HAVE_WRITEV)
+	int fd = ::open (path.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		throw std::runtime_error ("Failed to open output file");
+
+	std::vector<struct iovec> iov;
+	for (const auto &segment : segments)
+	{
+		if (segment.size)
+			iov.push_back ({const_cast<void *> (segment.data), segment.size});
+	}
+
+	// there are only a handful of segments, well below IOV_MAX
+	size_t first = 0;
+	while (first < iov.size ())
+	{
+		ssize_t rc = ::writev (fd, &iov[first], iov.size () - first);
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc <= 0)
+		{
+			::close (fd);
+			throw std::runtime_error ("Failed to output data");
+		}
+
+		// skip what was written
+		size_t written = rc;
+		while (written > 0 && written >= iov[first].iov_len)
+			written -= iov[first++].iov_len;
+
+		if (written > 0)
+		{
+			iov[first].iov_base = static_cast<uint8_t *> (iov[first].iov_base) + written;
+			iov[first].iov_len -= written;
+		}
+	}
+
+	if (::close (fd) != 0)
+		throw std::runtime_error ("Failed to output data");
+#else
+	FILE *fp = std::fopen (path.c_str (), "wb");
+	if (!fp)
+		throw std::runtime_error ("Failed to open output file");
+
+	for (const auto &segment : segments)
+		write_buffer (fp, segment.data, segment.size);
+
+	if (std::fclose (fp) != 0)
+		throw std::runtime_error ("Failed to output data");
+#endif
+}
+
+/** @brief Encode Tex3DS header
+ *  @returns Tex3DS header
+ */
+encode::Buffer tex3ds_header ()
 {
 	encode::Buffer buf;
 
@@ -899,6 +1491,16 @@ void write_tex3ds_header (FILE *fp)
 	if (process_mode == PROCESS_CUBEMAP || process_mode == PROCESS_SKYBOX)
 		texture_params |= 1 << 6;
 
+	// extension flags follow the mipmap count
+	uint8_t extensions = 0;
+	if (trim_offsets)
+		extensions |= encode::EXTENSION_TRIM;
+	if (chunked)
+		extensions |= encode::EXTENSION_CHUNKED;
+
+	if (extensions)
+		texture_params |= 1 << 7;
+
 	encode::encode<uint8_t> (texture_params, buf);
 	encode::encode<uint8_t> (process_format, buf);
 
@@ -907,6 +1509,9 @@ void write_tex3ds_header (FILE *fp)
 		num_mipmaps = 0;
 	encode::encode<uint8_t> (num_mipmaps, buf);
 
+	if (extensions)
+		encode::encode<uint8_t> (extensions, buf);
+
 	// encode subimage info
 	for (const auto &sub : subimage_data)
 	{
@@ -929,140 +1534,119 @@ void write_tex3ds_header (FILE *fp)
 		}
 
 		encode::encode (sub, width, height, buf);
+
+		if (trim_offsets)
+			encode::encodeTrim (sub, buf);
 	}
 
-	write_buffer (fp, buf.data (), buf.size ());
+	return buf;
 }
 
-/** @brief Dummy compression
- *  @param[in]  src    Source buffer
- *  @param[in]  len    Source length
- *  @returns "Compressed" buffer
+/** @brief Write chunked output data
+ *  @param[in] page Page number
+ *
+ *  @details
+ *  The chunk table follows the Tex3DS header. Every chunk starts on a
+ *  CHUNK_ALIGN boundary. Compressed chunks keep their compression header;
+ *  uncompressed chunks are stored as-is, so they can be copied straight to
+ *  VRAM.
  */
-std::vector<uint8_t> compressNone (const void *src, size_t len)
+void write_chunked_output (size_t page)
 {
-	const uint8_t *source = reinterpret_cast<const uint8_t *> (src);
-
-	std::vector<uint8_t> result;
+	static const uint8_t padding[encode::CHUNK_ALIGN] = {};
 
-	// append compression header
-	compressionHeader (result, 0x00, len);
+	auto align = [](size_t size) {
+		return (size + encode::CHUNK_ALIGN - 1) & ~(encode::CHUNK_ALIGN - 1);
+	};
 
-	// add data
-	result.insert (std::end (result), source, source + len);
+	encode::Buffer header = tex3ds_header ();
+	encode::encode<uint16_t> (chunks.size (), header);
 
-	// pad the output buffer to 4 bytes
-	if (result.size () & 0x3)
-		result.resize ((result.size () + 3) & ~0x3);
+	std::vector<Segment> segments;
 
-	return result;
-}
-
-/** @brief Auto-select compression
- *  @param[in]  src    Source buffer
- *  @param[in]  len    Source length
- *  @returns Compressed buffer
- */
-std::vector<uint8_t> compressAuto (const void *src, size_t len)
-{
-	std::vector<uint8_t> best;
-
-	static std::pair<std::vector<uint8_t> (*) (const void *, size_t), const char *>
-	    compress_funcs[] = {
-	        {&compressNone, "none"},
-	        {&lzssEncode, "lzss"},
-	        {&lz11Encode, "lz11"},
-	        {&huffEncode, "huff"},
-	        {&rleEncode, "rle"},
-	    };
-
-	const char *best_type = nullptr;
-
-	for (const auto &compress : compress_funcs)
+	// first chunk follows the chunk table
+	size_t offset = align (header.size () + chunks.size () * 16);
+	for (const auto &chunk : chunks)
 	{
-		std::vector<uint8_t> output = compress.first (src, len);
-
-		if (best.empty () || (!output.empty () && output.size () < best.size ()))
+		Segment segment = {image_data.data () + chunk.offset, chunk.size};
+		uint8_t type    = 0x00;
+		if (!chunk.uncompressed)
 		{
-			best.swap (output);
-			best_type = compress.second;
+			segment = {chunk.buffer.data (), chunk.buffer.size ()};
+			type    = chunk.buffer[0] & ~0x80;
 		}
+
+		encode::encodeChunk (type, offset, segment.size, chunk.size, header);
+
+		segments.push_back (segment);
+		segments.push_back ({padding, align (segment.size) - segment.size});
+		offset += align (segment.size);
 	}
 
-	std::printf ("Used %s for compression\n", best_type);
-	return best;
+	segments.insert (std::begin (segments),
+	    {
+	        {header.data (), header.size ()},
+	        {padding, align (header.size ()) - header.size ()},
+	    });
+
+	// tiles aren't reused from chunked output
+	layout.dataOffset = 0;
+	layout.dataSize   = 0;
+	layout.dataHash   = 0;
+
+	write_file (page_path (output_path, page), segments);
 }
 
-/** @brief Write image data
- *  @param[in] fp File handle
+/** @brief Write output data
+ *  @param[in] page Page number
  */
-void write_image_data (FILE *fp)
+void write_output_data (size_t page)
 {
-	std::vector<uint8_t> (*compress) (const void *, size_t) = nullptr;
+	// check if we need to output the data
+	if (output_path.empty ())
+		return;
 
-	// get the compression routine
-	switch (compression_format)
+	if (chunked)
 	{
-	case COMPRESSION_NONE:
-		compress = &compressNone;
-		break;
-
-	case COMPRESSION_LZ10:
-		compress = &lzssEncode;
-		break;
-
-	case COMPRESSION_LZ11:
-		compress = &lz11Encode;
-		break;
+		write_chunked_output (page);
+		return;
+	}
 
-	case COMPRESSION_RLE:
-		compress = &rleEncode;
-		break;
+	encode::Buffer header;
+	if (!output_raw)
+		header = tex3ds_header ();
 
-	case COMPRESSION_HUFF:
-		compress = &huffEncode;
-		break;
+	std::vector<uint8_t> buffer;
+	const bool uncompressed = compress_data (image_data.data (), image_data.size (), buffer);
 
-	case COMPRESSION_AUTO:
-		compress = &compressAuto;
-		break;
+	std::vector<Segment> segments = {
+	    {header.data (), header.size ()},
+	    {buffer.data (), buffer.size ()},
+	};
 
-	default:
-		// We should only get a valid type here
-		std::abort ();
-	}
+	size_t size   = buffer.size ();
+	uint64_t hash = fnv1a (buffer.data (), buffer.size ());
 
-	// compress data
-	std::vector<uint8_t> buffer = compress (image_data.data (), image_data.size ());
-	if (buffer.empty ())
+	if (uncompressed)
 	{
-		std::fclose (fp);
-		throw std::runtime_error ("Failed to compress data");
-	}
+		static const uint8_t padding[4] = {0, 0, 0, 0};
 
-	// output data
-	write_buffer (fp, buffer.data (), buffer.size ());
-}
+		const size_t pad = uncompressedSize (image_data.size ()) - size - image_data.size ();
 
-/** @brief Write output data
- */
-void write_output_data ()
-{
-	// check if we need to output the data
-	if (output_path.empty ())
-		return;
+		segments.push_back ({image_data.data (), image_data.size ()});
+		segments.push_back ({padding, pad});
 
-	FILE *fp = std::fopen (output_path.c_str (), "wb");
-	if (!fp)
-		throw std::runtime_error ("Failed to open output file");
-
-	if (!output_raw)
-		write_tex3ds_header (fp);
+		size += image_data.size () + pad;
+		hash = fnv1a (image_data.data (), image_data.size (), hash);
+		hash = fnv1a (padding, pad, hash);
+	}
 
-	write_image_data (fp);
+	// record data for the next incremental build
+	layout.dataOffset = header.size ();
+	layout.dataSize   = size;
+	layout.dataHash   = hash;
 
-	// close output file
-	std::fclose (fp);
+	write_file (page_path (output_path, page), segments);
 }
 
 /** @brief Sanitize identifier
@@ -1100,12 +1684,19 @@ void write_dependency ()
 	}
 
 	std::string target;
-	if (output_path.empty ())
-		target = header_path;
-	else if (header_path.empty ())
-		target = output_path;
-	else
-		target = output_path + ' ' + header_path;
+	for (size_t page = 0; !output_path.empty () && page < num_pages; ++page)
+	{
+		if (!target.empty ())
+			target += ' ';
+		target += page_path (output_path, page);
+	}
+
+	if (!header_path.empty ())
+	{
+		if (!target.empty ())
+			target += ' ';
+		target += header_path;
+	}
 
 	std::fprintf (fp, "%s:", target.c_str ());
 	for (const auto &dependency : dependencies)
@@ -1115,9 +1706,23 @@ void write_dependency ()
 	std::fclose (fp);
 }
 
+/** @brief Write untrimmed size and trim offset defines
+ *  @param[in] fp     Output header
+ *  @param[in] prefix Identifier prefix
+ *  @param[in] sub    Sub-image
+ */
+void write_trim_defines (FILE *fp, const std::string &prefix, const SubImage &sub)
+{
+	std::fprintf (fp, "#define %s_src_width %zu\n", prefix.c_str (), sub.srcWidth);
+	std::fprintf (fp, "#define %s_src_height %zu\n", prefix.c_str (), sub.srcHeight);
+	std::fprintf (fp, "#define %s_trim_left %zu\n", prefix.c_str (), sub.trimLeft);
+	std::fprintf (fp, "#define %s_trim_top %zu\n", prefix.c_str (), sub.trimTop);
+}
+
 /** @brief Write header
+ *  @param[in] subs Sub-images from every page
  */
-void write_header ()
+void write_header (const std::vector<SubImage> &subs)
 {
 	// check if we need to output the header
 	if (header_path.empty ())
@@ -1142,12 +1747,20 @@ void write_header ()
 
 	sanitize_identifier (header_path);
 
-	size_t i = 0;
-	for (const auto &sub : subimage_data)
+	if (multi_atlas)
+		std::fprintf (fp, "#define %s_pages %zu\n", header_path.c_str (), num_pages);
+
+	// sub-image indices are relative to their page
+	std::vector<size_t> count (num_pages);
+	for (const auto &sub : subs)
 	{
+		const size_t i = count[sub.page]++;
+
 		if (sub.name.empty ())
 		{
-			std::fprintf (fp, "#define %s_idx %zu\n", header_path.c_str (), i++);
+			std::fprintf (fp, "#define %s_idx %zu\n", header_path.c_str (), i);
+			if (trim)
+				write_trim_defines (fp, header_path, sub);
 			continue;
 		}
 
@@ -1159,18 +1772,92 @@ void write_header ()
 
 		sanitize_identifier (label);
 
-		label += "_idx";
-
 		if (label[0] != '_')
 			label.insert (0, 1, '_');
 
-		std::fprintf (fp, "#define %s%s %zu\n", header_path.c_str (), label.c_str (), i++);
+		std::fprintf (fp, "#define %s%s_idx %zu\n", header_path.c_str (), label.c_str (), i);
+
+		if (multi_atlas)
+		{
+			std::fprintf (
+			    fp, "#define %s%s_page %zu\n", header_path.c_str (), label.c_str (), sub.page);
+		}
+
+		if (trim)
+			write_trim_defines (fp, header_path + label, sub);
 	}
 
 	// close output header
 	std::fclose (fp);
 }
 
+/** @brief Get settings which affect the atlas layout
+ *  @returns Settings key
+ */
+std::string layout_settings ()
+{
+	return "tex3ds-" PACKAGE_VERSION " border=" + std::to_string (border) +
+	       " edge=" + std::to_string (edge) + " trim=" + std::to_string (trim);
+}
+
+/** @brief Get settings which affect tile encoding
+ *  @returns Settings key
+ *
+ *  @note Must be called after finalize_process_format ().
+ */
+std::string encoding_settings ()
+{
+	return "tex3ds-" PACKAGE_VERSION " format=" + std::to_string (process_format) +
+	       " quality=" + std::to_string (etc1_quality) + " rd=" + std::to_string (etc1_rd) +
+	       " mipmap=" + std::to_string (filter_type) + " bleed=" + std::to_string (bleed_mode);
+}
+
+/** @brief Load encoded tiles from the previous output for reuse
+ *  @param[in] previous Previous build state
+ */
+void load_previous_tiles (const Layout &previous)
+{
+	// the preview is produced while encoding, so every tile must be encoded
+	if (output_path.empty () || !preview_path.empty ())
+		return;
+
+	// rate-distortion choices depend on the preceding tiles
+	if (etc1_rd >= 0.0)
+		return;
+
+	// tiles are only reused from a single compressed blob
+	if (chunked)
+		return;
+
+	if (previous.encoding != encoding_settings () || previous.tiles.empty () ||
+	    !previous.dataSize)
+		return;
+
+	FILE *fp = std::fopen (output_path.c_str (), "rb");
+	if (!fp)
+		return;
+
+	encode::Buffer buffer (previous.dataSize);
+	const bool ok = std::fseek (fp, previous.dataOffset, SEEK_SET) == 0 &&
+	                std::fread (buffer.data (), 1, buffer.size (), fp) == buffer.size ();
+	std::fclose (fp);
+
+	// the output must still be the one the layout was recorded with
+	if (!ok || fnv1a (buffer.data (), buffer.size ()) != previous.dataHash)
+		return;
+
+	previous_data = decompress (buffer.data (), buffer.size ());
+	if (previous_data.size () % previous.tiles.size () != 0)
+	{
+		previous_data.clear ();
+		return;
+	}
+
+	previous_tile_size = previous_data.size () / previous.tiles.size ();
+	for (size_t i = 0; i < previous.tiles.size (); ++i)
+		previous_tiles.emplace (previous.tiles[i], i);
+}
+
 /** @brief Print version information */
 void print_version ()
 {
@@ -1205,20 +1892,45 @@ void print_usage (const char *prog)
 	    "    -H, --header <file>          Output C header to file\n"
 	    "    -h, --help                   Show this help message\n"
 	    "    -i, --include <file>         Include options from file\n"
+	    "    -j, --jobs <jobs>            Maximum number of threads. See \"Jobs\"\n"
+	    "    -l, --layout <file>          Build incrementally using layout file\n"
 	    "    -m, --mipmap <filter>        Generate mipmaps. See \"Mipmap Filter Options\"\n"
 	    "    -o, --output <output>        Output file\n"
 	    "    -p, --preview <preview>      Output preview file\n"
 	    "    -q, --quality <etc1-quality> ETC1 quality. Valid options: low, medium (default), high\n"
+	    "    -R, --etc1-rd <tolerance>    Trade ETC1 error for compression. See \"ETC1 Rate-Distortion\"\n"
 	    "    -r, --raw                    Output image data only\n"
 	    "    -t, --trim                   Trim input image(s)\n"
+	    "    -O, --trim-offsets           Record trim offsets in output (format extension)\n"
+	    "    -C, --chunked                Compress each mipmap level and face separately. See \"Chunked Output\"\n"
 	    "    -v, --version                Show version and copyright information\n"
 	    "    -z, --compress <compression> Compress output. See \"Compression Options\"\n"
+	    "    -L, --parallel-lz            Compress LZSS/LZ11 in parallel segments\n"
 	    "    -a, --atlas                  Generate texture atlas\n"
+	    "    -A, --multi-atlas            Generate texture atlas spanning multiple pages\n"
+	    "    -P, --pack <packer>          Atlas packing heuristic. See \"Packing Options\"\n"
+	    "    -S, --pack-sort <order>      Atlas packing order. See \"Packing Options\"\n"
+	    "    -T, --pack-time <ms>         Time budget for -P best (default 1000)\n"
 	    "    -c, --cubemap                Generate a cubemap. See \"Cubemap\"\n"
 	    "    -s, --skybox                 Generate a skybox. See \"Skybox\"\n"
 	    "    -b, --border <border-type>   Inserts a border around each image. See \"Border Options\"\n"
+	    "    -B, --bleed <bleed>          Color of invisible pixels. See \"Bleed Options\"\n"
+	    "        --stats                  Print time spent in each stage. See \"Statistics\"\n"
+	    "        --trace <file>           Write Chrome trace of each stage. See \"Statistics\"\n"
 	    "    <input>                      Input file\n\n"
 
+	    "  Packing Options:\n"
+	    "    -P contact           Corner points with most contact (default)\n"
+	    "    -P maxrects-bssf     MaxRects, best short side fit\n"
+	    "    -P maxrects-contact  MaxRects, contact point rule\n"
+	    "    -P skyline           Skyline, bottom-left rule\n"
+	    "    -P guillotine        Guillotine, best area fit\n"
+	    "    -P best              Try every packer and order in parallel within the time\n"
+	    "                         budget and keep the smallest atlas\n\n"
+
+	    "    -S area, -S perimeter, -S side, -S width, -S height\n"
+	    "      Place sprites in descending order of this measure (default area)\n\n"
+
 	    "  Format Options:\n"
 	    "    -f rgba, -f rgba8, -f rgba8888\n"
 	    "      32-bit RGBA (8-bit components) (default)\n\n"
@@ -1280,6 +1992,7 @@ void print_usage (const char *prog)
 	    "\n"
 	    "  Compression Options:\n"
 	    "    -z auto              Automatically select best compression (default)\n"
+	    "    -z auto-fast         Estimate compressed sizes and only try the best\n"
 	    "    -z none              No compression\n"
 	    "    -z huff, -z huffman  Huffman encoding\n"
 	    "    -z lzss, -z lz10     LZSS compression\n"
@@ -1298,11 +2011,33 @@ void print_usage (const char *prog)
 	    "      0x28: Huffman encoding\n"
 	    "      0x30: Run-length encoding\n\n"
 
+	    "  ETC1 Rate-Distortion:\n"
+	    "    With -R, each ETC1 block may be replaced by a recently output block, or by the\n"
+	    "    previous block's colors with new selectors, if its mean squared error per pixel\n"
+	    "    (0-255 RGB) increases by at most the tolerance. Repeated bytes compress better\n"
+	    "    with -z lzss and -z lz11. -R 0 only takes alternatives which are no worse.\n\n"
+
 		"  Border Options:\n"
 		"    -b none        No border (default)\n"
 		"    -b transparent 1px transparent shared border around images\n"
 		"    -b edge        1px color-matched unshared border around images\n\n"
 
+	    "  Bleed Options:\n"
+	    "    -B none        Keep the source color (default)\n"
+	    "    -B auto        Chosen by output format\n"
+	    "    -B constant    Black\n"
+	    "    -B dilate      Average color of the nearest visible pixels\n\n"
+
+	    "    A pixel is invisible if its alpha is 0 in the output format. With -B auto,\n"
+	    "    formats with color and alpha use dilate. Other formats are left alone.\n\n"
+
+	    "  Jobs:\n"
+	    "    tex3ds uses one thread per CPU, limited by -j and by the cgroup CPU quota.\n"
+	    "    When run by GNU make with -j, each thread after the first takes a token from\n"
+	    "    make's jobserver, so parallel tex3ds processes share the build's job budget.\n"
+	    "    Recipes must run tex3ds as a recursive make (a '+' prefix or $(MAKE) in the\n"
+	    "    command) for make to pass the jobserver on.\n\n"
+
 	    "  Cubemap:\n"
 	    "    A cubemap is generated from the input image in the following convention:\n"
 	    "    +----+----+---------+\n"
@@ -1324,27 +2059,47 @@ void print_usage (const char *prog)
 	    "    +----+----+---------+\n\n");
 }
 
+/** @brief Values of options without a short option */
+enum LongOption
+{
+	OPT_STATS = 256, ///< --stats
+	OPT_TRACE,       ///< --trace
+};
+
 /** @brief Program long options */
 const struct option long_options[] = {
     /* clang-format off */
-	{ "atlas",    no_argument,       nullptr, 'a', },
-	{ "border",   required_argument, nullptr, 'b', },
-	{ "cubemap",  no_argument,       nullptr, 'c', },
-	{ "depends",  required_argument, nullptr, 'd', },
-	{ "format",   required_argument, nullptr, 'f', },
-	{ "header",   required_argument, nullptr, 'H', },
-	{ "help",     no_argument,       nullptr, 'h', },
-	{ "include",  required_argument, nullptr, 'i', },
-	{ "mipmap",   required_argument, nullptr, 'm', },
-	{ "output",   required_argument, nullptr, 'o', },
-	{ "preview",  required_argument, nullptr, 'p', },
-	{ "quality",  required_argument, nullptr, 'q', },
-	{ "raw",      no_argument,       nullptr, 'r', },
-	{ "skybox",   no_argument,       nullptr, 's', },
-	{ "trim",     no_argument,       nullptr, 't', },
-	{ "version",  no_argument,       nullptr, 'v', },
-	{ "compress", required_argument, nullptr, 'z', },
-	{ nullptr,    no_argument,       nullptr,   0, },
+	{ "atlas",        no_argument,       nullptr, 'a', },
+	{ "bleed",        required_argument, nullptr, 'B', },
+	{ "border",       required_argument, nullptr, 'b', },
+	{ "chunked",      no_argument,       nullptr, 'C', },
+	{ "cubemap",      no_argument,       nullptr, 'c', },
+	{ "depends",      required_argument, nullptr, 'd', },
+	{ "etc1-rd",      required_argument, nullptr, 'R', },
+	{ "format",       required_argument, nullptr, 'f', },
+	{ "header",       required_argument, nullptr, 'H', },
+	{ "help",         no_argument,       nullptr, 'h', },
+	{ "include",      required_argument, nullptr, 'i', },
+	{ "jobs",         required_argument, nullptr, 'j', },
+	{ "layout",       required_argument, nullptr, 'l', },
+	{ "mipmap",       required_argument, nullptr, 'm', },
+	{ "output",       required_argument, nullptr, 'o', },
+	{ "preview",      required_argument, nullptr, 'p', },
+	{ "quality",      required_argument, nullptr, 'q', },
+	{ "raw",          no_argument,       nullptr, 'r', },
+	{ "skybox",       no_argument,       nullptr, 's', },
+	{ "trim",         no_argument,       nullptr, 't', },
+	{ "trim-offsets", no_argument,       nullptr, 'O', },
+	{ "version",      no_argument,       nullptr, 'v', },
+	{ "compress",     required_argument, nullptr, 'z', },
+	{ "multi-atlas",  no_argument,       nullptr, 'A', },
+	{ "parallel-lz",  no_argument,       nullptr, 'L', },
+	{ "pack",         required_argument, nullptr, 'P', },
+	{ "pack-sort",    required_argument, nullptr, 'S', },
+	{ "pack-time",    required_argument, nullptr, 'T', },
+	{ "stats",        no_argument,       nullptr, OPT_STATS, },
+	{ "trace",        required_argument, nullptr, OPT_TRACE, },
+	{ nullptr,        no_argument,       nullptr,   0, },
 	/* clang-format off */
 };
 
@@ -1456,7 +2211,7 @@ ParseStatus parseOptions (std::vector<char *> &args)
 	// parse options
 	while (
 	    (c = ::getopt_long (
-	         args.size (), args.data (), "d:f:H:hi:m:o:p:q:rs:tvz:", long_options, nullptr)) != -1)
+	         args.size (), args.data (), "AB:Cd:f:H:hi:j:Ll:m:Oo:P:p:q:R:rS:s:T:tvz:", long_options, nullptr)) != -1)
 	{
 		switch (c)
 		{
@@ -1465,6 +2220,12 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			process_mode = PROCESS_ATLAS;
 			break;
 
+		case 'A':
+			// multi-page atlas
+			process_mode = PROCESS_ATLAS;
+			multi_atlas  = true;
+			break;
+
 		case 'b':
 			// border
 			if (strcasecmp (optarg, "transparent") == 0)
@@ -1492,6 +2253,24 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			}
 			break;
 
+		case 'B':
+			// bleed
+			bleed_auto = false;
+			if (strcasecmp (optarg, "auto") == 0)
+				bleed_auto = true;
+			else if (strcasecmp (optarg, "none") == 0)
+				bleed_mode = BLEED_NONE;
+			else if (strcasecmp (optarg, "constant") == 0)
+				bleed_mode = BLEED_CONSTANT;
+			else if (strcasecmp (optarg, "dilate") == 0)
+				bleed_mode = BLEED_DILATE;
+			else
+			{
+				std::fprintf (stderr, "Invalid bleed option '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+			break;
+
 		case 'c':
 			// cubemap
 			process_mode = PROCESS_CUBEMAP;
@@ -1571,6 +2350,11 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			}
 			break;
 
+		case 'l':
+			// set layout path option
+			layout_path = getPath (optarg);
+			break;
+
 		case 'm':
 		{
 			// find matching mipmap filter type
@@ -1596,6 +2380,86 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			output_path = getPath (optarg);
 			break;
 
+		case 'P':
+		{
+			if (strcasecmp (optarg, "best") == 0)
+			{
+				pack_options.best = true;
+				break;
+			}
+
+			// find matching packing heuristic
+			auto heuristic = std::lower_bound (std::begin (heuristic_strings),
+			    std::end (heuristic_strings),
+			    optarg,
+			    HeuristicComparator ());
+
+			// set packing heuristic option
+			if (heuristic != std::end (heuristic_strings) &&
+			    strcasecmp (heuristic->first, optarg) == 0)
+			{
+				pack_options.heuristic = heuristic->second;
+				pack_options.best      = false;
+			}
+			else
+			{
+				std::fprintf (stderr, "Invalid packing heuristic '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+
+			break;
+		}
+
+		case 'S':
+		{
+			// find matching packing sort order
+			auto order = std::lower_bound (std::begin (sort_order_strings),
+			    std::end (sort_order_strings),
+			    optarg,
+			    SortOrderComparator ());
+
+			// set packing sort order option
+			if (order != std::end (sort_order_strings) && strcasecmp (order->first, optarg) == 0)
+				pack_options.order = order->second;
+			else
+			{
+				std::fprintf (stderr, "Invalid packing order '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+
+			break;
+		}
+
+		case 'T':
+		{
+			// set packing time budget option
+			char *end;
+			unsigned long budget = std::strtoul (optarg, &end, 10);
+			if (*optarg == 0 || *end != 0 || budget > UINT_MAX)
+			{
+				std::fprintf (stderr, "Invalid packing time budget '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+
+			pack_options.budget = budget;
+			break;
+		}
+
+		case 'j':
+		{
+			// set maximum number of threads
+			char *end;
+			unsigned long count = std::strtoul (optarg, &end, 10);
+			if (*optarg == 0 || *end != 0 || count == 0 || count > UINT_MAX)
+			{
+				std::fprintf (stderr, "Invalid number of jobs '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+
+			jobs::setMaximum (count);
+			break;
+		}
+
 		case 'p':
 			// set preview path option
 			preview_path = getPath (optarg);
@@ -1616,6 +2480,21 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			}
 			break;
 
+		case 'R':
+		{
+			// set ETC1 rate-distortion tolerance
+			char *end;
+			double tolerance = std::strtod (optarg, &end);
+			if (*optarg == 0 || *end != 0 || !(tolerance >= 0.0))
+			{
+				std::fprintf (stderr, "Invalid ETC1 rate-distortion tolerance '%s'\n", optarg);
+				return PARSE_FAILURE;
+			}
+
+			etc1_rd = tolerance;
+			break;
+		}
+
 		case 'r':
 			// output raw image data
 			output_raw = true;
@@ -1631,6 +2510,21 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			trim = true;
 			break;
 
+		case 'C':
+			// chunked container
+			chunked = true;
+			break;
+
+		case 'O':
+			// record trim offsets
+			trim_offsets = true;
+			break;
+
+		case 'L':
+			// parallel LZ compression
+			parallel_lz = true;
+			break;
+
 		case 'v':
 			// print version
 			print_version ();
@@ -1656,6 +2550,16 @@ ParseStatus parseOptions (std::vector<char *> &args)
 			break;
 		}
 
+		case OPT_STATS:
+			// print statistics
+			stats::enable ();
+			break;
+
+		case OPT_TRACE:
+			// write trace file
+			stats::setTracePath (getPath (optarg));
+			break;
+
 		default:
 			std::fprintf (stderr, "Invalid option '%c'\n", optopt);
 			return PARSE_FAILURE;
@@ -1671,6 +2575,18 @@ ParseStatus parseOptions (std::vector<char *> &args)
 		return PARSE_FAILURE;
 	}
 
+	if (chunked && output_raw)
+	{
+		std::fprintf (stderr, "--chunked cannot be used with --raw\n");
+		return PARSE_FAILURE;
+	}
+
+	if (!layout_path.empty () && multi_atlas)
+	{
+		std::fprintf (stderr, "--layout cannot be used with --multi-atlas\n");
+		return PARSE_FAILURE;
+	}
+
 	while (static_cast<size_t> (optind) < args.size ())
 	{
 		std::string path = getPath (args[optind++]);
@@ -1692,6 +2608,9 @@ int main (int argc, char *argv[])
 {
 	prog = argv[0];
 
+	// before anything opens a file which could reuse the jobserver's descriptors
+	jobs::init ();
+
 	std::setvbuf (stdout, nullptr, _IOLBF, 0);
 	std::setvbuf (stderr, nullptr, _IOLBF, 0);
 
@@ -1721,13 +2640,42 @@ int main (int argc, char *argv[])
 
 	try
 	{
-		std::vector<Magick::Image> images;
+		// load the previous build state
+		Layout previous;
+		if (!layout_path.empty () && (!previous.read (layout_path) ||
+		                                 previous.settings != layout_settings ()))
+			previous = Layout ();
+
+		std::vector<Page> pages;
 		if (process_mode == PROCESS_ATLAS)
 		{
-			Atlas atlas (Atlas::build (input_files, trim, border, edge));
-			subimage_data.swap (atlas.subs);
+			const AtlasLayout *previous_atlas = nullptr;
+			if (!previous.atlas.sprites.empty ())
+				previous_atlas = &previous.atlas;
+
+			std::vector<Atlas> atlases;
+			if (multi_atlas)
+				atlases = Atlas::buildPages (input_files, trim, border, edge, pack_options);
+			else
+			{
+				atlases.emplace_back (Atlas::build (
+				    input_files, trim, border, edge, pack_options, previous_atlas));
+			}
+
+			layout.atlas = atlases.front ().layout;
+
+			for (auto &atlas : atlases)
+			{
+				stats::Span span ("load");
 
-			images = load_image (atlas.img);
+				Page page;
+				page.images = load_image (atlas.img);
+				page.subs.swap (atlas.subs);
+				page.width  = output_width;
+				page.height = output_height;
+
+				pages.emplace_back (std::move (page));
+			}
 		}
 		else if (input_files.size () > 1)
 		{
@@ -1736,32 +2684,94 @@ int main (int argc, char *argv[])
 		}
 		else
 		{
-			Magick::Image img (input_files[0]);
+			Magick::Image img;
+			{
+				stats::Span span ("load");
+				img.read (input_files[0]);
+			}
 
 			if (trim)
+			{
+				stats::Span span ("trim");
 				img = applyTrim (img);
+			}
 
 			if (edge)
+			{
+				stats::Span span ("edge");
 				applyEdge (img);
+			}
 
-			images = load_image (img);
+			Page page;
+			{
+				stats::Span span ("load");
+				page.images = load_image (img);
+			}
+			page.subs.swap (subimage_data);
+			page.width  = output_width;
+			page.height = output_height;
+
+			pages.emplace_back (std::move (page));
 		}
 
-		// finalize process format
+		num_pages = pages.size ();
+
+		// finalize process format; every page shares the same format
+		std::vector<Magick::Image> images;
+		for (const auto &page : pages)
+			images.insert (std::end (images), std::begin (page.images), std::end (page.images));
+
 		finalize_process_format (images);
+		finalize_bleed_mode ();
+
+		if (!layout_path.empty ())
+			load_previous_tiles (previous);
 
-		// process each sub-image
-		for (size_t i = 0; i < images.size (); ++i)
-			process_image (images[i]);
+		std::vector<SubImage> subs;
+		for (size_t i = 0; i < pages.size (); ++i)
+		{
+			subimage_data.swap (pages[i].subs);
+			output_width  = pages[i].width;
+			output_height = pages[i].height;
+			image_data.clear ();
+			chunks.clear ();
+			start_compression ();
+
+			// process each sub-image
+			for (auto &img : pages[i].images)
+			{
+				if (num_pages > 1)
+					img.comment ("page" + std::to_string (i) + "_" + img.comment ());
+
+				process_image (img);
+			}
 
-		// write output data
-		write_output_data ();
+			// write output data
+			write_output_data (i);
+
+			subs.insert (std::end (subs), std::begin (subimage_data), std::end (subimage_data));
+		}
+
+		{
+			stats::Span span ("output");
 
-		// write dependency file
-		write_dependency ();
+			// write dependency file
+			write_dependency ();
 
-		// write header
-		write_header ();
+			// write header
+			write_header (subs);
+		}
+
+		// write layout for the next incremental build
+		if (!layout_path.empty ())
+		{
+			if (stats::enabled ())
+				std::printf ("Reused %zu/%zu tiles\n", reused_tiles.load (), layout.tiles.size ());
+
+			layout.settings = layout_settings ();
+			layout.encoding = encoding_settings ();
+			layout.write (layout_path);
+		}
 	}
 	catch (const std::exception &e)
 	{
@@ -1773,5 +2783,8 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (!stats::report ())
+		return EXIT_FAILURE;
+
 	return EXIT_SUCCESS;
 }
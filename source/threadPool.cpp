@@ -22,51 +22,326 @@
  */
 
 #include "threadPool.h"
+#include "jobs.h"
+#include "stats.h"
 
+#include <algorithm>
 #include <condition_variable>
-#include <mutex>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <thread>
 #include <vector>
 
 namespace
 {
+/** @brief Bounded lock-free multi-producer multi-consumer queue
+ *
+ *  @details
+ *  Dmitry Vyukov's bounded MPMC queue. Each cell has a sequence number which
+ *  tells producers and consumers whether the cell is free or full for their
+ *  position, so a push or pop only takes one compare-and-swap.
+ */
+class TaskQueue
+{
+public:
+	/** @brief Constructor
+	 *  @param[in] capacity Queue capacity
+	 */
+	explicit TaskQueue (size_t capacity) : cells (new Cell[capacity]), capacity (capacity)
+	{
+		for (size_t i = 0; i < capacity; ++i)
+			cells[i].sequence.store (i, std::memory_order_relaxed);
+	}
+
+	/** @brief Push a task
+	 *  @param[in] task Task to push; moved from on success
+	 *  @returns Whether there was room
+	 */
+	bool push (ThreadPool::Task &task)
+	{
+		size_t pos = tail.load (std::memory_order_relaxed);
+		while (true)
+		{
+			Cell &cell      = cells[pos % capacity];
+			const size_t seq = cell.sequence.load (std::memory_order_acquire);
+			const intptr_t diff =
+			    static_cast<intptr_t> (seq) - static_cast<intptr_t> (pos);
+
+			if (diff == 0)
+			{
+				if (tail.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.task = std::move (task);
+					cell.sequence.store (pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false; // full
+			else
+				pos = tail.load (std::memory_order_relaxed);
+		}
+	}
+
+	/** @brief Pop a task
+	 *  @param[out] task Popped task
+	 *  @returns Whether there was a task
+	 */
+	bool pop (ThreadPool::Task &task)
+	{
+		size_t pos = head.load (std::memory_order_relaxed);
+		while (true)
+		{
+			Cell &cell      = cells[pos % capacity];
+			const size_t seq = cell.sequence.load (std::memory_order_acquire);
+			const intptr_t diff =
+			    static_cast<intptr_t> (seq) - static_cast<intptr_t> (pos + 1);
+
+			if (diff == 0)
+			{
+				if (head.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+				{
+					task = std::move (cell.task);
+					cell.sequence.store (pos + capacity, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false; // empty
+			else
+				pos = head.load (std::memory_order_relaxed);
+		}
+	}
+
+private:
+	/** @brief Queue cell */
+	struct Cell
+	{
+		std::atomic<size_t> sequence; ///< Sequence number
+		ThreadPool::Task task;        ///< Task
+	};
+
+	std::unique_ptr<Cell[]> cells; ///< Cells
+	const size_t capacity;         ///< Queue capacity
+	char pad0[64];                 ///< Keep producers and consumers on separate cache lines
+	std::atomic<size_t> tail{0};   ///< Push position
+	char pad1[64];                 ///< Keep producers and consumers on separate cache lines
+	std::atomic<size_t> head{0};   ///< Pop position
+};
+
+/** @brief Bounded lock-free work-stealing deque
+ *
+ *  @details
+ *  The Chase-Lev deque, with the memory orders of Le et al., "Correct and
+ *  Efficient Work-Stealing for Weak Memory Models". Only the owning worker
+ *  pushes and pops, at the bottom, so it runs its newest task first; other
+ *  threads steal the oldest task from the top.
+ *
+ *  A thief moves its task out of the cell after it has claimed it, so each
+ *  cell also records whether it still holds a task; the owner treats a cell
+ *  which hasn't been emptied yet as full.
+ */
+class TaskDeque
+{
+public:
+	TaskDeque () : cells (new Cell[CAPACITY])
+	{
+	}
+
+	/** @brief Push a task; owner only
+	 *  @param[in] task Task to push; moved from on success
+	 *  @returns Whether there was room
+	 */
+	bool push (ThreadPool::Task &task)
+	{
+		const int64_t b = bottom.load (std::memory_order_relaxed);
+		const int64_t t = top.load (std::memory_order_acquire);
+		if (b - t >= static_cast<int64_t> (CAPACITY))
+			return false;
+
+		Cell &cell = cells[b % CAPACITY];
+		if (cell.full.load (std::memory_order_acquire))
+			return false; // a thief is still moving its task out
+
+		cell.task = std::move (task);
+		cell.full.store (true, std::memory_order_relaxed);
+
+		// publishes the task to thieves
+		bottom.store (b + 1, std::memory_order_release);
+		return true;
+	}
+
+	/** @brief Pop the newest task; owner only
+	 *  @param[out] task Popped task
+	 *  @returns Whether there was a task
+	 */
+	bool pop (ThreadPool::Task &task)
+	{
+		const int64_t b = bottom.load (std::memory_order_relaxed) - 1;
+		bottom.store (b, std::memory_order_relaxed);
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		int64_t t = top.load (std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			// empty
+			bottom.store (b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (t == b)
+		{
+			// last task; race the thieves for it
+			const bool won = top.compare_exchange_strong (
+			    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store (b + 1, std::memory_order_relaxed);
+			if (!won)
+				return false;
+		}
+
+		take (cells[b % CAPACITY], task);
+		return true;
+	}
+
+	/** @brief Steal the oldest task
+	 *  @param[out] task Stolen task
+	 *  @returns Whether a task was stolen; false if empty or another thread took it
+	 */
+	bool steal (ThreadPool::Task &task)
+	{
+		int64_t t = top.load (std::memory_order_acquire);
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		const int64_t b = bottom.load (std::memory_order_acquire);
+
+		if (t >= b)
+			return false;
+
+		if (!top.compare_exchange_strong (
+		        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return false;
+
+		take (cells[t % CAPACITY], task);
+		return true;
+	}
+
+private:
+	/** @brief Deque capacity */
+	static constexpr size_t CAPACITY = 256;
+
+	/** @brief Deque cell */
+	struct Cell
+	{
+		std::atomic<bool> full{false}; ///< Whether the cell still holds a task
+		ThreadPool::Task task;         ///< Task
+	};
+
+	/** @brief Move a claimed task out of its cell
+	 *  @param[in]  cell Cell
+	 *  @param[out] task Task
+	 */
+	static void take (Cell &cell, ThreadPool::Task &task)
+	{
+		task = std::move (cell.task);
+		cell.full.store (false, std::memory_order_release);
+	}
+
+	std::unique_ptr<Cell[]> cells;  ///< Cells
+	char pad0[64];                  ///< Keep the owner and thieves on separate cache lines
+	std::atomic<int64_t> bottom{0}; ///< Owner position
+	char pad1[64];                  ///< Keep the owner and thieves on separate cache lines
+	std::atomic<int64_t> top{0};    ///< Steal position
+};
+
+/** @brief Index of the current thread's deque; NO_WORKER if not a worker */
+constexpr size_t NO_WORKER = std::numeric_limits<size_t>::max ();
+thread_local size_t self   = NO_WORKER;
+
+std::unique_ptr<jobs::Slots> slots;
 std::vector<std::thread> threads;
-std::queue<std::function<void (void)>> jobs;
+std::vector<std::unique_ptr<TaskDeque>> deques; // one per worker
+std::unique_ptr<TaskQueue> injected;            // tasks from non-workers
+std::atomic<size_t> queued (0);                 // number of queued tasks
+std::atomic<size_t> sleeping (0);               // number of threads waiting on wake
 std::mutex mutex;
-std::condition_variable newJob;
-std::condition_variable jobTaken;
+std::condition_variable wake;
 bool quit = false;
 
-void worker ()
+/** @brief Take a queued task
+ *  @param[out] task Task
+ *  @returns Whether a task was taken
+ *
+ *  @note A worker takes its own newest task first, so while it waits for a
+ *  group it runs the children it just submitted before any older work. Then
+ *  tasks from non-workers are taken, oldest first, and finally the oldest task
+ *  of another worker is stolen.
+ */
+bool takeQueued (ThreadPool::Task &task)
 {
-	while (true)
+	if (self != NO_WORKER && deques[self]->pop (task))
+		return true;
+
+	if (injected->pop (task))
+		return true;
+
+	const size_t start = self == NO_WORKER ? 0 : self + 1;
+	for (size_t i = 0; i < deques.size (); ++i)
 	{
-		std::function<void (void)> job;
+		const size_t victim = (start + i) % deques.size ();
+		if (victim != self && deques[victim]->steal (task))
+			return true;
+	}
 
-		{
-			std::unique_lock<std::mutex> lock (mutex);
-			while (!quit && jobs.empty ())
-				newJob.wait (lock);
+	return false;
+}
 
-			if (quit)
-				return;
+/** @brief Run a queued task
+ *  @returns Whether a task was run
+ */
+bool runQueued ()
+{
+	ThreadPool::Task task;
+	if (!takeQueued (task))
+		return false;
 
-			job = std::move (jobs.front ());
-			jobs.pop ();
-		}
+	queued.fetch_sub (1);
+	task.run ();
+	return true;
+}
 
-		jobTaken.notify_one ();
+void worker (size_t index)
+{
+	self = index;
+	stats::threadName ("pool");
 
-		job ();
+	while (true)
+	{
+		if (runQueued ())
+			continue;
+
+		std::unique_lock<std::mutex> lock (mutex);
+		++sleeping;
+		wake.wait (lock, [] { return quit || queued.load () != 0; });
+		--sleeping;
+
+		if (quit)
+			return;
 	}
-};
+}
 
 std::once_flag initOnce;
 void init ()
 {
-	const auto numThreads = std::max (1u, std::thread::hardware_concurrency ());
-	for (unsigned i = 0; i < numThreads; ++i)
-		threads.emplace_back (worker);
+	// the workers hold their job slots until the pool is destroyed
+	slots.reset (new jobs::Slots (jobs::concurrency ()));
+
+	for (size_t i = 0; i < slots->size (); ++i)
+		deques.emplace_back (new TaskDeque ());
+
+	injected.reset (new TaskQueue (256 * slots->size ()));
+
+	for (size_t i = 0; i < slots->size (); ++i)
+		threads.emplace_back (worker, i);
 }
 }
 
@@ -79,29 +354,163 @@ ThreadPool::~ThreadPool ()
 		quit = true;
 	}
 
-	newJob.notify_all ();
+	wake.notify_all ();
 
 	for (auto &thread : threads)
 		thread.join ();
+
+	slots.reset ();
 }
 
 ThreadPool::ThreadPool ()
 {
 }
 
-void ThreadPool::pushJob (std::function<void (void)> &&job)
+size_t ThreadPool::size ()
 {
 	std::call_once (initOnce, init);
+	return threads.size ();
+}
+
+void ThreadPool::push (Task &&task)
+{
+	std::call_once (initOnce, init);
+
+	// count the task before it is visible, so a worker which pops it can't take
+	// queued below zero
+	queued.fetch_add (1);
 
+	// a worker's own deque may be full; then the task goes to the shared queue
+	if ((self != NO_WORKER && deques[self]->push (task)) || injected->push (task))
 	{
-		std::unique_lock<std::mutex> lock (mutex);
+		// a sleeping thread may have checked for tasks before this one was queued
+		if (sleeping.load () != 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock (mutex);
+			}
+			wake.notify_all ();
+		}
 
-		// block while there's many outstanding jobs
-		while (jobs.size () > threads.size () * 2)
-			jobTaken.wait (lock);
+		return;
+	}
 
-		jobs.emplace (std::move (job));
+	// every queue is full
+	queued.fetch_sub (1);
+	task.run ();
+}
+
+bool ThreadPool::runOne ()
+{
+	return runQueued ();
+}
+
+void ThreadPool::idle (const TaskGroup &group)
+{
+	std::unique_lock<std::mutex> lock (mutex);
+	++sleeping;
+	wake.wait (lock, [&] { return group.pending.load () == 0 || queued.load () != 0; });
+	--sleeping;
+}
+
+void ThreadPool::complete (TaskGroup *group, std::exception_ptr error)
+{
+	if (error)
+	{
+		std::lock_guard<std::mutex> lock (group->mutex);
+		if (!group->error)
+			group->error = error;
 	}
 
-	newJob.notify_one ();
+	// the group may be destroyed as soon as pending reaches 0
+	if (group->pending.fetch_sub (1) != 1)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+	}
+	wake.notify_all ();
+}
+
+ThreadPool::Task::Task (Task &&other) noexcept : ops (other.ops), group (other.group)
+{
+	if (ops)
+		ops (OP_MOVE, &other, this);
+
+	other.ops = nullptr;
+}
+
+ThreadPool::Task &ThreadPool::Task::operator= (Task &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	reset ();
+
+	ops   = other.ops;
+	group = other.group;
+	if (ops)
+		ops (OP_MOVE, &other, this);
+
+	other.ops = nullptr;
+	return *this;
+}
+
+ThreadPool::Task::~Task ()
+{
+	reset ();
+}
+
+void ThreadPool::Task::reset ()
+{
+	if (ops)
+		ops (OP_DESTROY, this, nullptr);
+
+	ops = nullptr;
+}
+
+void ThreadPool::Task::run ()
+{
+	std::exception_ptr error;
+	try
+	{
+		ops (OP_RUN, this, nullptr);
+	}
+	catch (...)
+	{
+		error = std::current_exception ();
+	}
+
+	reset ();
+	complete (group, error);
+}
+
+TaskGroup::~TaskGroup ()
+{
+	try
+	{
+		wait ();
+	}
+	catch (...)
+	{
+		// exceptions are only reported by an explicit wait ()
+	}
+}
+
+void TaskGroup::wait ()
+{
+	// help instead of blocking while there are queued tasks
+	while (pending.load () != 0)
+	{
+		if (!ThreadPool::runOne ())
+			ThreadPool::idle (*this);
+	}
+
+	std::lock_guard<std::mutex> lock (mutex);
+	if (error)
+	{
+		std::exception_ptr rethrow = error;
+		error                      = nullptr;
+		std::rethrow_exception (rethrow);
+	}
 }
@@ -23,6 +23,32 @@
 
 #include "utility.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+/** @brief Image attribute holding the untrimmed size and trim offset */
+const char *const TRIM_ATTRIBUTE = "tex3ds:trim";
+
+/** @brief Record the untrimmed size and trim offset
+ *  @param[in] img    Image to update
+ *  @param[in] width  Untrimmed width
+ *  @param[in] height Untrimmed height
+ *  @param[in] left   Left offset of the trimmed image
+ *  @param[in] top    Top offset of the trimmed image
+ */
+void setTrim (Magick::Image &img, size_t width, size_t height, size_t left, size_t top)
+{
+	char buffer[128];
+	std::snprintf (buffer, sizeof (buffer), "%zu %zu %zu %zu", width, height, left, top);
+	img.attribute (TRIM_ATTRIBUTE, buffer);
+}
+}
+
 Magick::Image applyTrim (Magick::Image &img)
 {
 	Magick::Image copy = img;
@@ -30,7 +56,17 @@ Magick::Image applyTrim (Magick::Image &img)
 	try
 	{
 		img.trim ();
+
+		// trim() leaves the position within the original canvas in the page offsets
+		ssize_t left = img.page ().xOff () - copy.page ().xOff ();
+		ssize_t top  = img.page ().yOff () - copy.page ().yOff ();
+
 		img.page (Magick::Geometry (img.columns (), img.rows ()));
+		setTrim (img,
+		    copy.columns (),
+		    copy.rows (),
+		    std::max<ssize_t> (left, 0),
+		    std::max<ssize_t> (top, 0));
 		return img;
 	}
 	catch (...)
@@ -65,5 +101,160 @@ void applyEdge (Magick::Image &img)
 
 	cache.sync ();
 
+	// the edge is not part of the untrimmed image
+	std::string trim = img.attribute (TRIM_ATTRIBUTE);
+	if (trim.empty ())
+		setTrim (edged, img.columns (), img.rows (), 0, 0);
+	else
+		edged.attribute (TRIM_ATTRIBUTE, trim);
+
 	img = edged;
 }
+
+size_t applyBleed (Magick::Image &img, BleedMode mode, unsigned alphaBits)
+{
+	using Magick::Quantum;
+
+	if (mode == BLEED_NONE)
+		return 0;
+
+	const size_t width     = img.columns ();
+	const size_t height    = img.rows ();
+	const double threshold = (QuantumRange + 1.0) / (1u << alphaBits);
+
+	Pixels cache (img);
+	PixelPacket p = cache.get (0, 0, width, height);
+
+	std::vector<Magick::Quantum> rgb (width * height * 3);
+	std::vector<bool> known (width * height);
+	std::vector<size_t> invisible;
+
+	for (size_t i = 0; i < width * height; ++i)
+	{
+		Magick::Color c = p[i];
+		rgb[i * 3 + 0]  = quantumRed (c);
+		rgb[i * 3 + 1]  = quantumGreen (c);
+		rgb[i * 3 + 2]  = quantumBlue (c);
+
+		if (quantumAlpha (c) < threshold)
+			invisible.emplace_back (i);
+		else
+			known[i] = true;
+	}
+
+	if (invisible.empty ())
+		return 0;
+
+	// dilation needs something to dilate
+	if (invisible.size () == width * height)
+		mode = BLEED_CONSTANT;
+
+	auto neighbors = [&](size_t i, const std::function<void (size_t)> &fn) {
+		const size_t x = i % width;
+		const size_t y = i / width;
+
+		for (size_t ny = (y ? y - 1 : y); ny <= std::min (y + 1, height - 1); ++ny)
+		{
+			for (size_t nx = (x ? x - 1 : x); nx <= std::min (x + 1, width - 1); ++nx)
+			{
+				if (nx != x || ny != y)
+					fn (ny * width + nx);
+			}
+		}
+	};
+
+	if (mode == BLEED_CONSTANT)
+	{
+		for (const auto &i : invisible)
+			std::fill_n (&rgb[i * 3], 3, 0);
+	}
+	else
+	{
+		// each pass colors the invisible pixels next to colored pixels
+		std::vector<bool> queued (known);
+		std::vector<size_t> frontier;
+		for (const auto &i : invisible)
+		{
+			neighbors (i, [&](size_t n) {
+				if (known[n] && !queued[i])
+				{
+					queued[i] = true;
+					frontier.emplace_back (i);
+				}
+			});
+		}
+
+		std::vector<Magick::Quantum> colors;
+		while (!frontier.empty ())
+		{
+			colors.clear ();
+			for (const auto &i : frontier)
+			{
+				double sum[3] = {0.0, 0.0, 0.0};
+				size_t count  = 0;
+				neighbors (i, [&](size_t n) {
+					if (!known[n])
+						return;
+
+					for (size_t c = 0; c < 3; ++c)
+						sum[c] += rgb[n * 3 + c];
+					++count;
+				});
+
+				for (size_t c = 0; c < 3; ++c)
+					colors.emplace_back (sum[c] / count + 0.5);
+			}
+
+			std::vector<size_t> next;
+			for (size_t j = 0; j < frontier.size (); ++j)
+			{
+				const size_t i = frontier[j];
+				std::copy_n (&colors[j * 3], 3, &rgb[i * 3]);
+				known[i] = true;
+
+				neighbors (i, [&](size_t n) {
+					if (!queued[n])
+					{
+						queued[n] = true;
+						next.emplace_back (n);
+					}
+				});
+			}
+
+			frontier.swap (next);
+		}
+	}
+
+	for (const auto &i : invisible)
+	{
+		Magick::Color c = p[i];
+		quantumRed (c, rgb[i * 3 + 0]);
+		quantumGreen (c, rgb[i * 3 + 1]);
+		quantumBlue (c, rgb[i * 3 + 2]);
+		p[i] = c;
+	}
+
+	cache.sync ();
+
+	return invisible.size ();
+}
+
+void getTrim (const Magick::Image &img, SubImage &sub)
+{
+	sub.srcWidth  = img.columns ();
+	sub.srcHeight = img.rows ();
+	sub.trimLeft  = 0;
+	sub.trimTop   = 0;
+
+	std::string trim = img.attribute (TRIM_ATTRIBUTE);
+	if (trim.empty ())
+		return;
+
+	if (std::sscanf (trim.c_str (),
+	        "%zu %zu %zu %zu",
+	        &sub.srcWidth,
+	        &sub.srcHeight,
+	        &sub.trimLeft,
+	        &sub.trimTop) != 4)
+		throw std::runtime_error ("Invalid trim attribute");
+}